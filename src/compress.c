@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "compress.h"
+#include "pagealloc.h"
+#include "spill.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+// Страница сжимается, только если экономит хотя бы четверть
+#define COMPRESSED_LIMIT (FILE_PAGE_SIZE - FILE_PAGE_SIZE / 4)
+
+// LZ ---------------------------------------------------------------------------
+
+static uint32_t read32(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Длина сверх 15 дописывается байтами: 255, 255, ..., остаток
+static bool put_length(char **op, const char *end, size_t length) {
+    while (length >= 255) {
+        if (*op >= end) return false;
+        *(*op)++ = (char)255;
+        length -= 255;
+    }
+    if (*op >= end) return false;
+    *(*op)++ = (char)length;
+    return true;
+}
+
+// match_length == 0 - последняя последовательность, только литералы
+static bool emit_sequence(char **op, const char *end, const char *literals, size_t literal_length,
+                          size_t offset, size_t match_length) {
+    if (*op >= end) return false;
+    char *token = (*op)++;
+    size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+    *token = (char)(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_length >= 15 && !put_length(op, end, literal_length - 15)) return false;
+    if ((size_t)(end - *op) < literal_length) return false;
+    memcpy(*op, literals, literal_length);
+    *op += literal_length;
+    if (match_length == 0) return true;
+
+    if (end - *op < 2) return false;
+    *(*op)++ = (char)(offset & 0xFF);
+    *(*op)++ = (char)(offset >> 8);
+    if (match_code >= 15 && !put_length(op, end, match_code - 15)) return false;
+    return true;
+}
+
+size_t lz_compress(const char *in, size_t size, char *out, size_t capacity) {
+    int32_t table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+    char *op = out;
+    const char *end = out + capacity;
+    size_t ip = 0;
+    size_t anchor = 0;
+
+    while (ip + LZ_MIN_MATCH <= size) {
+        uint32_t sequence = read32(in + ip);
+        uint32_t hash = lz_hash(sequence);
+        int32_t ref = table[hash];
+        table[hash] = (int32_t)ip;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || read32(in + ref) != sequence) {
+            ip++;
+            continue;
+        }
+        size_t length = LZ_MIN_MATCH;
+        while (ip + length < size && in[ref + length] == in[ip + length]) length++;
+        if (!emit_sequence(&op, end, in + anchor, ip - anchor, ip - ref, length)) return 0;
+        ip += length;
+        anchor = ip;
+    }
+    if (!emit_sequence(&op, end, in + anchor, size - anchor, 0, 0)) return 0;
+    return op - out;
+}
+
+static bool get_length(const unsigned char **ip, const unsigned char *end, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= end) return false;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz_decompress(const char *in, size_t size, char *out, size_t out_size) {
+    const unsigned char *ip = (const unsigned char *)in;
+    const unsigned char *in_end = ip + size;
+    char *op = out;
+    char *out_end = out + out_size;
+
+    while (ip < in_end) {
+        unsigned int token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !get_length(&ip, in_end, &literal_length)) return false;
+        if ((size_t)(in_end - ip) < literal_length || (size_t)(out_end - op) < literal_length) return false;
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+        if (ip == in_end) break;
+
+        if (in_end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !get_length(&ip, in_end, &match_length)) return false;
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || (size_t)(out_end - op) < match_length) return false;
+        // Совпадение может перекрываться с выводом, поэтому побайтно
+        const char *match = op - offset;
+        for (size_t i = 0; i < match_length; i++) op[i] = match[i];
+        op += match_length;
+    }
+    return op == out_end;
+}
+
+// Страницы ------------------------------------------------------------------------
+
+// Разжатие в кэш происходит под блокировкой чтения fs, поэтому читатели
+// сериализуются здесь
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Зовётся из read_node под блокировкой чтения, так что одну страницу
+// трогают несколько потоков сразу. Время берётся из часов запроса
+// (current_time), а поля пишутся, только если меняются, чтобы горячая
+// страница не гоняла кэш-линию между ядрами.
+void touch_page(DataPage *page) {
+    uint32_t now = (uint32_t)current_time().tv_sec;
+    if (__atomic_load_n(&page->last_access, __ATOMIC_RELAXED) != now) {
+        __atomic_store_n(&page->last_access, now, __ATOMIC_RELAXED);
+    }
+    if (!__atomic_load_n(&page->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&page->referenced, true, __ATOMIC_RELAXED);
+    }
+}
+
+// Данные страницы для чтения; сжатая страница разжимается и кэшируется,
+// выгруженная читается из файла подкачки
+char* load_page_data(DataPage *page) {
+    char *data = __atomic_load_n(&page->data, __ATOMIC_ACQUIRE);
+    if (data) return data;
+
+    pthread_mutex_lock(&cache_lock);
+    data = page->data;
+    if (data == NULL && page->spilled) {
+        data = spill_page_in(page);
+    } else if (data == NULL) {
+        data = alloc_page_data();
+        if (data && !lz_decompress(page->zdata, page->zsize, data, FILE_PAGE_SIZE)) {
+            fprintf(stderr, "Ошибка: Повреждена сжатая страница.\n");
+            free_page_data(data);
+            data = NULL;
+        }
+        if (data) {
+            data_stats.cached_pages++;
+            __atomic_store_n(&page->data, data, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return data;
+}
+
+// Упреждающее чтение под блокировкой чтения fs: сжатые страницы разжимаются,
+// выгруженные подкачиваются; страницы в памяти пропускаются сразу
+size_t prefetch_pages(Inode *node, size_t first, size_t count) {
+    if (!is_file(node) || node->data == NULL) return 0;
+    FileData *file = node->data;
+    size_t loaded = 0;
+    for (size_t i = first; i < first + count && i < file->num_pages; i++) {
+        DataPage *page = file->pages[i];
+        if (page == NULL || __atomic_load_n(&page->data, __ATOMIC_ACQUIRE)) continue;
+        if (load_page_data(page)) loaded++;
+    }
+    return loaded;
+}
+
+// Перед записью на месте: сжатая копия больше не нужна (под блокировкой записи)
+bool make_page_hot(DataPage *page) {
+    if (load_page_data(page) == NULL) return false;
+    if (page->zdata == NULL) return true;
+    free(page->zdata);
+    page->zdata = NULL;
+    data_stats.compressed_pages--;
+    data_stats.compressed_bytes -= page->zsize;
+    data_stats.cached_pages--;
+    page->zsize = 0;
+    return true;
+}
+
+static bool compress_page(DataPage *page, char *buf) {
+    size_t size = lz_compress(page->data, FILE_PAGE_SIZE, buf, COMPRESSED_LIMIT);
+    if (size == 0) {
+        page->incompressible = true;
+        return false;
+    }
+    char *zdata = malloc(size);
+    if (zdata == NULL) return false;
+    memcpy(zdata, buf, size);
+    free_page_data(page->data);
+    page->data = NULL;
+    page->zdata = zdata;
+    page->zsize = size;
+    data_stats.compressed_pages++;
+    data_stats.compressed_bytes += size;
+    return true;
+}
+
+// Один проход. Блокировка записи берётся на каждый файл отдельно,
+// чтобы не задерживать колбэки на весь проход.
+void compress_cold_pages(Filesystem *fs, unsigned int cold_after) {
+    char buf[COMPRESSED_LIMIT];
+    bool released = false;
+    for (int i = 1; i <= MAX_INODES; i++) {
+        write_lock_filesystem(fs);
+        uint32_t now = (uint32_t)time(NULL);
+        Inode *node = fs->inodes_list->inode_table[i];
+        FileData *file = node && is_file(node) ? node->data : NULL;
+        for (size_t j = 0; file && j < file->num_pages; j++) {
+            DataPage *page = file->pages[j];
+            if (page == NULL || page->mapped || page->spilled || page->preallocated
+                || now - page->last_access < cold_after) continue;
+            if (page->zdata) {
+                // Разжатая копия остыла - выбрасываем кэш
+                if (page->data) {
+                    free_page_data(page->data);
+                    page->data = NULL;
+                    data_stats.cached_pages--;
+                    released = true;
+                }
+            } else if (!page->incompressible && compress_page(page, buf)) {
+                released = true;
+            }
+        }
+        unlock_filesystem(fs);
+    }
+    // Буферы страниц живут в отображениях pagealloc, а не в куче malloc
+    if (released) page_alloc_trim();
+}
+
+// Поток -----------------------------------------------------------------------------
+
+static void* compressor_thread(void *arg) {
+    Compressor *compressor = arg;
+    unsigned int period = compressor->cold_after / 2 ? compressor->cold_after / 2 : 1;
+    pthread_mutex_lock(&compressor->lock);
+    while (compressor->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += period;
+        pthread_cond_timedwait(&compressor->wakeup, &compressor->lock, &deadline);
+        if (!compressor->running) break;
+        pthread_mutex_unlock(&compressor->lock);
+        compress_cold_pages(compressor->fs, compressor->cold_after);
+        pthread_mutex_lock(&compressor->lock);
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    return NULL;
+}
+
+Compressor* compressor_start(Filesystem *fs, unsigned int cold_after) {
+    Compressor *compressor = calloc(1, sizeof(Compressor));
+    if (compressor == NULL) return NULL;
+    compressor->fs = fs;
+    compressor->cold_after = cold_after;
+    compressor->running = true;
+    pthread_mutex_init(&compressor->lock, NULL);
+    pthread_cond_init(&compressor->wakeup, NULL);
+    if (pthread_create(&compressor->thread, NULL, compressor_thread, compressor) != 0) {
+        fprintf(stderr, "Ошибка: Не удалось запустить поток сжатия.\n");
+        free(compressor);
+        return NULL;
+    }
+    return compressor;
+}
+
+void compressor_stop(Compressor *compressor) {
+    pthread_mutex_lock(&compressor->lock);
+    compressor->running = false;
+    pthread_cond_signal(&compressor->wakeup);
+    pthread_mutex_unlock(&compressor->lock);
+    pthread_join(compressor->thread, NULL);
+    pthread_mutex_destroy(&compressor->lock);
+    pthread_cond_destroy(&compressor->wakeup);
+    free(compressor);
+}
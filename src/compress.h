@@ -0,0 +1,37 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <pthread.h>
+#include "filesystem.h"
+
+// Сжатие холодных данных -----------------------------------------------------
+// Фоновый поток раз в период проходит по файлам и сжимает страницы, к которым
+// не обращались cold_after секунд. Чтение разжимает страницу и оставляет
+// разжатую копию рядом со сжатой (кэш); следующий проход снова её выбросит,
+// если страница остыла. Запись в страницу возвращает её в обычный вид.
+
+// Блочный LZ77 в духе LZ4: токен (длина литералов | длина совпадения),
+// литералы, 2 байта смещения. Возвращает 0, если выход не влез в capacity.
+size_t lz_compress(const char *in, size_t size, char *out, size_t capacity);
+bool lz_decompress(const char *in, size_t size, char *out, size_t out_size);
+
+char* load_page_data(DataPage *page);
+// Возвращает, сколько страниц пришлось разжать или подкачать
+size_t prefetch_pages(Inode *node, size_t first, size_t count);
+bool make_page_hot(DataPage *page);
+void touch_page(DataPage *page);
+void compress_cold_pages(Filesystem *fs, unsigned int cold_after);
+
+typedef struct Compressor{
+    Filesystem *fs;
+    unsigned int cold_after;
+    pthread_t thread;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+} Compressor;
+
+Compressor* compressor_start(Filesystem *fs, unsigned int cold_after);
+void compressor_stop(Compressor *compressor);
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "counters.h"
+
+typedef struct CounterShard{
+    OpCounters counters;
+} __attribute__((aligned(64))) CounterShard;
+
+static CounterShard shards[COUNTER_SHARDS];
+static unsigned int next_shard = 0;
+static __thread OpCounters *shard = NULL;
+
+static OpCounters* thread_shard(void) {
+    if (shard == NULL) {
+        unsigned int index = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED);
+        shard = &shards[index % COUNTER_SHARDS].counters;
+    }
+    return shard;
+}
+
+static void add(uint64_t *counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+void count_read(size_t bytes) {
+    OpCounters *counters = thread_shard();
+    add(&counters->reads, 1);
+    add(&counters->read_bytes, bytes);
+}
+
+void count_write(size_t bytes) {
+    OpCounters *counters = thread_shard();
+    add(&counters->writes, 1);
+    add(&counters->write_bytes, bytes);
+}
+
+void count_lookup(bool hit) {
+    OpCounters *counters = thread_shard();
+    add(&counters->lookups, 1);
+    if (hit) add(&counters->lookup_hits, 1);
+}
+
+void count_readahead(size_t pages) {
+    add(&thread_shard()->readahead_pages, pages);
+}
+
+void counters_sum(OpCounters *total) {
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < COUNTER_SHARDS; i++) {
+        const OpCounters *counters = &shards[i].counters;
+        total->reads += __atomic_load_n(&counters->reads, __ATOMIC_RELAXED);
+        total->read_bytes += __atomic_load_n(&counters->read_bytes, __ATOMIC_RELAXED);
+        total->writes += __atomic_load_n(&counters->writes, __ATOMIC_RELAXED);
+        total->write_bytes += __atomic_load_n(&counters->write_bytes, __ATOMIC_RELAXED);
+        total->lookups += __atomic_load_n(&counters->lookups, __ATOMIC_RELAXED);
+        total->lookup_hits += __atomic_load_n(&counters->lookup_hits, __ATOMIC_RELAXED);
+        total->readahead_pages += __atomic_load_n(&counters->readahead_pages, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Счётчики операций ----------------------------------------------------------
+// Каждый поток при первом обращении получает свой сегмент на отдельной
+// кэш-линии и дальше увеличивает только его, так что горячий путь не гоняет
+// общую линию между ядрами. Сумма по сегментам считается только для
+// статистики. Потоков больше COUNTER_SHARDS делят сегменты по кругу,
+// поэтому сложение всё равно атомарное.
+
+#define COUNTER_SHARDS 64
+
+typedef struct OpCounters{
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t writes;
+    uint64_t write_bytes;
+    uint64_t lookups;      // поисков по пути
+    uint64_t lookup_hits;  // из них найдено в кэше потока
+    uint64_t readahead_pages;  // страниц, подготовленных упреждающим чтением
+} OpCounters;
+
+void count_read(size_t bytes);
+void count_write(size_t bytes);
+void count_lookup(bool hit);
+void count_readahead(size_t pages);
+void counters_sum(OpCounters *total);
+
+#endif /* COUNTERS_H */
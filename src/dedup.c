@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "compress.h"
+
+#define DEDUP_INITIAL_BUCKETS 1024
+
+DedupStats dedup_stats;
+
+static DataPage **buckets = NULL;
+static size_t num_buckets = 0;
+
+// Хэш страницы по 8 байт за шаг; совпадение всё равно проверяется memcmp
+static uint64_t page_hash(const char *data) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < FILE_PAGE_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+static bool is_zero_page(const char *data) {
+    static const char zero_page[FILE_PAGE_SIZE];
+    return memcmp(data, zero_page, FILE_PAGE_SIZE) == 0;
+}
+
+static bool grow_buckets(void) {
+    size_t new_num_buckets = num_buckets ? num_buckets * 2 : DEDUP_INITIAL_BUCKETS;
+    DataPage **new_buckets = calloc(new_num_buckets, sizeof(DataPage*));
+    if (new_buckets == NULL) return false;
+    for (size_t i = 0; i < num_buckets; i++) {
+        DataPage *page = buckets[i];
+        while (page) {
+            DataPage *next = page->hash_next;
+            size_t bucket = page->hash & (new_num_buckets - 1);
+            page->hash_next = new_buckets[bucket];
+            new_buckets[bucket] = page;
+            page = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    num_buckets = new_num_buckets;
+    return true;
+}
+
+// Возвращает страницу с таким же содержимым или добавляет эту в индекс
+static DataPage* find_or_insert(DataPage *page) {
+    if (dedup_stats.indexed_pages >= num_buckets && !grow_buckets()) return page;
+    page->hash = page_hash(page->data);
+    size_t bucket = page->hash & (num_buckets - 1);
+    for (DataPage *other = buckets[bucket]; other; other = other->hash_next) {
+        if (other->hash != page->hash) continue;
+        const char *other_data = load_page_data(other);
+        if (other_data && memcmp(other_data, page->data, FILE_PAGE_SIZE) == 0) {
+            return other;
+        }
+    }
+    page->indexed = true;
+    page->hash_next = buckets[bucket];
+    buckets[bucket] = page;
+    dedup_stats.indexed_pages++;
+    return page;
+}
+
+void dedup_forget_page(DataPage *page) {
+    size_t bucket = page->hash & (num_buckets - 1);
+    for (DataPage **link = &buckets[bucket]; *link; link = &(*link)->hash_next) {
+        if (*link == page) {
+            *link = page->hash_next;
+            dedup_stats.indexed_pages--;
+            break;
+        }
+    }
+    page->indexed = false;
+}
+
+void dedup_node(Inode *node) {
+    if (!is_file(node) || node->data == NULL) return;
+    FileData *file = node->data;
+    for (size_t i = 0; i < file->num_pages; i++) {
+        DataPage *page = file->pages[i];
+        // Ради сжатых и выгруженных (холодных) страниц разжимать не стоит,
+        // а выделенные fallocate должны остаться на месте до записи
+        if (page == NULL || page->indexed || page->mapped || page->zdata || page->spilled
+            || page->preallocated) continue;
+        // В диапазоне образа дырка читалась бы из образа, а не нулями
+        if (i >= file->image_pages && is_zero_page(page->data)) {
+            file->pages[i] = NULL;
+            release_data_page(page);
+            dedup_stats.zero_pages++;
+            continue;
+        }
+        DataPage *same = find_or_insert(page);
+        if (same != page) {
+            get_data_page(same);
+            file->pages[i] = same;
+            release_data_page(page);
+            dedup_stats.merged_pages++;
+        }
+    }
+}
+
+// Полный проход по дереву: для данных, записанных до включения дедупликации
+void dedup_tree(Filesystem *fs) {
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = fs->inodes_list->inode_table[i];
+        if (node) dedup_node(node);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "filesystem.h"
+
+// Дедупликация страниц -------------------------------------------------------
+// Индекс по содержимому страниц, один на процесс. dedup_node хэширует ещё
+// не проиндексированные страницы файла: одинаковые заменяются одной общей
+// страницей (копия при записи, как после clone_node), нулевые - дыркой.
+// Страница из индекса неизменяема, запись в неё всегда идёт через копию.
+
+typedef struct DedupStats{
+    size_t indexed_pages;  // уникальных страниц в индексе
+    size_t merged_pages;   // сколько страниц заменено общими (за всё время)
+    size_t zero_pages;     // сколько нулевых страниц заменено дырками
+} DedupStats;
+
+extern DedupStats dedup_stats;
+
+void dedup_node(Inode *node);
+void dedup_tree(Filesystem *fs);
+void dedup_forget_page(DataPage *page);
+
+#endif /* DEDUP_H */
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "compress.h"
+
+#define TAR_BLOCK 512
+#define TAR_BUFFER_SIZE (64 * FILE_PAGE_SIZE)
+// Больше не помещается в 11 восьмеричных цифр поля size
+#define USTAR_MAX_SIZE 077777777777ull
+// uid и gid - 7 цифр; больше уходит в pax
+#define USTAR_MAX_ID 07777777u
+
+typedef struct ExportEntry{
+    char *name;        // путь в архиве
+    struct stat st;
+    int link_to;       // запись, на которую это жёсткая ссылка, или -1
+    PageRef *pages;    // страницы файла, пустые - нули
+    size_t num_pages;
+} ExportEntry;
+
+typedef struct Export{
+    Filesystem *fs;
+    ExportEntry *entries;
+    size_t count;
+    size_t capacity;
+    int first_entry[MAX_INODES + 1];  // первая запись иноды, для жёстких ссылок
+} Export;
+
+typedef struct TarWriter{
+    int fd;
+    char *buf;
+    size_t used;
+    uint64_t written;
+    int error;
+} TarWriter;
+
+// Снимок -----------------------------------------------------------------------
+
+static ExportEntry* add_entry_copy(Export *export, Inode *node, const char *name) {
+    if (export->count == export->capacity) {
+        size_t capacity = export->capacity ? export->capacity * 2 : 64;
+        ExportEntry *entries = realloc(export->entries, capacity * sizeof(ExportEntry));
+        if (entries == NULL) return NULL;
+        export->entries = entries;
+        export->capacity = capacity;
+    }
+    ExportEntry *entry = &export->entries[export->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->name = strdup(name);
+    if (entry->name == NULL) return NULL;
+    entry->st = *node->st;
+    entry->link_to = -1;
+    export->count++;
+    return entry;
+}
+
+static int capture_file(Export *export, Inode *node, ExportEntry *entry) {
+    int first = export->first_entry[node->node_number];
+    if (first >= 0) {
+        entry->link_to = first;
+        return 0;
+    }
+    export->first_entry[node->node_number] = export->count - 1;
+    FileData *file = node->data;
+    size_t num_pages = (entry->st.st_size + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+    if (file == NULL || num_pages == 0) return 0;
+    entry->pages = calloc(num_pages, sizeof(PageRef));
+    if (entry->pages == NULL) return -ENOMEM;
+    entry->num_pages = num_pages;
+    for (size_t i = 0; i < num_pages && i < file->num_pages; i++) get_page_ref(file, i, &entry->pages[i]);
+    return 0;
+}
+
+static int capture(Export *export, Inode *node, const char *name) {
+    ExportEntry *entry = add_entry_copy(export, node, name);
+    if (entry == NULL) return -ENOMEM;
+    if (is_file(node)) return capture_file(export, node, entry);
+    if (!is_dir(node)) return 0;
+
+    Directory *dir = node->data;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        const char *child_name = dir->entries[i].name;
+        if (strcmp(child_name, ".") == 0 || strcmp(child_name, "..") == 0) continue;
+        Inode *child = get_inode_from_container(export->fs->inodes_list, dir->entries[i].node_number);
+        if (child == NULL) continue;
+        char child_path[MAX_PATH];
+        if ((size_t)snprintf(child_path, sizeof(child_path), "%s%s", name, child_name) >= sizeof(child_path)) {
+            return -ENAMETOOLONG;
+        }
+        if (is_dir(child)) strcat(child_path, "/");
+        int res = capture(export, child, child_path);
+        if (res != 0) return res;
+    }
+    return 0;
+}
+
+static void release_export(Export *export) {
+    write_lock_filesystem(export->fs);
+    for (size_t i = 0; i < export->count; i++) {
+        for (size_t j = 0; j < export->entries[i].num_pages; j++) {
+            if (export->entries[i].pages[j].page) release_data_page(export->entries[i].pages[j].page);
+        }
+    }
+    unlock_filesystem(export->fs);
+    for (size_t i = 0; i < export->count; i++) {
+        free(export->entries[i].name);
+        free(export->entries[i].pages);
+    }
+    free(export->entries);
+}
+
+// Запись -------------------------------------------------------------------------
+
+static bool tar_flush(TarWriter *w) {
+    size_t done = 0;
+    while (done < w->used) {
+        ssize_t res = write(w->fd, w->buf + done, w->used - done);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) {
+            w->error = res < 0 ? errno : EIO;
+            return false;
+        }
+        done += res;
+    }
+    w->written += w->used;
+    w->used = 0;
+    return true;
+}
+
+static bool tar_write(TarWriter *w, const void *data, size_t size) {
+    while (size) {
+        if (w->used == TAR_BUFFER_SIZE && !tar_flush(w)) return false;
+        size_t chunk = TAR_BUFFER_SIZE - w->used < size ? TAR_BUFFER_SIZE - w->used : size;
+        if (data) {
+            memcpy(w->buf + w->used, data, chunk);
+            data = (const char*)data + chunk;
+        } else {
+            memset(w->buf + w->used, 0, chunk);
+        }
+        w->used += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Дополняет данные размера size нулями до границы блока
+static bool tar_pad(TarWriter *w, uint64_t size) {
+    size_t rest = size % TAR_BLOCK;
+    return rest == 0 || tar_write(w, NULL, TAR_BLOCK - rest);
+}
+
+// width - 1 восьмеричных цифр с ведущими нулями и '\0'. Значения, которые
+// не помещаются, вызывающий передаёт через pax
+static void octal(char *field, size_t width, uint64_t value) {
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i > 0; i--) {
+        field[i - 1] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+static void write_checksum(char *header) {
+    memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) sum += (unsigned char)header[i];
+    snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+}
+
+// Имя длиннее 100 символов делится на prefix и name по '/'
+static bool split_ustar_name(const char *name, char *header) {
+    size_t length = strlen(name);
+    if (length <= 100) {
+        memcpy(header, name, length);
+        return true;
+    }
+    for (size_t i = length - 1; i > 0; i--) {
+        if (name[i] != '/' || i > 155 || length - i - 1 > 100) continue;
+        if (length - i - 1 == 0) continue;
+        memcpy(header + 345, name, i);
+        memcpy(header, name + i + 1, length - i - 1);
+        return true;
+    }
+    return false;
+}
+
+// Запись pax "длина ключ=значение\n", длина учитывает саму себя
+static size_t pax_record(char *out, size_t capacity, const char *key, const char *value) {
+    size_t payload = strlen(key) + strlen(value) + 3;
+    size_t length = payload + 1;
+    for (;;) {
+        int digits = snprintf(NULL, 0, "%zu", length);
+        if (payload + digits == length) break;
+        length = payload + digits;
+    }
+    if (length >= capacity) return 0;
+    snprintf(out, capacity, "%zu %s=%s\n", length, key, value);
+    return length;
+}
+
+static bool write_header(TarWriter *w, const ExportEntry *entry, char type, const char *link_name,
+                         uint64_t size) {
+    char header[TAR_BLOCK];
+    memset(header, 0, sizeof(header));
+    bool long_name = !split_ustar_name(entry->name, header);
+    bool long_link = link_name && strlen(link_name) > 100;
+    bool large = size > USTAR_MAX_SIZE;
+    bool large_uid = entry->st.st_uid > USTAR_MAX_ID;
+    bool large_gid = entry->st.st_gid > USTAR_MAX_ID;
+    if (long_name || long_link || large || large_uid || large_gid) {
+        char pax[MAX_PATH * 2 + 128];
+        size_t length = 0;
+        char number[32];
+        if (long_name) length += pax_record(pax + length, sizeof(pax) - length, "path", entry->name);
+        if (long_link) length += pax_record(pax + length, sizeof(pax) - length, "linkpath", link_name);
+        if (large) {
+            snprintf(number, sizeof(number), "%llu", (unsigned long long)size);
+            length += pax_record(pax + length, sizeof(pax) - length, "size", number);
+        }
+        if (large_uid) {
+            snprintf(number, sizeof(number), "%u", (unsigned int)entry->st.st_uid);
+            length += pax_record(pax + length, sizeof(pax) - length, "uid", number);
+        }
+        if (large_gid) {
+            snprintf(number, sizeof(number), "%u", (unsigned int)entry->st.st_gid);
+            length += pax_record(pax + length, sizeof(pax) - length, "gid", number);
+        }
+        char pax_header[TAR_BLOCK];
+        memset(pax_header, 0, sizeof(pax_header));
+        snprintf(pax_header, 100, "PaxHeader/%.80s", entry->name);
+        octal(pax_header + 100, 8, 0644);
+        octal(pax_header + 108, 8, 0);
+        octal(pax_header + 116, 8, 0);
+        octal(pax_header + 124, 12, length);
+        octal(pax_header + 136, 12, entry->st.st_mtim.tv_sec);
+        pax_header[156] = 'x';
+        memcpy(pax_header + 257, "ustar", 6);
+        memcpy(pax_header + 263, "00", 2);
+        write_checksum(pax_header);
+        if (!tar_write(w, pax_header, TAR_BLOCK) || !tar_write(w, pax, length) || !tar_pad(w, length)) {
+            return false;
+        }
+        if (long_name) {
+            memset(header, 0, 100);
+            memset(header + 345, 0, 155);
+            memcpy(header, entry->name, 99);
+        }
+    }
+
+    octal(header + 100, 8, entry->st.st_mode & 07777);
+    octal(header + 108, 8, large_uid ? 0 : entry->st.st_uid);
+    octal(header + 116, 8, large_gid ? 0 : entry->st.st_gid);
+    octal(header + 124, 12, large ? 0 : size);
+    octal(header + 136, 12, entry->st.st_mtim.tv_sec);
+    header[156] = type;
+    if (link_name) strncpy(header + 157, link_name, 100);
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    write_checksum(header);
+    return tar_write(w, header, TAR_BLOCK);
+}
+
+// Данные файла: страницы копируются в буфер под блокировкой чтения
+// (сжатые разжимаются, выгруженные подгружаются), запись - без неё
+static bool write_file_data(TarWriter *w, Filesystem *fs, const ExportEntry *entry) {
+    static const char zero_page[FILE_PAGE_SIZE];
+    uint64_t size = entry->st.st_size;
+    size_t i = 0;
+    while (i < entry->num_pages) {
+        size_t room = (TAR_BUFFER_SIZE - w->used) / FILE_PAGE_SIZE;
+        if (room == 0) {
+            if (!tar_flush(w)) return false;
+            continue;
+        }
+        size_t count = entry->num_pages - i < room ? entry->num_pages - i : room;
+        read_lock_filesystem(fs);
+        for (size_t j = i; j < i + count; j++) {
+            uint64_t start = (uint64_t)j * FILE_PAGE_SIZE;
+            size_t valid = size - start < FILE_PAGE_SIZE ? size - start : FILE_PAGE_SIZE;
+            const PageRef *ref = &entry->pages[j];
+            const char *data = ref->page ? load_page_data(ref->page) : ref->image ? ref->image : zero_page;
+            if (data == NULL) {
+                unlock_filesystem(fs);
+                w->error = EIO;
+                return false;
+            }
+            memcpy(w->buf + w->used, data, valid);
+            w->used += valid;
+        }
+        unlock_filesystem(fs);
+        i += count;
+    }
+    return tar_pad(w, size);
+}
+
+static bool write_entry(TarWriter *w, Export *export, const ExportEntry *entry) {
+    if (S_ISDIR(entry->st.st_mode)) return write_header(w, entry, '5', NULL, 0);
+    if (entry->link_to >= 0) {
+        return write_header(w, entry, '1', export->entries[entry->link_to].name, 0);
+    }
+    return write_header(w, entry, '0', NULL, entry->st.st_size)
+        && write_file_data(w, export->fs, entry);
+}
+
+int export_tar(Filesystem *fs, const char *path, int fd, uint64_t *written) {
+    Export *export = calloc(1, sizeof(Export));
+    if (export == NULL) return -ENOMEM;
+    export->fs = fs;
+    for (int i = 0; i <= MAX_INODES; i++) export->first_entry[i] = -1;
+
+    // "/a/b/" выгружается как "/a/b"
+    char subtree[MAX_PATH];
+    snprintf(subtree, sizeof(subtree), "%s", path);
+    for (size_t length = strlen(subtree); length > 1 && subtree[length - 1] == '/'; length--) {
+        subtree[length - 1] = '\0';
+    }
+    path = subtree;
+
+    write_lock_filesystem(fs);
+    Inode *node = get_inode_by_path(path, fs->inodes_list);
+    int res = node ? 0 : -ENOENT;
+    if (node) {
+        // Корень выгружается без общего префикса, остальное - с именем поддерева
+        const char *name = strcmp(path, "/") == 0 ? "" : get_last_name(path);
+        char top[MAX_FILE_NAME + 1];
+        snprintf(top, sizeof(top), "%s%s", name, is_dir(node) && *name ? "/" : "");
+        if (*top == '\0') {
+            Directory *dir = node->data;
+            for (int i = next_entry(dir, 0); res == 0 && i >= 0; i = next_entry(dir, i + 1)) {
+                const char *child_name = dir->entries[i].name;
+                if (strcmp(child_name, ".") == 0 || strcmp(child_name, "..") == 0) continue;
+                Inode *child = get_inode_from_container(fs->inodes_list, dir->entries[i].node_number);
+                if (child == NULL) continue;
+                snprintf(top, sizeof(top), "%s%s", child_name, is_dir(child) ? "/" : "");
+                res = capture(export, child, top);
+            }
+        } else {
+            res = capture(export, node, top);
+        }
+    }
+    unlock_filesystem(fs);
+
+    TarWriter w = {fd, malloc(TAR_BUFFER_SIZE), 0, 0, 0};
+    if (res == 0 && w.buf == NULL) res = -ENOMEM;
+    for (size_t i = 0; res == 0 && i < export->count; i++) {
+        if (!write_entry(&w, export, &export->entries[i])) res = -w.error;
+    }
+    // Конец архива - два нулевых блока
+    if (res == 0 && (!tar_write(&w, NULL, 2 * TAR_BLOCK) || !tar_flush(&w))) res = -w.error;
+    if (written) *written = w.written;
+
+    free(w.buf);
+    release_export(export);
+    free(export);
+    return res;
+}
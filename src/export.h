@@ -0,0 +1,17 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "filesystem.h"
+
+// Выгрузка поддерева в tar ---------------------------------------------------
+// Под блокировкой записи снимается снимок поддерева: метаданные копируются,
+// на страницы данных берутся ссылки, так что последующие записи в файлы
+// идут через копию и в архив не попадают. Затем снимок пишется в fd как
+// POSIX tar (ustar, длинные имена и размеры - через заголовки pax), данные
+// копируются из страниц пачками под короткой блокировкой чтения.
+// Блокировки берутся внутри, вызывать без блокировки fs.
+
+// Возвращает 0 или -errno; в written - сколько байт записано
+int export_tar(Filesystem *fs, const char *path, int fd, uint64_t *written);
+
+#endif /* EXPORT_H */
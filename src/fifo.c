@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "fifo.h"
+
+static bool write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buf, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Ждёт писателя или выхода дочернего процесса. true - можно читать
+static bool wait_writer(int fifo, int exited) {
+    for (;;) {
+        struct pollfd fds[2] = {{fifo, POLLIN, 0}, {exited, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        // Данные или писатель уже закрыл FIFO - дочитываем
+        if (fds[0].revents & (POLLIN | POLLHUP)) return true;
+        if (fds[1].revents) return false;
+    }
+}
+
+static int copy_fifo(int fifo, int exited, int out) {
+    if (!wait_writer(fifo, exited)) return 0;
+    int flags = fcntl(fifo, F_GETFL);
+    if (flags < 0 || fcntl(fifo, F_SETFL, flags & ~O_NONBLOCK) != 0) return -1;
+    char buf[65536];
+    for (;;) {
+        ssize_t length = read(fifo, buf, sizeof(buf));
+        if (length < 0 && errno == EINTR) continue;
+        if (length < 0) return -1;
+        if (length == 0) return 0;
+        if (!write_all(out, buf, length)) return -1;
+    }
+}
+
+int pump_fifo(const char *path, int (*request)(void *arg), void *arg, int out) {
+    int fifo = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fifo < 0) return -1;
+    int exited[2];
+    if (pipe(exited) != 0) {
+        close(fifo);
+        return -1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(fifo);
+        close(exited[0]);
+        _exit(request(arg));
+    }
+    close(exited[1]);
+    int result = -1;
+    int error = errno;
+    if (child > 0) {
+        result = copy_fifo(fifo, exited[0], out);
+        error = errno;
+        int status;
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+        }
+        if (result == 0 && WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            error = WEXITSTATUS(status);
+            result = -1;
+        } else if (result == 0 && !WIFEXITED(status)) {
+            error = EIO;
+            result = -1;
+        }
+    }
+    close(fifo);
+    close(exited[0]);
+    errno = error;
+    return result;
+}
@@ -0,0 +1,18 @@
+#ifndef FIFO_H
+#define FIFO_H
+
+// Чтение из FIFO, которое открывает другой процесс -------------------------------
+// Демон пишет архив только в путь хоста, поэтому tmpfsctl export в поток
+// создаёт FIFO, а ioctl выполняет дочерний процесс. Если демон отказал, не
+// открыв FIFO (нет прав, нет пути, замороженная fs), блокирующий open на
+// чтение ждал бы писателя вечно. Поэтому FIFO открывается без блокировки,
+// и ожидание идёт одновременно по FIFO и по выходу дочернего процесса (канал,
+// который закрывается вместе с ним). Когда данные пошли, чтение снова
+// блокирующее.
+
+// Выполняет request(arg) в дочернем процессе и копирует в out всё, что
+// придёт в FIFO path. request возвращает 0 или код errno. Результат - 0 или
+// -1 с errno (ошибка запроса, чтения или записи в out)
+int pump_fifo(const char *path, int (*request)(void *arg), void *arg, int out);
+
+#endif /* FIFO_H */
@@ -1,12 +1,23 @@
+#define _GNU_SOURCE  // mremap
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
 
 
 #include "filesystem.h"
+#include "dedup.h"
+#include "compress.h"
+#include "spill.h"
+#include "pagealloc.h"
+#include "reclaim.h"
+#include "counters.h"
+#include "usage.h"
 #include <fcntl.h>
 #include <sys/stat.h>
 
@@ -32,11 +43,163 @@ Inode* init_inode(int node_number, struct stat *st, void *data, Inode *parent_no
 }
 
 void destroy_inode(Inode *node) {
+    if (node->data) {
+        if (is_dir(node)) free(node->data);
+        else destroy_file_data(node->data);
+    }
     free(node->st);
-    if (node->data) free(node->data);
     free(node);
 }
 
+// FileData ------------------------------------------------------------------------------
+DataStats data_stats;
+
+FileData* init_file_data() {
+    return calloc(1, sizeof(FileData));
+}
+
+// Таблица страниц большого файла - анонимное отображение: при росте mremap
+// переносит её без копирования, при усечении хвост отдаётся системе
+#define PAGE_TABLE_MMAP_BYTES (64 * 1024)
+
+static bool page_table_mapped(size_t capacity) {
+    return capacity * sizeof(DataPage*) >= PAGE_TABLE_MMAP_BYTES;
+}
+
+static size_t page_table_bytes(size_t capacity) {
+    return capacity * sizeof(DataPage*);
+}
+
+static bool grow_page_table(FileData *file, size_t num_pages) {
+    size_t capacity = file->capacity ? file->capacity : 16;
+    while (capacity < num_pages) capacity *= 2;
+    if (!page_table_mapped(capacity)) {
+        DataPage **pages = realloc(file->pages, page_table_bytes(capacity));
+        if (pages == NULL) return false;
+        file->pages = pages;
+        file->capacity = capacity;
+        return true;
+    }
+
+    // Отображение растёт ровно до нужного размера, округлённого до страницы
+    size_t bytes = (page_table_bytes(num_pages) + FILE_PAGE_SIZE - 1) & ~(size_t)(FILE_PAGE_SIZE - 1);
+    if (bytes < PAGE_TABLE_MMAP_BYTES) bytes = PAGE_TABLE_MMAP_BYTES;
+    void *pages;
+    if (page_table_mapped(file->capacity)) {
+        pages = mremap(file->pages, page_table_bytes(file->capacity), bytes, MREMAP_MAYMOVE);
+        if (pages == MAP_FAILED) return false;
+    } else {
+        pages = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pages == MAP_FAILED) return false;
+        memcpy(pages, file->pages, page_table_bytes(file->num_pages));
+        free(file->pages);
+    }
+    file->pages = pages;
+    file->capacity = bytes / sizeof(DataPage*);
+    return true;
+}
+
+static void shrink_page_table(FileData *file) {
+    if (!page_table_mapped(file->capacity)) return;
+    size_t used = (page_table_bytes(file->num_pages) + FILE_PAGE_SIZE - 1) & ~(size_t)(FILE_PAGE_SIZE - 1);
+    size_t bytes = page_table_bytes(file->capacity);
+    if (used < bytes) madvise((char*)file->pages + used, bytes - used, MADV_DONTNEED);
+}
+
+// Данные ещё не тронутой страницы образа, иначе NULL
+char* image_page(const FileData *file, size_t index) {
+    if (index >= file->image_pages || file->pages[index]) return NULL;
+    return file->image + index * FILE_PAGE_SIZE;
+}
+
+// Страницы образа с номера index получают свои DataPage, и дальше образ
+// напрямую не читается: там можно оставить дырку
+static bool detach_image(FileData *file, size_t index) {
+    for (size_t i = index; i < file->image_pages; i++) {
+        if (file->pages[i]) continue;
+        file->pages[i] = init_data_page(file->image + i * FILE_PAGE_SIZE, true);
+        if (file->pages[i] == NULL) return false;
+    }
+    if (index < file->image_pages) file->image_pages = index;
+    return true;
+}
+
+void get_page_ref(const FileData *file, size_t index, PageRef *ref) {
+    ref->page = file && index < file->num_pages ? file->pages[index] : NULL;
+    ref->image = file && ref->page == NULL ? image_page(file, index) : NULL;
+    if (ref->page) get_data_page(ref->page);
+}
+
+void destroy_file_data(FileData *file) {
+    for (size_t i = 0; i < file->num_pages; i++) {
+        if (file->pages[i]) release_data_page(file->pages[i]);
+    }
+    if (page_table_mapped(file->capacity)) munmap(file->pages, page_table_bytes(file->capacity));
+    else free(file->pages);
+    free(file);
+}
+
+DataPage* init_data_page(char *data, bool mapped) {
+    DataPage *page = malloc(sizeof(DataPage));
+    if (page == NULL) return NULL;
+    page->refcount = 1;
+    page->mapped = mapped;
+    page->indexed = false;
+    page->incompressible = false;
+    page->preallocated = false;
+    page->referenced = false;
+    page->spilled = false;
+    page->spill_slot = 0;
+    page->data = data;
+    page->zdata = NULL;
+    page->zsize = 0;
+    page->hash = 0;
+    page->hash_next = NULL;
+    touch_page(page);
+    if (mapped) data_stats.mapped_pages++;
+    else data_stats.pages++;
+    data_stats.page_refs++;
+    return page;
+}
+
+void get_data_page(DataPage *page) {
+    page->refcount++;
+    data_stats.page_refs++;
+}
+
+void release_data_page(DataPage *page) {
+    data_stats.page_refs--;
+    if (--page->refcount > 0) return;
+    if (page->indexed) dedup_forget_page(page);
+    if (page->spilled) spill_forget_page(page);
+    if (page->zdata) {
+        data_stats.compressed_pages--;
+        data_stats.compressed_bytes -= page->zsize;
+        if (page->data) data_stats.cached_pages--;
+        free(page->zdata);
+    }
+    if (page->mapped) {
+        data_stats.mapped_pages--;
+    } else {
+        data_stats.pages--;
+        free_page_data(page->data);
+    }
+    free(page);
+}
+
+// Увеличивает таблицу страниц, новые слоты - дырки
+bool reserve_file_pages(FileData *file, size_t num_pages) {
+    if (num_pages <= file->num_pages) return true;
+    bool fresh = file->capacity == 0;
+    if (num_pages > file->capacity && !grow_page_table(file, num_pages)) return false;
+    // Новое анонимное отображение и так в нулях: не трогаем его страницы
+    if (!fresh || !page_table_mapped(file->capacity)) {
+        memset(file->pages + file->num_pages, 0, (num_pages - file->num_pages) * sizeof(DataPage*));
+    }
+    file->num_pages = num_pages;
+    return true;
+}
+
 // InodesNumbersTracker ------------------------------------------------------------
 InodesNumbersTracker* init_inodes_numbers_tracker(int max_inodes) {
     InodesNumbersTracker* inode_tracker = malloc(sizeof(InodesNumbersTracker));
@@ -78,8 +241,16 @@ bool isInodeNumberFree(int number, InodesNumbersTracker* tracker){
 }
 
 // InodeContainer -----------------------------------------------------------------------
+// Меняется при удалении иноды или записи каталога: найденные раньше пути
+// в кэшах поиска могли стать неверными. Пишется под блокировкой записи fs.
+static uint64_t lookup_generation = 1;
+
+static void invalidate_lookups(void) {
+    __atomic_fetch_add(&lookup_generation, 1, __ATOMIC_RELAXED);
+}
+
 bool is_valid_number(int node_number) {
-    if (node_number < 0 || node_number >= MAX_INODES) {
+    if (node_number < 0 || node_number > MAX_INODES) {
         return false;
     }
     return true;
@@ -87,9 +258,10 @@ bool is_valid_number(int node_number) {
 
 InodeContainer* init_inode_container(int max_inodes) {
     InodeContainer* container = malloc(sizeof(InodeContainer));
-    for (int i = 0; i < MAX_INODES; i++) {
+    for (int i = 0; i <= MAX_INODES; i++) {
         container->inode_table[i] = NULL;
     }
+    invalidate_lookups();
     return container;
 }
 
@@ -107,10 +279,23 @@ Inode *get_inode_from_container(InodeContainer *container, int node_number) {
 bool remove_inode_from_container(InodeContainer *container, int node_number) {
     if (!is_valid_number(node_number)){ return false;}
     container->inode_table[node_number] = NULL;
+    invalidate_lookups();
     return true;
 }
 
 // Directory ------------------------------------------------------------------------------
+// Индекс упорядоченного каталога: слот вставляется по своему текущему имени
+static void insert_order(Directory *dir, int slot, int count) {
+    int position = lower_bound_entry(dir, dir->order, count, dir->entries[slot].name);
+    memmove(dir->order + position + 1, dir->order + position, count - position);
+    dir->order[position] = (unsigned char)slot;
+}
+
+static void remove_order(Directory *dir, int slot, int count) {
+    int position = lower_bound_entry(dir, dir->order, count, dir->entries[slot].name);
+    memmove(dir->order + position, dir->order + position + 1, count - position - 1);
+}
+
 // Структура для хранения пары <name>:<номер inode>
 bool add_entry(Directory *dir, const char *name, int node_number) {
     if (dir->num_entries >= MAX_FILES) {
@@ -123,39 +308,98 @@ bool add_entry(Directory *dir, const char *name, int node_number) {
         return false;
     }
 
-    strcpy(dir->entries[dir->num_entries].name, name);
-    dir->entries[dir->num_entries].node_number = node_number;
+    int slot = 0;
+    while (slot < dir->num_slots && dir->entries[slot].node_number != 0) slot++;
+    if (slot == dir->num_slots) dir->num_slots++;
+    strcpy(dir->entries[slot].name, name);
+    dir->entries[slot].node_number = node_number;
+    dir->entries[slot].generation++;
+    if (dir->ordered) insert_order(dir, slot, dir->num_entries);
     dir->num_entries++;
     return true;
 }
 
+static int find_entry(Directory *dir, const char *name) {
+    if (dir->ordered) {
+        int position = lower_bound_entry(dir, dir->order, dir->num_entries, name);
+        if (position == dir->num_entries) return -1;
+        int slot = dir->order[position];
+        return strcmp(dir->entries[slot].name, name) == 0 ? slot : -1;
+    }
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        if (strcmp(dir->entries[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
 // Функция для удаления записи из каталога
 bool remove_entry(Directory *dir, const char *name) {
-    int i;
-    for (i = 0; i < dir->num_entries; i++) {
-        if (strcmp(dir->entries[i].name, name) == 0) {
-            // Найдена запись, сдвигаем все последующие записи на один влево
-            for (int j = i; j < dir->num_entries - 1; j++) {
-                strcpy(dir->entries[j].name, dir->entries[j + 1].name);
-                dir->entries[j].node_number = dir->entries[j + 1].node_number;
-            }
-            dir->num_entries--;
-            return true;
-        }
+    int slot = find_entry(dir, name);
+    if (slot < 0) {
+        fprintf(stderr, "Ошибка: Файл с именем \"%s\" не найден в каталоге.\n", name);
+        return false;
     }
-    fprintf(stderr, "Ошибка: Файл с именем \"%s\" не найден в каталоге.\n", name);
-    return false;
+    // Слот освобождается на месте, остальные записи не двигаются. Имя
+    // остаётся: по нему продолжается упорядоченный листинг
+    if (dir->ordered) remove_order(dir, slot, dir->num_entries);
+    dir->entries[slot].node_number = 0;
+    dir->num_entries--;
+    while (dir->num_slots > 0 && dir->entries[dir->num_slots - 1].node_number == 0) dir->num_slots--;
+    invalidate_lookups();
+    return true;
+}
+
+bool rename_entry(Directory *dir, const char *name, const char *new_name) {
+    int slot = find_entry(dir, name);
+    if (slot < 0 || strlen(new_name) >= MAX_FILE_NAME) return false;
+    if (dir->ordered) remove_order(dir, slot, dir->num_entries);
+    strcpy(dir->entries[slot].name, new_name);
+    if (dir->ordered) insert_order(dir, slot, dir->num_entries - 1);
+    invalidate_lookups();
+    return true;
 }
 
 // Проверяет есть ли такая запись в директории
 char check_entry(Directory* dir, const char *name){
-    int i;
-    for (i = 0; i < dir->num_entries; i++) {
-        if (strcmp(dir->entries[i].name, name) == 0) {
-            return 1;
-        }
+    return find_entry(dir, name) >= 0;
+}
+
+int next_entry(const Directory *dir, int slot) {
+    for (; slot < dir->num_slots; slot++) {
+        if (dir->entries[slot].node_number != 0) return slot;
     }
-    return 0;
+    return -1;
+}
+
+void set_directory_ordered(Directory *dir, bool ordered) {
+    if (ordered && !dir->ordered) sorted_entries(dir, dir->order);
+    dir->ordered = ordered;
+}
+
+int sorted_entries(const Directory *dir, unsigned char order[MAX_FILES]) {
+    if (dir->ordered) {
+        memcpy(order, dir->order, dir->num_entries);
+        return dir->num_entries;
+    }
+    // Не больше MAX_FILES записей - хватает вставок с двоичным поиском
+    int count = 0;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        int position = lower_bound_entry(dir, order, count, dir->entries[i].name);
+        memmove(order + position + 1, order + position, count - position);
+        order[position] = (unsigned char)i;
+        count++;
+    }
+    return count;
+}
+
+int lower_bound_entry(const Directory *dir, const unsigned char *order, int count, const char *name) {
+    int low = 0, high = count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (strcmp(dir->entries[order[middle]].name, name) < 0) low = middle + 1;
+        else high = middle;
+    }
+    return low;
 }
 
 // Filesystem ------------------------------------------------------------------------------
@@ -170,7 +414,7 @@ Filesystem* init_filesystem(){
     }
 
     // Задаём данные дирректори для root 
-    Directory* root_directory = malloc(sizeof(Directory));
+    Directory* root_directory = calloc(1, sizeof(Directory));
     if (root_directory == NULL) {
         fprintf(stderr, "Ошибка выделения памяти для данных корневой директории.\n");
         exit(EXIT_FAILURE);
@@ -179,8 +423,10 @@ Filesystem* init_filesystem(){
     add_entry(root_directory, ".", 1);
     add_entry(root_directory, "..", 1);
 
-    struct stat* root_stat = malloc(sizeof(struct stat));
+    struct stat* root_stat = calloc(1, sizeof(struct stat));
     root_stat->st_nlink = 1;   
+    root_stat->st_ino = 1;
+    root_stat->st_atim = root_stat->st_mtim = root_stat->st_ctim = current_time();
     root_stat->st_mode = S_IRWXO | S_IRWXG | S_IRWXU | __S_IFDIR;
     
     // Создаём иноду для root
@@ -189,14 +435,45 @@ Filesystem* init_filesystem(){
     root_inode->data = root_directory;
     root_inode->st->st_nlink = 2;
     add_inode_to_container(inodes_container, 1, root_inode);
+    allocate_inode_number(inodes_numbers_tracker); // номер 1 занят root
+    usage_reset();
+    usage_created(root_inode);
 
     // Назначаем значения полей структуры Filesystem 
     fs->inodes_list = inodes_container;
     fs->root = root_inode;
     fs->inodes_numbers_tracker = inodes_numbers_tracker;
+    fs->image = NULL;
+    fs->image_size = 0;
+    pthread_rwlock_init(&fs->lock, NULL);
     return fs;
 }
 
+// Все иноды, в том числе удалённые, но ещё открытые, лежат в таблице
+// контейнера, поэтому обход дерева не нужен
+void destroy_filesystem(Filesystem* fs) {
+    for (int i = 0; i <= MAX_INODES; i++) {
+        Inode* node = fs->inodes_list->inode_table[i];
+        if (node) destroy_inode(node);
+    }
+    free(fs->inodes_list);
+    free(fs->inodes_numbers_tracker);
+    pthread_rwlock_destroy(&fs->lock);
+    free(fs);
+}
+
+void read_lock_filesystem(Filesystem* fs) {
+    pthread_rwlock_rdlock(&fs->lock);
+}
+
+void write_lock_filesystem(Filesystem* fs) {
+    pthread_rwlock_wrlock(&fs->lock);
+}
+
+void unlock_filesystem(Filesystem* fs) {
+    pthread_rwlock_unlock(&fs->lock);
+}
+
 // Вот тут начинаются "высокоуровневые" операции
 
 // /dir/dir2/file.txt -> [dir1, dir2, file.txt]
@@ -223,17 +500,60 @@ char* get_last_name(const char* path) {
     return (char*)path;
 }
 
+// Кэш поиска потока: путь -> номер иноды. Свой у каждого потока, поэтому
+// без блокировок; устаревает целиком со сменой lookup_generation.
+// Длинные пути не кэшируются.
+#define LOOKUP_CACHE_SIZE 256
+#define LOOKUP_CACHE_PATH 112
+
+typedef struct LookupEntry{
+    const InodeContainer *container;
+    uint64_t generation;
+    int node_number;
+    char path[LOOKUP_CACHE_PATH];
+} LookupEntry;
+
+static __thread LookupEntry lookup_cache[LOOKUP_CACHE_SIZE];
+
+static LookupEntry* lookup_slot(const char* path, size_t* length) {
+    uint32_t hash = 2166136261u;
+    const char* p = path;
+    for (; *p; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+    *length = p - path;
+    return &lookup_cache[hash % LOOKUP_CACHE_SIZE];
+}
+
+static Inode* walk_path(const char* path, InodeContainer* inodes_container);
+
 // Finds the Inode corresponding to the given path starting from the root
 // Works only with absolute paths
 Inode* get_inode_by_path(const char* path, InodeContainer* inodes_container) {
     if (path == NULL || inodes_container == NULL || *path != '/')
         return NULL;
-    
+    size_t length;
+    LookupEntry* entry = lookup_slot(path, &length);
+    uint64_t generation = __atomic_load_n(&lookup_generation, __ATOMIC_RELAXED);
+    if (entry->generation == generation && entry->container == inodes_container
+        && strcmp(entry->path, path) == 0) {
+        count_lookup(true);
+        return get_inode_from_container(inodes_container, entry->node_number);
+    }
+    count_lookup(false);
+    Inode* node = walk_path(path, inodes_container);
+    if (node && length < LOOKUP_CACHE_PATH) {
+        memcpy(entry->path, path, length + 1);
+        entry->container = inodes_container;
+        entry->node_number = node->node_number;
+        entry->generation = generation;
+    }
+    return node;
+}
+
+static Inode* walk_path(const char* path, InodeContainer* inodes_container) {
 
     Inode *current_inode = get_inode_from_container(inodes_container, 1);
     path++;
     if (!*path){
-        printf("Был запрошен ROOT\n");
         return current_inode;
     } 
     
@@ -253,19 +573,12 @@ Inode* get_inode_by_path(const char* path, InodeContainer* inodes_container) {
         }
         Directory* directory = (Directory*)current_inode->data;
         // Поиск имени файла в текущем каталоге
-        int i;
-        for (i = 0; i < directory->num_entries; ++i) {
-            if (strcmp(directory->entries[i].name, dirname) == 0) {
-                int node_number = directory->entries[i].node_number;
-                current_inode = get_inode_from_container(inodes_container, node_number);
-                break;
-            }
-        }
-        
+        int slot = find_entry(directory, dirname);
         // Если директория не найдена, возвращаем NULL
-        if (i == directory->num_entries) {
+        if (slot < 0) {
             return NULL;
         }
+        current_inode = get_inode_from_container(inodes_container, directory->entries[slot].node_number);
     }
     return current_inode;
 }
@@ -282,6 +595,8 @@ char* get_prefix(const char* path) {
     const char* last_slash = strrchr(path, '/'); 
     if (!last_slash)
         return NULL;
+    if (last_slash == path)
+        return strdup("/");
     
     int prefix_length = last_slash - path;
     char* prefix = (char*)malloc(prefix_length + 1);
@@ -297,12 +612,12 @@ char* get_prefix(const char* path) {
 Inode* get_parent_directory(const char* path, InodeContainer* inodes_container){
     char* dir_path = get_prefix(path);
     Inode* dir_node = get_inode_by_path(dir_path, inodes_container);
+    free(dir_path);
     if (!dir_node) return NULL;
     else if (!is_dir(dir_node)) {
         errno = ENOTDIR;
         return NULL;
     }
-    free(dir_path);
     return dir_node;
 }
 
@@ -318,49 +633,70 @@ int add_node_to_directory(Inode* dir_node, Inode* node, const char* name){
 bool add_node_by_path(const char * path, Inode* node, InodeContainer* inodes_container){
     char* node_name = get_last_name(path);
     Inode* parent_inode = get_parent_directory(path, inodes_container);
-    if (parent_inode == NULL) {
-        printf("Не найдена дирректория размещения");
-        return false;
-    }
-    if (!is_dir(parent_inode)){
-        printf("Родительская дирректория - не дирректория");
+    if (parent_inode == NULL || !is_dir(parent_inode)) {
         return false;
     }
     Directory* parent_dir =  parent_inode->data;
     char name_already_taken = check_entry(parent_dir, node_name);
     if(name_already_taken) {
         errno = EEXIST;
-        printf("Имя занято");
         return false;
     }
 
     add_entry(parent_dir, node_name, node->node_number);
     node->st->st_nlink++;
+    update_times(parent_inode, TIME_MTIME | TIME_CTIME);
+    update_times(node, TIME_CTIME);
     return true;
 }
 
+// Убирает иноду из таблицы, освобождает её номер и память
+void release_inode(Filesystem* fs, Inode* node){
+    remove_inode_from_container(fs->inodes_list, node->node_number);
+    free_inode_number(fs->inodes_numbers_tracker, node->node_number);
+    // Данные большого файла отпустит фоновый поток
+    if (is_file(node) && node->data && reclaim_defer(node->data)) {
+        node->data = NULL;
+    }
+    destroy_inode(node);
+    page_alloc_trim();
+}
+
 // Удаляет запись о ноде в указанной дирректории. Если на ноду больше нет ссылок, то она удаляется.
-bool remove_node_by_path(const char* path, InodeContainer* inodes_container){
+bool remove_node_by_path(const char* path, Filesystem* fs){
     char* node_name = get_last_name(path);
-    Inode* node = get_inode_by_path(path, inodes_container);
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
     if (node == NULL){
+        errno = ENOENT;
         return false;
     }
-    Inode* parent_dir = get_parent_directory(path, inodes_container);
-
-    if (is_dir(node)){
-        if (is_dir_empty(node)){
-            errno = ENOTEMPTY;
-            return false;
-        }
-        destroy_inode(node);
-    } else if (!node->nopen && --node->st->st_nlink == 0){
-        destroy_inode(node);
+    Inode* parent_dir = get_parent_directory(path, fs->inodes_list);
+    if (parent_dir == NULL){
+        return false;
+    }
+    if (is_dir(node) && !is_dir_empty(node)){
+        errno = ENOTEMPTY;
+        return false;
     }
 
     if (!remove_entry(parent_dir->data, node_name)) {
+        errno = ENOENT;
         return false;
     }
+    update_times(parent_dir, TIME_MTIME | TIME_CTIME);
+    update_times(node, TIME_CTIME);
+
+    if (is_dir(node)){
+        parent_dir->st->st_nlink--;
+        usage_unlinked(fs->inodes_list, node, parent_dir);
+        release_inode(fs, node);
+        return true;
+    }
+    node->st->st_nlink--;
+    usage_unlinked(fs->inodes_list, node, parent_dir);
+    if (node->st->st_nlink == 0 && !node->nopen){
+        release_inode(fs, node);
+    }
     return true;
 }
 
@@ -385,23 +721,606 @@ bool move_node(const char* path, const char* new_path, InodeContainer* container
     old_file_name = get_last_name(path);
     new_file_name = get_last_name(new_path);
 
-    if (!source_dir_node || !dist_dir_node) return NULL;
+    if (!node || !source_dir_node || !dist_dir_node) {
+        errno = ENOENT;
+        return false;
+    }
     if (!is_dir(source_dir_node) || !is_dir(dist_dir_node)){
         errno = ENOTDIR;
         return false;
     }
-    
-    if (!remove_entry(source_dir_node->data, old_file_name)){
+
+    // В том же каталоге имя меняется на месте: запись сохраняет слот, и
+    // открытые листинги не видят её дважды или не теряют
+    if (source_dir_node == dist_dir_node) {
+        if (!rename_entry(source_dir_node->data, old_file_name, new_file_name)) {
+            errno = ENOENT;
+            return false;
+        }
+    // Сначала добавляем новую запись, чтобы при переполнении каталога не потерять файл
+    } else if (!add_entry(dist_dir_node->data, new_file_name, node->node_number)){
+        errno = EOVERFLOW;
+        return false;
+    }
+    if (source_dir_node != dist_dir_node && !remove_entry(source_dir_node->data, old_file_name)){
+        remove_entry(dist_dir_node->data, new_file_name);
         errno = ENOENT;
         return false;
     }
 
-    if (!add_entry(dist_dir_node->data, new_file_name, node->node_number)){
-        errno = EOVERFLOW;
-        return false;
+    if (is_dir(node) && source_dir_node != dist_dir_node) {
+        Directory* directory = node->data;
+        int slot = find_entry(directory, "..");
+        if (slot >= 0) {
+            directory->entries[slot].node_number = dist_dir_node->node_number;
+        }
+        source_dir_node->st->st_nlink--;
+        dist_dir_node->st->st_nlink++;
     }
-    
+    usage_moved(node, dist_dir_node);
+    update_times(source_dir_node, TIME_MTIME | TIME_CTIME);
+    update_times(dist_dir_node, TIME_MTIME | TIME_CTIME);
+    update_times(node, TIME_CTIME);
+    return true;
+}
 
-    return node;
+// Время ------------------------------------------------------------------------------
+
+#define RELATIME_INTERVAL (24 * 60 * 60)
+
+static __thread struct timespec thread_clock;
+static __thread bool thread_clock_set = false;
+
+void refresh_clock(void) {
+    clock_gettime(CLOCK_REALTIME_COARSE, &thread_clock);
+    thread_clock_set = true;
+}
+
+struct timespec current_time(void) {
+    if (thread_clock_set) return thread_clock;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    return now;
+}
+
+void update_times(Inode* node, int which) {
+    struct timespec now = current_time();
+    if (which & TIME_ATIME) node->st->st_atim = now;
+    if (which & TIME_MTIME) node->st->st_mtim = now;
+    if (which & TIME_CTIME) node->st->st_ctim = now;
+}
+
+static bool time_after(struct timespec a, struct timespec b) {
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+bool atime_stale(const Inode* node) {
+    const struct stat* st = node->st;
+    if (!time_after(st->st_atim, st->st_mtim) || !time_after(st->st_atim, st->st_ctim)) return true;
+    return current_time().tv_sec - st->st_atim.tv_sec >= RELATIME_INTERVAL;
+}
+
+// Операции ------------------------------------------------------------------------------
+// Общая часть колбэков fuse и воспроизведения журнала.
+// Возвращают 0 (write_node - число байт) или -errno, как принято в fuse.
+
+static struct stat* new_node_stat(int node_number, mode_t mode, uid_t uid, gid_t gid) {
+    struct stat* st = calloc(1, sizeof(struct stat));
+    if (st == NULL) return NULL;
+    st->st_ino = node_number;
+    st->st_mode = mode;
+    st->st_uid = uid;
+    st->st_gid = gid;
+    st->st_atim = st->st_mtim = st->st_ctim = current_time();
+    return st;
+}
+
+// Проверяет, что в каталоге можно создать запись с именем из path
+static int check_new_entry(Inode* parent_dir_node, const char* name) {
+    if (strlen(name) >= MAX_FILE_NAME) return -ENAMETOOLONG;
+    Directory* parent_dir = parent_dir_node->data;
+    if (check_entry(parent_dir, name)) return -EEXIST;
+    if (parent_dir->num_entries >= MAX_FILES) return -ENOSPC;
+    return 0;
 }
 
+int make_node(Filesystem* fs, const char* path, mode_t mode, uid_t uid, gid_t gid) {
+    Inode* parent_dir_node = get_parent_directory(path, fs->inodes_list);
+    if (parent_dir_node == NULL) return -ENOENT;
+    const char* name = get_last_name(path);
+    int res = check_new_entry(parent_dir_node, name);
+    if (res != 0) return res;
+
+    int node_number = allocate_inode_number(fs->inodes_numbers_tracker);
+    if (node_number < 0) return -ENOSPC;
+    struct stat* st = new_node_stat(node_number, mode, uid, gid);
+    if (st == NULL) {
+        free_inode_number(fs->inodes_numbers_tracker, node_number);
+        return -ENOMEM;
+    }
+    st->st_nlink = 1;
+    Inode* node = init_inode(node_number, st, NULL, parent_dir_node);
+    add_entry(parent_dir_node->data, name, node_number);
+    add_inode_to_container(fs->inodes_list, node_number, node);
+    usage_created(node);
+    update_times(parent_dir_node, TIME_MTIME | TIME_CTIME);
+    return 0;
+}
+
+// Жёсткая ссылка newpath на файл path
+int link_node(Filesystem* fs, const char* path, const char* newpath) {
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    if (!node) return -ENOENT;
+    if (is_dir(node)) return -EPERM;
+    Inode* parent_dir_node = get_parent_directory(newpath, fs->inodes_list);
+    if (parent_dir_node == NULL) return -ENOENT;
+    const char* name = get_last_name(newpath);
+    int res = check_new_entry(parent_dir_node, name);
+    if (res != 0) return res;
+
+    // Файл без ссылок снова попадает в учёт, уже в новом каталоге
+    bool orphan = node->st->st_nlink == 0;
+    if (!add_node_by_path(newpath, node, fs->inodes_list)) return -errno;
+    if (orphan) {
+        node->parent_node = parent_dir_node;
+        usage_created(node);
+    }
+    return 0;
+}
+
+int make_directory(Filesystem* fs, const char* path, mode_t mode, uid_t uid, gid_t gid) {
+    Inode* parent_dir_node = get_parent_directory(path, fs->inodes_list);
+    if (parent_dir_node == NULL) return -ENOENT;
+    const char* name = get_last_name(path);
+    int res = check_new_entry(parent_dir_node, name);
+    if (res != 0) return res;
+
+    Directory* dir_data = calloc(1, sizeof(Directory));
+    if (dir_data == NULL) return -ENOMEM;
+    int node_number = allocate_inode_number(fs->inodes_numbers_tracker);
+    if (node_number < 0) {
+        free(dir_data);
+        return -ENOSPC;
+    }
+    struct stat* st = new_node_stat(node_number, mode | __S_IFDIR, uid, gid);
+    if (st == NULL) {
+        free(dir_data);
+        free_inode_number(fs->inodes_numbers_tracker, node_number);
+        return -ENOMEM;
+    }
+    Inode* dir_node = init_inode(node_number, st, dir_data, parent_dir_node);
+    set_directory_ordered(dir_data, ((Directory*)parent_dir_node->data)->ordered);
+
+    add_entry(dir_data, ".", node_number);
+    dir_node->st->st_nlink++;
+    add_entry(dir_data, "..", parent_dir_node->node_number);
+    parent_dir_node->st->st_nlink++;
+
+    add_entry(parent_dir_node->data, name, node_number);
+    dir_node->st->st_nlink++;
+    add_inode_to_container(fs->inodes_list, node_number, dir_node);
+    usage_created(dir_node);
+    update_times(parent_dir_node, TIME_MTIME | TIME_CTIME);
+    return 0;
+}
+
+int unlink_node(Filesystem* fs, const char* path) {
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    if (!node) return -ENOENT;
+    if (is_dir(node)) return -EPERM;
+    if (node->nopen) return -EBUSY;
+    if (!remove_node_by_path(path, fs)) return -errno;
+    return 0;
+}
+
+int remove_directory(Filesystem* fs, const char* path) {
+    if (strcmp(path, "/") == 0) return -EACCES;
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    if (!node) return -ENOENT;
+    if (!is_dir(node)) return -ENOTDIR;
+    if (!remove_node_by_path(path, fs)) return -errno;
+    return 0;
+}
+
+// Отпускает ссылку на node из удаляемого каталога parent; подкаталоги
+// обходятся по номерам инод, без разбора путей от корня
+static void drop_tree_node(Filesystem* fs, Inode* node, Inode* parent) {
+    if (!is_dir(node)) {
+        node->st->st_nlink--;
+        usage_unlinked(fs->inodes_list, node, parent);
+        // Открытый файл доживёт до release, как после unlink
+        if (node->st->st_nlink == 0 && !node->nopen) release_inode(fs, node);
+        return;
+    }
+    // Учёт файла с другими ссылками не должен переехать в удаляемый каталог
+    node->st->st_nlink = 0;
+    Directory* dir = node->data;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        const char* name = dir->entries[i].name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        Inode* child = get_inode_from_container(fs->inodes_list, dir->entries[i].node_number);
+        if (child) drop_tree_node(fs, child, node);
+    }
+    usage_unlinked(fs->inodes_list, node, parent);
+    release_inode(fs, node);
+}
+
+int remove_tree(Filesystem* fs, const char* path) {
+    if (strcmp(path, "/") == 0) return -EACCES;
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    if (!node) return -ENOENT;
+    Inode* parent = get_parent_directory(path, fs->inodes_list);
+    if (!parent || !remove_entry(parent->data, get_last_name(path))) return -ENOENT;
+    if (is_dir(node)) parent->st->st_nlink--;
+    update_times(parent, TIME_MTIME | TIME_CTIME);
+    drop_tree_node(fs, node, parent);
+    return 0;
+}
+
+int order_directory(Filesystem* fs, const char* path, bool ordered) {
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    if (!node) return -ENOENT;
+    if (!is_dir(node)) return -ENOTDIR;
+    set_directory_ordered(node->data, ordered);
+    return 0;
+}
+
+int rename_node(Filesystem* fs, const char* path, const char* newpath) {
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    if (!node) return -ENOENT;
+
+    const char* old_name = get_last_name(path);
+    const char* new_name = get_last_name(newpath);
+    if (strcmp(old_name, ".") == 0 || strcmp(old_name, "..") == 0
+        || strcmp(new_name, ".") == 0 || strcmp(new_name, "..") == 0) {
+        return -EINVAL;
+    }
+    if (strlen(new_name) >= MAX_FILE_NAME) return -ENAMETOOLONG;
+    if (get_inode_by_path(newpath, fs->inodes_list) != NULL) return -EEXIST;
+    if (!move_node(path, newpath, fs->inodes_list)) return -errno;
+    return 0;
+}
+
+static FileData* node_file_data(Inode* node) {
+    if (node->data == NULL) node->data = init_file_data();
+    return node->data;
+}
+
+// Сколько байт страницы index лежит внутри файла размера size
+static size_t page_valid_bytes(off_t size, size_t index) {
+    off_t start = (off_t)index * FILE_PAGE_SIZE;
+    if (size <= start) return 0;
+    return size - start >= FILE_PAGE_SIZE ? FILE_PAGE_SIZE : (size_t)(size - start);
+}
+
+// Возвращает страницу, в которую можно писать: общую, из образа или
+// из индекса дедупликации копирует
+static DataPage* writable_page(FileData* file, size_t index, off_t size) {
+    DataPage* page = file->pages[index];
+    if (page && page->refcount == 1 && !page->mapped && !page->indexed) {
+        if (!make_page_hot(page)) return NULL;
+        page->incompressible = false;
+        page->preallocated = false;
+        touch_page(page);
+        return page;
+    }
+
+    const char* image = image_page(file, index);
+    size_t valid = page || image ? page_valid_bytes(size, index) : 0;
+    const char* source = page && valid ? load_page_data(page) : image;
+    if (valid && source == NULL) return NULL;
+    char* data = alloc_page_data();
+    if (data == NULL) return NULL;
+    if (valid) memcpy(data, source, valid);
+    memset(data + valid, 0, FILE_PAGE_SIZE - valid);
+    DataPage* copy = init_data_page(data, false);
+    if (copy == NULL) {
+        free_page_data(data);
+        return NULL;
+    }
+    if (page) release_data_page(page);
+    file->pages[index] = copy;
+    return copy;
+}
+
+// Перед увеличением размера обнуляет хвост последней страницы за старым концом,
+// чтобы там читались нули, а не остатки прежних данных или соседний файл образа
+static bool zero_file_tail(FileData* file, off_t size) {
+    size_t index = size / FILE_PAGE_SIZE;
+    size_t in_page = size % FILE_PAGE_SIZE;
+    if (in_page == 0 || index >= file->num_pages) return true;
+    if (file->pages[index] == NULL && image_page(file, index) == NULL) return true;
+    DataPage* page = writable_page(file, index, size);
+    if (page == NULL) return false;
+    memset(page->data + in_page, 0, FILE_PAGE_SIZE - in_page);
+    return true;
+}
+
+// Меняет размер файла: лишние страницы отпускает, при росте добавляет дырки
+static int resize_file_data(Inode* node, off_t size) {
+    FileData* file = node_file_data(node);
+    if (file == NULL) return -ENOMEM;
+    size_t num_pages = (size + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+    if (size > node->st->st_size) {
+        if (!zero_file_tail(file, node->st->st_size)) return -ENOMEM;
+        if (!reserve_file_pages(file, num_pages)) return -ENOMEM;
+    } else {
+        for (size_t i = num_pages; i < file->num_pages; i++) {
+            if (file->pages[i]) release_data_page(file->pages[i]);
+        }
+        if (file->image_pages > num_pages) file->image_pages = num_pages;
+        if (num_pages < file->num_pages) {
+            file->num_pages = num_pages;
+            shrink_page_table(file);
+            page_alloc_trim();
+        }
+    }
+    usage_set_size(node, size);
+    return 0;
+}
+
+int read_node(Inode* node, char* buf, size_t size, off_t offset) {
+    if (is_dir(node)) return -EISDIR;
+    if (offset < 0) return -EINVAL;
+    if (offset >= node->st->st_size) return 0;
+    if (offset + size > node->st->st_size) size = node->st->st_size - offset;
+
+    FileData* file = node->data;
+    size_t done = 0;
+    while (done < size) {
+        size_t index = (offset + done) / FILE_PAGE_SIZE;
+        size_t in_page = (offset + done) % FILE_PAGE_SIZE;
+        size_t chunk = FILE_PAGE_SIZE - in_page;
+        if (chunk > size - done) chunk = size - done;
+        DataPage* page = file && index < file->num_pages ? file->pages[index] : NULL;
+        const char* image = file && page == NULL ? image_page(file, index) : NULL;
+        if (page) {
+            const char* data = load_page_data(page);
+            if (data == NULL) return done ? (int)done : -EIO;
+            memcpy(buf + done, data + in_page, chunk);
+            touch_page(page);
+        } else if (image) {
+            memcpy(buf + done, image + in_page, chunk);
+        } else {
+            memset(buf + done, 0, chunk);
+        }
+        done += chunk;
+    }
+    return (int)size;
+}
+
+// Копирует buf в страницы; размер файла уже покрывает диапазон
+static int write_pages(Inode* node, const char* buf, size_t size, off_t offset) {
+    FileData* file = node->data;
+    size_t done = 0;
+    while (done < size) {
+        size_t index = (offset + done) / FILE_PAGE_SIZE;
+        size_t in_page = (offset + done) % FILE_PAGE_SIZE;
+        size_t chunk = FILE_PAGE_SIZE - in_page;
+        if (chunk > size - done) chunk = size - done;
+        DataPage* page = writable_page(file, index, node->st->st_size);
+        if (page == NULL) return done ? (int)done : -ENOMEM;
+        memcpy(page->data + in_page, buf + done, chunk);
+        done += chunk;
+    }
+    if (size) update_times(node, TIME_MTIME | TIME_CTIME);
+    return (int)size;
+}
+
+int write_node(Inode* node, const char* buf, size_t size, off_t offset) {
+    if (is_dir(node)) return -EISDIR;
+    if (offset < 0) return -EINVAL;
+    if (offset + size > node->st->st_size) {
+        int res = resize_file_data(node, offset + size);
+        if (res != 0) return res;
+    }
+    return write_pages(node, buf, size, offset);
+}
+
+// Хвост последней страницы за концом файла будет целиком перезаписан,
+// поэтому resize_file_data с обнулением хвоста не нужен: достаточно
+// места в таблице страниц
+int append_node(Inode* node, const char* buf, size_t size, off_t* offset) {
+    if (is_dir(node)) return -EISDIR;
+    FileData* file = node_file_data(node);
+    if (file == NULL) return -ENOMEM;
+    off_t start = node->st->st_size;
+    if (!reserve_file_pages(file, (start + size + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE)) return -ENOMEM;
+    usage_set_size(node, start + size);
+    *offset = start;
+    return write_pages(node, buf, size, start);
+}
+
+int truncate_node(Inode* node, off_t size) {
+    if (is_dir(node)) return -EISDIR;
+    if (size < 0) return -EINVAL;
+    int res = resize_file_data(node, size);
+    if (res == 0) update_times(node, TIME_MTIME | TIME_CTIME);
+    return res;
+}
+
+// Целые страницы диапазона становятся дырками, у крайних обнуляется часть
+static int punch_hole(FileData* file, off_t size, off_t offset, off_t end) {
+    off_t table_end = (off_t)file->num_pages * FILE_PAGE_SIZE;
+    if (end > table_end) end = table_end;
+    if (offset < end && !detach_image(file, offset / FILE_PAGE_SIZE)) return -ENOMEM;
+    while (offset < end) {
+        size_t index = offset / FILE_PAGE_SIZE;
+        size_t in_page = offset % FILE_PAGE_SIZE;
+        size_t chunk = FILE_PAGE_SIZE - in_page;
+        if ((off_t)chunk > end - offset) chunk = end - offset;
+        DataPage* page = file->pages[index];
+        if (page && chunk == FILE_PAGE_SIZE) {
+            release_data_page(page);
+            file->pages[index] = NULL;
+        } else if (page) {
+            page = writable_page(file, index, size);
+            if (page == NULL) return -ENOMEM;
+            memset(page->data + in_page, 0, chunk);
+        }
+        offset += chunk;
+    }
+    page_alloc_trim();
+    return 0;
+}
+
+// Заранее выделяет страницы под диапазон, чтобы запись в него уже не
+// выделяла память. С KEEP_SIZE страницы могут лежать и за концом файла.
+int fallocate_node(Inode* node, int mode, off_t offset, off_t length) {
+    if (is_dir(node)) return -EISDIR;
+    if (offset < 0 || length <= 0) return -EINVAL;
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) return -EOPNOTSUPP;
+    if (offset > LLONG_MAX - length) return -EFBIG;
+    FileData* file = node_file_data(node);
+    if (file == NULL) return -ENOMEM;
+    off_t end = offset + length;
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        if (!(mode & FALLOC_FL_KEEP_SIZE)) return -EOPNOTSUPP;
+        int res = punch_hole(file, node->st->st_size, offset, end);
+        if (res == 0) update_times(node, TIME_MTIME | TIME_CTIME);
+        return res;
+    }
+
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && end > node->st->st_size) {
+        int res = resize_file_data(node, end);
+        if (res != 0) return res;
+        update_times(node, TIME_MTIME | TIME_CTIME);
+    }
+    size_t last = (end + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+    if (!reserve_file_pages(file, last)) return -ENOMEM;
+    for (size_t i = offset / FILE_PAGE_SIZE; i < last; i++) {
+        if (file->pages[i] || image_page(file, i)) continue;
+        char* data = alloc_page_data();
+        if (data == NULL) return -ENOMEM;
+        memset(data, 0, FILE_PAGE_SIZE);
+        DataPage* page = init_data_page(data, false);
+        if (page == NULL) {
+            free_page_data(data);
+            return -ENOMEM;
+        }
+        page->preallocated = true;
+        file->pages[i] = page;
+    }
+    return 0;
+}
+
+// Делает dst копией src, разделяя все страницы (FICLONE)
+int clone_node(Inode* src, Inode* dst) {
+    if (is_dir(src) || is_dir(dst)) return -EISDIR;
+    if (src == dst) return 0;
+    FileData* src_file = node_file_data(src);
+    if (src_file == NULL) return -ENOMEM;
+    FileData* clone = init_file_data();
+    if (clone == NULL || !reserve_file_pages(clone, src_file->num_pages)) {
+        free(clone);
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < src_file->num_pages; i++) {
+        clone->pages[i] = src_file->pages[i];
+        if (clone->pages[i]) get_data_page(clone->pages[i]);
+    }
+    clone->image = src_file->image;
+    clone->image_pages = src_file->image_pages;
+    if (dst->data) destroy_file_data(dst->data);
+    dst->data = clone;
+    usage_set_size(dst, src->st->st_size);
+    update_times(dst, TIME_MTIME | TIME_CTIME);
+    return 0;
+}
+
+// Страница для разделения с другим файлом: нетронутая страница образа
+// сначала получает свою DataPage
+static DataPage* shared_page(FileData* file, size_t index) {
+    if (index >= file->num_pages) return NULL;
+    char* image = image_page(file, index);
+    if (image) file->pages[index] = init_data_page(image, true);
+    return file->pages[index];
+}
+
+// Побайтовое копирование через промежуточный буфер размером в страницу
+static int copy_node_bytes(Inode* src, off_t src_offset, Inode* dst, off_t dst_offset, size_t size) {
+    char buf[FILE_PAGE_SIZE];
+    size_t done = 0;
+    while (done < size) {
+        size_t chunk = size - done < FILE_PAGE_SIZE ? size - done : FILE_PAGE_SIZE;
+        int res = read_node(src, buf, chunk, src_offset + done);
+        if (res < 0) return res;
+        res = write_node(dst, buf, chunk, dst_offset + done);
+        if (res < 0) return res;
+        done += chunk;
+    }
+    return 0;
+}
+
+// copy_file_range: целые страницы при одинаковом выравнивании не копируются,
+// а разделяются; неполные края копируются побайтово. Возвращает число байт.
+int copy_node_range(Inode* src, off_t src_offset, Inode* dst, off_t dst_offset, size_t size) {
+    if (is_dir(src) || is_dir(dst)) return -EISDIR;
+    if (src_offset < 0 || dst_offset < 0) return -EINVAL;
+    if (src_offset >= src->st->st_size) return 0;
+    if (src_offset + size > src->st->st_size) size = src->st->st_size - src_offset;
+    if (size > INT_MAX) size = INT_MAX & ~(FILE_PAGE_SIZE - 1);
+    if (src == dst && src_offset < dst_offset + (off_t)size && dst_offset < src_offset + (off_t)size) {
+        return -EINVAL;
+    }
+    if (size == 0) return 0;
+    if (dst_offset + size > dst->st->st_size) {
+        int res = resize_file_data(dst, dst_offset + size);
+        if (res != 0) return res;
+    }
+
+    size_t head = 0;
+    size_t full_pages = 0;
+    if (src_offset % FILE_PAGE_SIZE == dst_offset % FILE_PAGE_SIZE) {
+        head = (FILE_PAGE_SIZE - src_offset % FILE_PAGE_SIZE) % FILE_PAGE_SIZE;
+        if (head > size) head = size;
+        full_pages = (size - head) / FILE_PAGE_SIZE;
+    } else {
+        head = size;
+    }
+
+    int res = copy_node_bytes(src, src_offset, dst, dst_offset, head);
+    if (res < 0) return res;
+
+    FileData* src_file = node_file_data(src);
+    FileData* dst_file = dst->data;
+    size_t src_index = (src_offset + head) / FILE_PAGE_SIZE;
+    size_t dst_index = (dst_offset + head) / FILE_PAGE_SIZE;
+    if (full_pages && !detach_image(dst_file, dst_index)) return -ENOMEM;
+    for (size_t i = 0; i < full_pages; i++) {
+        DataPage* page = shared_page(src_file, src_index + i);
+        if (page == NULL && image_page(src_file, src_index + i)) return -ENOMEM;
+        if (dst_file->pages[dst_index + i]) release_data_page(dst_file->pages[dst_index + i]);
+        dst_file->pages[dst_index + i] = page;
+        if (page) get_data_page(page);
+    }
+
+    size_t tail_start = head + full_pages * FILE_PAGE_SIZE;
+    res = copy_node_bytes(src, src_offset + tail_start, dst, dst_offset + tail_start, size - tail_start);
+    if (res < 0) return res;
+    update_times(dst, TIME_MTIME | TIME_CTIME);
+    return (int)size;
+}
+
+static bool valid_time(const struct timespec* value) {
+    return value->tv_nsec == UTIME_NOW || value->tv_nsec == UTIME_OMIT
+        || (value->tv_nsec >= 0 && value->tv_nsec < 1000000000);
+}
+
+static void set_time(struct timespec* field, const struct timespec* value, struct timespec now) {
+    if (value->tv_nsec == UTIME_OMIT) return;
+    *field = value->tv_nsec == UTIME_NOW ? now : *value;
+}
+
+int set_node_times(Inode* node, const struct timespec tv[2]) {
+    struct timespec now = current_time();
+    if (tv == NULL) {
+        node->st->st_atim = node->st->st_mtim = now;
+    } else {
+        if (!valid_time(&tv[0]) || !valid_time(&tv[1])) return -EINVAL;
+        set_time(&node->st->st_atim, &tv[0], now);
+        set_time(&node->st->st_mtim, &tv[1], now);
+    }
+    node->st->st_ctim = now;
+    return 0;
+}
@@ -5,10 +5,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/falloc.h>
 #include <unistd.h>
+#include <pthread.h>
 
 
 
@@ -26,12 +29,74 @@ typedef struct Inode{
     struct stat *st;
     void *data;
     struct Inode *parent_node;
-    char nopen;
+    unsigned int nopen;  // открытых дескрипторов
 } Inode;
 
 Inode* init_inode(int node_number, struct stat *st, void *data, Inode *parent_node);
 void destroy_inode(Inode *node);
 
+// FileData ----------------------------------------------------------------
+// Содержимое обычного файла (node->data) - таблица страниц. Страницы
+// разделяются между файлами по счётчику ссылок и копируются при первой
+// записи, поэтому клонирование файла не копирует данные.
+#define FILE_PAGE_SIZE 4096
+
+typedef struct DataPage{
+    int refcount;
+    bool mapped;    // data лежит внутри отображённого образа (см. snapshot.h)
+    bool indexed;   // страница в индексе дедупликации (см. dedup.h), менять на месте нельзя
+    bool incompressible;
+    bool preallocated;  // выделена fallocate и ещё не записывалась
+    bool referenced;  // бит CLOCK для вытеснения (см. spill.h); под блокировкой чтения - __atomic
+    bool spilled;     // данные выгружены в файл подкачки, слот spill_slot
+    char *data;     // NULL, если страница сжата и не разжата (см. compress.h) или выгружена
+    char *zdata;    // сжатая копия или NULL
+    uint32_t zsize;
+    uint32_t spill_slot;
+    uint32_t last_access;  // секунды, как referenced (см. touch_page)
+    uint64_t hash;
+    struct DataPage *hash_next;
+} DataPage;
+
+typedef struct FileData{
+    DataPage **pages;   // NULL - страница из нулей или ещё не тронутая страница образа
+    size_t num_pages;
+    size_t capacity;    // под сколько страниц выделена таблица
+    char *image;        // данные файла в отображении образа (см. snapshot.h)
+    size_t image_pages; // пустые записи с меньшим номером читаются из image
+    struct FileData *reclaim_next;  // очередь фонового освобождения (см. reclaim.h)
+} FileData;
+
+FileData* init_file_data();
+void destroy_file_data(FileData *file);
+char* image_page(const FileData *file, size_t index);
+
+// Страница, захваченная для чтения вне блокировки записи: своя DataPage
+// со ссылкой или ещё не тронутая страница образа (образ не меняется)
+typedef struct PageRef{
+    DataPage *page;
+    const char *image;
+} PageRef;
+
+void get_page_ref(const FileData *file, size_t index, PageRef *ref);
+DataPage* init_data_page(char *data, bool mapped);
+void get_data_page(DataPage *page);
+void release_data_page(DataPage *page);
+bool reserve_file_pages(FileData *file, size_t num_pages);
+
+// Счётчики страниц для статистики
+typedef struct DataStats{
+    size_t pages;         // страниц в куче
+    size_t mapped_pages;  // страниц образа, у которых уже есть DataPage
+    size_t page_refs;     // ссылок на страницы из файлов
+    size_t compressed_pages;
+    size_t compressed_bytes;
+    size_t cached_pages;  // сжатые страницы, у которых есть разжатая копия
+    size_t spilled_pages; // страницы, выгруженные в файл подкачки
+} DataStats;
+
+extern DataStats data_stats;
+
 // InodeNumbersTracker -----------------------------------------------------
 // Manages node numbers
 typedef struct InodesNumbersTracker{
@@ -58,34 +123,111 @@ bool remove_inode_from_container(InodeContainer *container, int node_number);
 bool is_valid_number(int node_number);
 
 // Directory ---------------------------------------------------------------
+// Записи не сдвигаются: удаление освобождает слот (node_number == 0), новая
+// запись занимает первый свободный. Номер слота - позиция курсора readdir, поэтому
+// продолжение листинга не пропускает и не повторяет записи, которые
+// существовали всё это время, даже если каталог меняется между вызовами.
+//
+// Упорядоченный каталог дополнительно держит номера слотов, отсортированные
+// по имени (order): поиск двоичный, readdir отдаёт имена по возрастанию,
+// диапазон имён читается без сортировки. Подкаталоги наследуют режим.
 typedef struct DirectoryEntry{
-    char name[MAX_FILE_NAME];
-    int node_number;
+    char name[MAX_FILE_NAME];  // у свободного слота - последнее имя в нём
+    int node_number;           // 0 - свободный слот
+    uint32_t generation;       // сколько раз слот занимали
 } DirectoryEntry;
 
+// Суммарный размер файлов и число инод (см. usage.h)
+typedef struct Usage{
+    int64_t bytes;     // сумма st_size (видимый размер), не занятые страницы
+    int64_t inodes;
+} Usage;
+
 typedef struct Directory{
     DirectoryEntry entries[MAX_FILES];
-    int num_entries;
+    int num_entries;  // занятых слотов
+    int num_slots;    // слоты [num_slots, MAX_FILES) ни разу не заняты или освобождены с конца
+    bool ordered;
+    unsigned char order[MAX_FILES];  // [0, num_entries) - слоты по возрастанию имён
+    Usage usage;      // поддерево вместе с самим каталогом
 } Directory;
 
 bool add_entry(Directory *dir, const char *name, int node_number);
 bool remove_entry(Directory *dir, const char *name);
+// Меняет имя на месте, запись остаётся в своём слоте
+bool rename_entry(Directory *dir, const char *name, const char *new_name);
 char check_entry(Directory* dir, const char *name);
+// Первый занятый слот, начиная со slot, или -1:
+// for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1))
+int next_entry(const Directory *dir, int slot);
+void set_directory_ordered(Directory *dir, bool ordered);
+// Слоты по возрастанию имён в order, возвращает их число. У упорядоченного
+// каталога это копия индекса, у обычного - сортировка на месте.
+int sorted_entries(const Directory *dir, unsigned char order[MAX_FILES]);
+// Позиция в order первого имени, не меньшего name
+int lower_bound_entry(const Directory *dir, const unsigned char *order, int count, const char *name);
 
 // Filesystem --------------------------------------------------------------
 typedef struct Filesystem{
     Inode *root;
     InodeContainer *inodes_list;
     InodesNumbersTracker *inodes_numbers_tracker;
+    void *image;       // образ, из которого восстановлена fs (или NULL)
+    size_t image_size;
+    pthread_rwlock_t lock;
 } Filesystem;
 
 Filesystem* init_filesystem();
+// Освобождает все иноды и их данные; образ отпускает release_snapshot
+void destroy_filesystem(Filesystem* fs);
+// Колбэки и фоновые потоки работают с деревом только под этой блокировкой
+void read_lock_filesystem(Filesystem* fs);
+void write_lock_filesystem(Filesystem* fs);
+void unlock_filesystem(Filesystem* fs);
 Inode* get_inode_by_path(const char* path, InodeContainer* inodes_container);
 char* get_last_name(const char* path);
 bool add_node_by_path(const char * path, Inode* node, InodeContainer* inodes_container);
-bool remove_node_by_path(const char* path, InodeContainer* inodes_container);
+bool remove_node_by_path(const char* path, Filesystem* fs);
+void release_inode(Filesystem* fs, Inode* node);
 bool is_dir_empty(Inode* node);
 bool move_node(const char* path, const char* new_path, InodeContainer* container);
 int add_node_to_directory(Inode* dir_node, Inode* node, const char* name);
 Inode* get_parent_directory(const char* path, InodeContainer* inodes_container);
+
+// Время -------------------------------------------------------------------
+// Метки берутся из грубых часов (CLOCK_REALTIME_COARSE, шаг - тик ядра).
+// Поток обработки обновляет своё время раз на запрос, и все изменения
+// внутри запроса получают одну метку; остальные потоки читают часы сами.
+#define TIME_ATIME 1
+#define TIME_MTIME 2
+#define TIME_CTIME 4
+
+void refresh_clock(void);
+struct timespec current_time(void);
+void update_times(Inode* node, int which);
+// relatime: atime стоит обновлять, только если он не новее mtime или ctime
+// либо отстал больше чем на сутки
+bool atime_stale(const Inode* node);
+
+// Операции (0 или -errno) ------------------------------------------------
+int make_node(Filesystem* fs, const char* path, mode_t mode, uid_t uid, gid_t gid);
+int make_directory(Filesystem* fs, const char* path, mode_t mode, uid_t uid, gid_t gid);
+int unlink_node(Filesystem* fs, const char* path);
+int link_node(Filesystem* fs, const char* path, const char* newpath);
+int remove_directory(Filesystem* fs, const char* path);
+// rm -rf: удаляет path вместе со всем поддеревом за один проход
+int remove_tree(Filesystem* fs, const char* path);
+// Включает или выключает индекс имён каталога (новые подкаталоги наследуют)
+int order_directory(Filesystem* fs, const char* path, bool ordered);
+int rename_node(Filesystem* fs, const char* path, const char* newpath);
+int read_node(Inode* node, char* buf, size_t size, off_t offset);
+int write_node(Inode* node, const char* buf, size_t size, off_t offset);
+// O_APPEND: пишет в текущий конец файла, смещение записи - в *offset
+int append_node(Inode* node, const char* buf, size_t size, off_t* offset);
+int truncate_node(Inode* node, off_t size);
+int fallocate_node(Inode* node, int mode, off_t offset, off_t length);
+int clone_node(Inode* src, Inode* dst);
+int copy_node_range(Inode* src, off_t src_offset, Inode* dst, off_t dst_offset, size_t size);
+// utimensat: tv[0] - atime, tv[1] - mtime, допускаются UTIME_NOW и UTIME_OMIT
+int set_node_times(Inode* node, const struct timespec tv[2]);
 #endif /* FILE_SYSTEM_H */
\ No newline at end of file
@@ -1,4 +1,19 @@
 #include "filesystem.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "compress.h"
+#include "dedup.h"
+#include "spill.h"
+#include "pagealloc.h"
+#include "reclaim.h"
+#include "populate.h"
+#include "export.h"
+#include "freeze.h"
+#include "trace.h"
+#include "counters.h"
+#include "handle.h"
+#include "usage.h"
+#include "fifo.h"
 
 void test_FindInodeByName() {
     Filesystem* fs = init_filesystem();
@@ -10,7 +25,7 @@ void test_FindInodeByName() {
     add_entry(root_dir, "subdir", 2);
     add_entry(root_dir, "file2", 22);
 
-    Directory* sub_directory = malloc(sizeof(Directory));
+    Directory* sub_directory = calloc(1, sizeof(Directory));
     struct stat* dir_stat = malloc(sizeof(struct stat));
     dir_stat->st_mode = S_IRWXO | S_IRWXG | S_IRWXU | __S_IFDIR;
     Inode* subdirInode = init_inode(2, dir_stat, sub_directory, NULL);
@@ -63,7 +78,7 @@ void test_FindInodeByName() {
         printf("%d", fs->root->parent_node->node_number);
     }
 
-    remove_node_by_path("/subdir/file1", fs->inodes_list);
+    remove_node_by_path("/subdir/file1", fs);
     foundInode = get_inode_by_path("/subdir/file1", fs->inodes_list);
     if (foundInode != file1Inode) {
         printf("Ошибка: Неверный результат для поиска\n");
@@ -72,15 +87,1097 @@ void test_FindInodeByName() {
         printf("%d\n", foundInode->node_number);
         printf("%d", fs->root->parent_node->node_number);
     }
-    remove_node_by_path("/subdir/file3", fs->inodes_list);
+    remove_node_by_path("/subdir/file3", fs);
 
     printf("DDF %d\n", ((Directory*)subdirInode->data)->num_entries);
     if (is_dir_empty(subdirInode)){printf("AAAA0");}
 }
 
+void test_SnapshotRoundTrip() {
+    Filesystem* fs = init_filesystem();
+    const char* data = "snapshot data";
+    make_node(fs, "/file", S_IFREG | 0644, 0, 0);
+    Inode* file = get_inode_by_path("/file", fs->inodes_list);
+    write_node(file, data, strlen(data), 0);
+    file->st->st_mtim.tv_nsec = 123456789;
+    make_node(fs, "/second", S_IFREG | 0644, 0, 0);
+    write_node(get_inode_by_path("/second", fs->inodes_list), "2", 1, 0);
+    // Удалённый, но открытый файл в образ не попадает
+    make_node(fs, "/orphan", S_IFREG | 0644, 0, 0);
+    Inode* orphan = get_inode_by_path("/orphan", fs->inodes_list);
+    orphan->nopen = 1;
+    remove_node_by_path("/orphan", fs);
+
+    const char* image = "/tmp/tmpfs_snapshot_test.img";
+    if (!save_snapshot(fs, image)) {
+        printf("Ошибка: Не удалось сохранить образ\n");
+        return;
+    }
+    Filesystem* restored = restore_snapshot(image);
+    Inode* found = restored ? get_inode_by_path("/file", restored->inodes_list) : NULL;
+    Inode* second = restored ? get_inode_by_path("/second", restored->inodes_list) : NULL;
+    char buf[32] = {0};
+    if (!found || !second || found->st->st_size != (off_t)strlen(data)
+        || image_page(found->data, 0) == NULL
+        || found->st->st_mtim.tv_nsec != 123456789
+        || restored->inodes_list->inode_table[orphan->node_number] != NULL
+        || (image_page(second->data, 0) - (char*)restored->image) % FILE_PAGE_SIZE != 0
+        || read_node(found, buf, sizeof(buf), 0) != (int)strlen(data) || strcmp(buf, data) != 0) {
+        printf("Ошибка: Образ восстановлен неверно\n");
+    } else {
+        printf("Тест сохранения и восстановления образа пройден успешно.\n");
+    }
+    if (found && (write_node(found, "S", 1, 0) != 1 || ((FileData*)found->data)->pages[0]->mapped)) {
+        printf("Ошибка: Не удалось перенести данные из образа\n");
+    }
+
+    // Запись каталога, указывающая на иноду не из образа, делает его повреждённым
+    FILE* img = fopen(image, "r+b");
+    SnapshotHeader header;
+    int32_t missing = MAX_INODES;
+    if (img && fread(&header, sizeof(header), 1, img) == 1) {
+        fseek(img, (long)header.entries_offset, SEEK_SET);
+        fwrite(&missing, sizeof(missing), 1, img);
+    }
+    if (img) fclose(img);
+    Filesystem* broken = restore_snapshot(image);
+    if (broken) {
+        printf("Ошибка: Образ с записью на отсутствующую иноду восстановлен\n");
+    }
+    unlink(image);
+}
+
+void test_ImagePagesOnFirstAccess() {
+    Filesystem* fs = init_filesystem();
+    static char data[4 * FILE_PAGE_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (char)(i / FILE_PAGE_SIZE + 'a');
+    make_node(fs, "/file", S_IFREG | 0644, 0, 0);
+    write_node(get_inode_by_path("/file", fs->inodes_list), data, sizeof(data), 0);
+    const char* image = "/tmp/tmpfs_image_pages_test.img";
+    if (!save_snapshot(fs, image)) {
+        printf("Ошибка: Не удалось сохранить образ\n");
+        return;
+    }
+
+    size_t mapped = data_stats.mapped_pages;
+    Filesystem* restored = restore_snapshot(image);
+    Inode* node = restored ? get_inode_by_path("/file", restored->inodes_list) : NULL;
+    if (node == NULL) {
+        printf("Ошибка: Образ не восстановлен\n");
+        return;
+    }
+    FileData* file = node->data;
+    static char buf[4 * FILE_PAGE_SIZE];
+    // Ни восстановление, ни чтение не заводят DataPage
+    bool ok = data_stats.mapped_pages == mapped && file->pages[0] == NULL && file->pages[3] == NULL
+        && read_node(node, buf, sizeof(buf), 0) == (int)sizeof(buf) && memcmp(buf, data, sizeof(data)) == 0
+        && file->pages[0] == NULL;
+
+    make_node(restored, "/clone", S_IFREG | 0644, 0, 0);
+    make_node(restored, "/copy", S_IFREG | 0644, 0, 0);
+    Inode* clone = get_inode_by_path("/clone", restored->inodes_list);
+    Inode* copy = get_inode_by_path("/copy", restored->inodes_list);
+    ok = ok && clone_node(node, clone) == 0 && write_node(clone, "X", 1, 3 * FILE_PAGE_SIZE) == 1
+        && read_node(clone, buf, sizeof(buf), 0) == (int)sizeof(buf) && memcmp(buf, data, 3 * FILE_PAGE_SIZE) == 0
+        && buf[3 * FILE_PAGE_SIZE] == 'X' && ((FileData*)clone->data)->pages[0] == NULL;
+    // Разделяемая страница образа получает DataPage
+    ok = ok && copy_node_range(node, 0, copy, 0, 2 * FILE_PAGE_SIZE) == 2 * FILE_PAGE_SIZE
+        && file->pages[1] != NULL && ((FileData*)copy->data)->pages[1] == file->pages[1]
+        && data_stats.mapped_pages == mapped + 2;
+
+    // Дырка посреди образа читается нулями, соседние страницы - из образа
+    ok = ok && fallocate_node(node, FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE, 2 * FILE_PAGE_SIZE, FILE_PAGE_SIZE) == 0
+        && read_node(node, buf, sizeof(buf), 0) == (int)sizeof(buf)
+        && buf[2 * FILE_PAGE_SIZE] == 0 && buf[3 * FILE_PAGE_SIZE - 1] == 0
+        && memcmp(buf + 3 * FILE_PAGE_SIZE, data + 3 * FILE_PAGE_SIZE, FILE_PAGE_SIZE) == 0;
+    // После усечения и роста хвост читается нулями, а не из образа
+    ok = ok && truncate_node(node, FILE_PAGE_SIZE / 2) == 0 && truncate_node(node, sizeof(data)) == 0
+        && read_node(node, buf, sizeof(buf), 0) == (int)sizeof(buf)
+        && buf[FILE_PAGE_SIZE / 2 - 1] == 'a' && buf[FILE_PAGE_SIZE / 2] == 0 && buf[3 * FILE_PAGE_SIZE] == 0;
+    if (ok) {
+        printf("Тест создания страниц образа при первом обращении пройден успешно.\n");
+    } else {
+        printf("Ошибка: Страницы образа заводятся не вовремя или читаются неверно\n");
+    }
+    unlink(image);
+}
+
+void test_CloneSharesPages() {
+    Filesystem* fs = init_filesystem();
+    char data[3 * FILE_PAGE_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (char)i;
+    make_node(fs, "/src", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/dst", S_IFREG | 0644, 0, 0);
+    Inode* src = get_inode_by_path("/src", fs->inodes_list);
+    Inode* dst = get_inode_by_path("/dst", fs->inodes_list);
+    write_node(src, data, sizeof(data), 0);
+
+    clone_node(src, dst);
+    FileData* src_file = src->data;
+    bool shared = src_file->pages[1] == ((FileData*)dst->data)->pages[1] && src_file->pages[1]->refcount == 2;
+    write_node(dst, "x", 1, FILE_PAGE_SIZE);
+    char buf[sizeof(data)];
+    read_node(src, buf, sizeof(buf), 0);
+    bool source_intact = memcmp(buf, data, sizeof(data)) == 0 && src_file->pages[1]->refcount == 1;
+
+    // Сдвиг на 10 байт: целые страницы не разделить, копируется побайтово
+    int copied = copy_node_range(src, 10, dst, 20, 2 * FILE_PAGE_SIZE);
+    read_node(dst, buf, 2 * FILE_PAGE_SIZE, 20);
+    if (!shared || !source_intact || copied != 2 * FILE_PAGE_SIZE
+        || memcmp(buf, data + 10, 2 * FILE_PAGE_SIZE) != 0) {
+        printf("Ошибка: Клонирование работает неверно\n");
+    } else {
+        printf("Тест клонирования файла пройден успешно.\n");
+    }
+}
+
+void test_JournalReplay() {
+    const char* log = "/tmp/tmpfs_journal_test.log";
+    unlink(log);
+    Journal* journal = journal_open(log, 10);
+    journal_append(journal, JOURNAL_MKDIR, "/dir", NULL, 0755, 0, 0, 0, NULL, 0);
+    journal_append(journal, JOURNAL_MKNOD, "/dir/a", NULL, S_IFREG | 0644, 0, 0, 0, NULL, 0);
+    journal_append(journal, JOURNAL_WRITE, "/dir/a", NULL, 0, 0, 0, 0, "journal", 7);
+    journal_append(journal, JOURNAL_RENAME, "/dir/a", "/b.txt", 0, 0, 0, 0, NULL, 0);
+    journal_append(journal, JOURNAL_TRUNCATE, "/b.txt", NULL, 0, 0, 0, 4, NULL, 0);
+    journal_append(journal, JOURNAL_LINK, "/b.txt", "/c.txt", 0, 0, 0, 0, NULL, 0);
+    journal_append(journal, JOURNAL_RMDIR, "/dir", NULL, 0, 0, 0, 0, NULL, 0);
+    journal_close(journal);
+
+    Filesystem* fs = init_filesystem();
+    journal_replay(fs, log);
+    Inode* found = get_inode_by_path("/b.txt", fs->inodes_list);
+    char buf[8] = {0};
+    if (!found || read_node(found, buf, sizeof(buf), 0) != 4 || strcmp(buf, "jour") != 0
+        || get_inode_by_path("/dir", fs->inodes_list) != NULL
+        || get_inode_by_path("/c.txt", fs->inodes_list) != found || found->st->st_nlink != 2) {
+        printf("Ошибка: Журнал воспроизведён неверно\n");
+    } else {
+        printf("Тест воспроизведения журнала пройден успешно.\n");
+    }
+    unlink(log);
+}
+
+// Снимок для образа фиксирует дерево на момент захвата, а журнал после
+// сохранения теряет только записи до этого момента
+void test_CheckpointCapture() {
+    const char* image = "/tmp/tmpfs_checkpoint_test.img";
+    const char* log = "/tmp/tmpfs_checkpoint_test.log";
+    unlink(log);
+    Filesystem* fs = init_filesystem();
+    Journal* journal = journal_open(log, 10);
+    make_node(fs, "/f", S_IFREG | 0644, 0, 0);
+    Inode* node = get_inode_by_path("/f", fs->inodes_list);
+    write_node(node, "before", 6, 0);
+    journal_append(journal, JOURNAL_MKNOD, "/f", NULL, S_IFREG | 0644, 0, 0, 0, NULL, 0);
+    journal_append(journal, JOURNAL_WRITE, "/f", NULL, 0, 0, 0, 0, "before", 6);
+
+    write_lock_filesystem(fs);
+    SnapshotCapture* capture = capture_snapshot(fs);
+    uint64_t mark = journal_mark(journal);
+    unlock_filesystem(fs);
+    // Изменения после захвата идут в журнал, но не в образ
+    write_node(node, "after!", 6, 0);
+    journal_append(journal, JOURNAL_WRITE, "/f", NULL, 0, 0, 0, 0, "after!", 6);
+    make_node(fs, "/g", S_IFREG | 0644, 0, 0);
+    journal_append(journal, JOURNAL_MKNOD, "/g", NULL, S_IFREG | 0644, 0, 0, 0, NULL, 0);
+    bool ok = capture && write_snapshot(fs, capture, image);
+    release_capture(fs, capture);
+    ok = ok && journal_discard(journal, mark);
+    journal_close(journal);
+    destroy_filesystem(fs);
+
+    char buf[8] = {0};
+    Filesystem* restored = ok ? restore_snapshot(image) : NULL;
+    ok = restored && get_inode_by_path("/g", restored->inodes_list) == NULL
+        && read_node(get_inode_by_path("/f", restored->inodes_list), buf, 6, 0) == 6
+        && strcmp(buf, "before") == 0;
+    ok = ok && journal_replay(restored, log) && get_inode_by_path("/g", restored->inodes_list) != NULL
+        && read_node(get_inode_by_path("/f", restored->inodes_list), buf, 6, 0) == 6
+        && strcmp(buf, "after!") == 0;
+    struct stat log_stat;
+    ok = ok && stat(log, &log_stat) == 0
+        && log_stat.st_size == (off_t)(2 * sizeof(JournalRecord) + 2 * strlen("/f") + 6);
+    if (restored) {
+        release_snapshot(restored);
+        destroy_filesystem(restored);
+    }
+    unlink(image);
+    unlink(log);
+    if (!ok) {
+        printf("Ошибка: Образ или журнал после checkpoint неверны\n");
+    } else {
+        printf("Тест checkpoint со снимком пройден успешно.\n");
+    }
+}
+
+void test_DedupMergesPages() {
+    Filesystem* fs = init_filesystem();
+    char data[2 * FILE_PAGE_SIZE];
+    memset(data, 'a', FILE_PAGE_SIZE);
+    memset(data + FILE_PAGE_SIZE, 0, FILE_PAGE_SIZE);
+    make_node(fs, "/one", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/two", S_IFREG | 0644, 0, 0);
+    Inode* one = get_inode_by_path("/one", fs->inodes_list);
+    Inode* two = get_inode_by_path("/two", fs->inodes_list);
+    write_node(one, data, sizeof(data), 0);
+    write_node(two, data, sizeof(data), 0);
+
+    size_t pages_before = data_stats.pages;
+    dedup_node(one);
+    dedup_node(two);
+    FileData* first = one->data;
+    FileData* second = two->data;
+    bool merged = first->pages[0] == second->pages[0] && first->pages[1] == NULL
+        && data_stats.pages == pages_before - 3;
+
+    // Запись в общую страницу не должна менять второй файл
+    write_node(two, "b", 1, 0);
+    char buf[1];
+    read_node(one, buf, 1, 0);
+    if (!merged || buf[0] != 'a' || first->pages[0] == second->pages[0]) {
+        printf("Ошибка: Дедупликация работает неверно\n");
+    } else {
+        printf("Тест дедупликации страниц пройден успешно.\n");
+    }
+}
+
+void test_CompressColdPages() {
+    Filesystem* fs = init_filesystem();
+    char data[3 * FILE_PAGE_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = "compressible text "[i % 18];
+    }
+    make_node(fs, "/cold", S_IFREG | 0644, 0, 0);
+    Inode* node = get_inode_by_path("/cold", fs->inodes_list);
+    write_node(node, data, sizeof(data), 0);
+
+    compress_cold_pages(fs, 0);
+    FileData* file = node->data;
+    bool compressed = file->pages[1]->data == NULL && file->pages[1]->zdata != NULL
+        && file->pages[1]->zsize < FILE_PAGE_SIZE / 2;
+
+    // Чтение разжимает, запись возвращает страницу в обычный вид
+    char buf[sizeof(data)];
+    int read = read_node(node, buf, sizeof(buf), 0);
+    write_node(node, "X", 1, FILE_PAGE_SIZE);
+    bool hot = file->pages[1]->zdata == NULL && file->pages[1]->data[0] == 'X';
+    if (!compressed || read != (int)sizeof(data) || memcmp(buf, data, sizeof(data)) != 0 || !hot) {
+        printf("Ошибка: Сжатие холодных страниц работает неверно\n");
+    } else {
+        printf("Тест сжатия холодных страниц пройден успешно.\n");
+    }
+}
+
+void test_SpillToDisk() {
+    Filesystem* fs = init_filesystem();
+    const char* swap = "/tmp/tmpfs_spill_test.swap";
+    size_t heap_before = data_heap_bytes();
+    spill_open(swap, heap_before + 4 * FILE_PAGE_SIZE);
+
+    char data[16 * FILE_PAGE_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)(i * 7 + i / FILE_PAGE_SIZE);
+    }
+    make_node(fs, "/big", S_IFREG | 0644, 0, 0);
+    Inode* node = get_inode_by_path("/big", fs->inodes_list);
+    write_node(node, data, sizeof(data), 0);
+    spill_enforce_budget(fs);
+    bool spilled = data_stats.spilled_pages >= 12 && !spill_over_budget();
+
+    char buf[sizeof(data)];
+    int read = read_node(node, buf, sizeof(buf), 0);
+    bool faulted = data_stats.spilled_pages == 0;
+    unlink_node(fs, "/big");
+    spill_close();
+    if (!spilled || !faulted || read != (int)sizeof(data) || memcmp(buf, data, sizeof(data)) != 0) {
+        printf("Ошибка: Подкачка страниц работает неверно\n");
+    } else {
+        printf("Тест подкачки страниц пройден успешно.\n");
+    }
+}
+
+void test_LargeFilePageTable() {
+    Filesystem* fs = init_filesystem();
+    make_node(fs, "/huge", S_IFREG | 0644, 0, 0);
+    Inode* node = get_inode_by_path("/huge", fs->inodes_list);
+    off_t far = (off_t)64 << 20;
+    off_t farther = (off_t)512 << 20;
+    write_node(node, "head", 4, 0);
+    // Таблица переезжает в отображение, затем растёт через mremap
+    write_node(node, "tail", 4, far);
+    write_node(node, "last", 4, farther);
+    FileData* file = node->data;
+    bool mapped = file->capacity * sizeof(DataPage*) >= 64 * 1024;
+
+    char head[4], tail[4], last[4];
+    read_node(node, head, 4, 0);
+    read_node(node, tail, 4, far);
+    read_node(node, last, 4, farther);
+    size_t free_before = page_alloc_stats.free_pages;
+    truncate_node(node, 4);
+    bool released = page_alloc_stats.free_pages == free_before + 2 && file->num_pages == 1;
+    if (!mapped || !released || memcmp(head, "head", 4) != 0 || memcmp(tail, "tail", 4) != 0
+        || memcmp(last, "last", 4) != 0) {
+        printf("Ошибка: Таблица страниц большого файла работает неверно\n");
+    } else {
+        printf("Тест таблицы страниц большого файла пройден успешно.\n");
+    }
+}
+
+void test_FallocatePunchHole() {
+    Filesystem* fs = init_filesystem();
+    make_node(fs, "/db", S_IFREG | 0644, 0, 0);
+    Inode* node = get_inode_by_path("/db", fs->inodes_list);
+    fallocate_node(node, 0, 0, 4 * FILE_PAGE_SIZE);
+    fallocate_node(node, FALLOC_FL_KEEP_SIZE, 4 * FILE_PAGE_SIZE, FILE_PAGE_SIZE);
+    FileData* file = node->data;
+    bool preallocated = node->st->st_size == 4 * FILE_PAGE_SIZE && file->num_pages == 5
+        && file->pages[4] != NULL && file->pages[4]->preallocated;
+
+    // Запись в выделенную страницу не заменяет её
+    DataPage* page = file->pages[1];
+    char data[4 * FILE_PAGE_SIZE];
+    memset(data, 'x', sizeof(data));
+    write_node(node, data, sizeof(data), 0);
+    bool in_place = file->pages[1] == page;
+
+    fallocate_node(node, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, FILE_PAGE_SIZE / 2, 2 * FILE_PAGE_SIZE);
+    char buf[4 * FILE_PAGE_SIZE];
+    read_node(node, buf, sizeof(buf), 0);
+    bool punched = file->pages[1] == NULL && buf[FILE_PAGE_SIZE / 2 - 1] == 'x' && buf[FILE_PAGE_SIZE / 2] == 0
+        && buf[5 * FILE_PAGE_SIZE / 2 - 1] == 0 && buf[5 * FILE_PAGE_SIZE / 2] == 'x'
+        && node->st->st_size == 4 * FILE_PAGE_SIZE;
+    if (!preallocated || !in_place || !punched) {
+        printf("Ошибка: fallocate работает неверно\n");
+    } else {
+        printf("Тест fallocate пройден успешно.\n");
+    }
+}
+
+void test_ReclaimUnlinked() {
+    Filesystem* fs = init_filesystem();
+    size_t pages_before = data_stats.pages;
+    reclaimer_start(fs);
+    char data[FILE_PAGE_SIZE];
+    memset(data, 'r', sizeof(data));
+    make_node(fs, "/large", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/small", S_IFREG | 0644, 0, 0);
+    Inode* large = get_inode_by_path("/large", fs->inodes_list);
+    Inode* small = get_inode_by_path("/small", fs->inodes_list);
+    for (int i = 0; i < 2 * RECLAIM_MIN_PAGES; i++) {
+        write_node(large, data, sizeof(data), (off_t)i * FILE_PAGE_SIZE);
+    }
+    write_node(small, data, sizeof(data), 0);
+
+    write_lock_filesystem(fs);
+    unlink_node(fs, "/large");
+    bool gone = get_inode_by_path("/large", fs->inodes_list) == NULL;
+    unlock_filesystem(fs);
+    reclaimer_stop();
+    bool reclaimed = data_stats.pages == pages_before + 1 && reclaim_stats.pending_files == 0
+        && reclaim_stats.pending_pages == 0 && reclaim_stats.reclaimed_files == 1;
+
+    destroy_filesystem(fs);
+    if (!gone || !reclaimed || data_stats.pages != pages_before) {
+        printf("Ошибка: Фоновое освобождение работает неверно\n");
+    } else {
+        printf("Тест фонового освобождения пройден успешно.\n");
+    }
+}
+
+void test_RemoveTree() {
+    Filesystem* fs = init_filesystem();
+    nlink_t root_links = fs->root->st->st_nlink;
+    make_directory(fs, "/ws", 0755, 0, 0);
+    make_directory(fs, "/ws/build", 0755, 0, 0);
+    make_directory(fs, "/ws/build/obj", 0755, 0, 0);
+    make_node(fs, "/ws/build/obj/main.o", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/ws/readme", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/keep", S_IFREG | 0644, 0, 0);
+    Inode* open_file = get_inode_by_path("/ws/readme", fs->inodes_list);
+    open_file->nopen++;
+
+    int res = remove_tree(fs, "/ws");
+    int live = 0;
+    for (int i = 1; i <= MAX_INODES; i++) {
+        if (fs->inodes_list->inode_table[i]) live++;
+    }
+    // Открытый файл остаётся до закрытия: корень, /keep и он
+    bool removed = res == 0 && get_inode_by_path("/ws", fs->inodes_list) == NULL && live == 3
+        && open_file->st->st_nlink == 0 && fs->root->st->st_nlink == root_links
+        && get_inode_by_path("/keep", fs->inodes_list) != NULL;
+    if (!removed || remove_tree(fs, "/ws") != -ENOENT) {
+        printf("Ошибка: Рекурсивное удаление работает неверно\n");
+    } else {
+        printf("Тест рекурсивного удаления пройден успешно.\n");
+    }
+}
+
+void test_PopulateFromHost() {
+    const char* host = "/tmp/tmpfs_populate_test";
+    mkdir(host, 0755);
+    mkdir("/tmp/tmpfs_populate_test/dir", 0750);
+    FILE* small = fopen("/tmp/tmpfs_populate_test/dir/small.txt", "w");
+    fputs("hello", small);
+    fclose(small);
+    FILE* big = fopen("/tmp/tmpfs_populate_test/big.bin", "w");
+    for (int i = 0; i < 300 * FILE_PAGE_SIZE + 17; i++) fputc(i % 251, big);
+    fclose(big);
+
+    Filesystem* fs = init_filesystem();
+    bool ok = populate_from_host(fs, host, 4);
+    Inode* dir = get_inode_by_path("/dir", fs->inodes_list);
+    Inode* text = get_inode_by_path("/dir/small.txt", fs->inodes_list);
+    Inode* data = get_inode_by_path("/big.bin", fs->inodes_list);
+    char buf[8] = {0};
+    bool same = ok && dir && is_dir(dir) && (dir->st->st_mode & 07777) == 0750 && text && data
+        && read_node(text, buf, sizeof(buf), 0) == 5 && strcmp(buf, "hello") == 0
+        && data->st->st_size == 300 * FILE_PAGE_SIZE + 17;
+    for (int i = 0; same && i < 300 * FILE_PAGE_SIZE + 17; i += 4001) {
+        same = read_node(data, buf, 1, i) == 1 && (unsigned char)buf[0] == i % 251;
+    }
+    unlink("/tmp/tmpfs_populate_test/dir/small.txt");
+    rmdir("/tmp/tmpfs_populate_test/dir");
+    unlink("/tmp/tmpfs_populate_test/big.bin");
+    rmdir(host);
+    if (!same) {
+        printf("Ошибка: Заполнение из каталога хоста работает неверно\n");
+    } else {
+        printf("Тест заполнения из каталога хоста пройден успешно.\n");
+    }
+}
+
+void test_TarExport() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/proj", 0755, 0, 0);
+    make_directory(fs, "/proj/sub", 0700, 0, 0);
+    make_node(fs, "/proj/a.txt", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/proj/sub/sparse", S_IFREG | 0600, 0, 0);
+    // uid не помещается в 7 восьмеричных цифр ustar
+    make_node(fs, "/proj/big_uid", S_IFREG | 0644, 100000000, 5);
+    write_node(get_inode_by_path("/proj/a.txt", fs->inodes_list), "hello", 5, 0);
+    Inode* sparse = get_inode_by_path("/proj/sub/sparse", fs->inodes_list);
+    write_node(sparse, "end", 3, 3 * FILE_PAGE_SIZE);
+
+    const char* archive = "/tmp/tmpfs_export_test.tar";
+    int fd = open(archive, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    uint64_t written = 0;
+    int res = export_tar(fs, "/proj", fd, &written);
+    off_t size = lseek(fd, 0, SEEK_END);
+    char* tar = malloc(size);
+    bool ok = res == 0 && size > 0 && (uint64_t)size == written && pread(fd, tar, size, 0) == size;
+    close(fd);
+    unlink(archive);
+
+    // Обходим архив по заголовкам: имя, тип, размер, данные
+    int found = 0;
+    bool pax_uid = false;
+    for (off_t off = 0; ok && off + 512 <= size && tar[off]; ) {
+        const char* header = tar + off;
+        size_t length = strtoull(header + 124, NULL, 8);
+        const char* data = header + 512;
+        ok = memcmp(header + 257, "ustar", 5) == 0;
+        if (header[156] == 'x') {
+            char records[512] = {0};
+            memcpy(records, data, length < sizeof(records) ? length : sizeof(records) - 1);
+            pax_uid = pax_uid || strstr(records, " uid=100000000\n") != NULL;
+        } else if (strcmp(header, "proj/big_uid") == 0) {
+            found++;
+            ok = ok && pax_uid && strtoul(header + 108, NULL, 8) == 0 && strtoul(header + 116, NULL, 8) == 5;
+        } else if (strcmp(header, "proj/") == 0) {
+            found++;
+            ok = ok && header[156] == '5';
+        } else if (strcmp(header, "proj/a.txt") == 0) {
+            found++;
+            ok = ok && length == 5 && memcmp(data, "hello", 5) == 0;
+        } else if (strcmp(header, "proj/sub/sparse") == 0) {
+            found++;
+            ok = ok && length == 3 * FILE_PAGE_SIZE + 3 && data[FILE_PAGE_SIZE] == 0
+                && memcmp(data + 3 * FILE_PAGE_SIZE, "end", 3) == 0
+                && strtoul(header + 100, NULL, 8) == 0600;
+        }
+        off += 512 + (length + 511) / 512 * 512;
+    }
+    // Снимок держал ссылки на страницы, после выгрузки они отпущены
+    ok = ok && found == 4 && sparse->data && ((FileData*)sparse->data)->pages[3]->refcount == 1;
+    free(tar);
+    if (!ok) {
+        printf("Ошибка: Выгрузка в tar работает неверно\n");
+    } else {
+        printf("Тест выгрузки в tar пройден успешно.\n");
+    }
+}
+
+static void* count_in_thread(void* arg) {
+    (void)arg;
+    page_alloc_thread_cache(true);
+    for (int i = 0; i < 1000; i++) {
+        count_read(10);
+        char* data = alloc_page_data();
+        data[0] = (char)i;
+        free_page_data(data);
+    }
+    page_alloc_thread_cache(false);
+    return NULL;
+}
+
+void test_ThreadCaches() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/d", 0755, 0, 0);
+    make_node(fs, "/d/f", S_IFREG | 0644, 0, 0);
+    OpCounters before, after;
+    counters_sum(&before);
+    Inode* node = get_inode_by_path("/d/f", fs->inodes_list);
+    bool ok = node && get_inode_by_path("/d/f", fs->inodes_list) == node;
+    // Кэш поиска не должен пережить переименование и удаление
+    ok = ok && rename_node(fs, "/d/f", "/d/g") == 0 && get_inode_by_path("/d/f", fs->inodes_list) == NULL
+        && get_inode_by_path("/d/g", fs->inodes_list) == node && unlink_node(fs, "/d/g") == 0
+        && get_inode_by_path("/d/g", fs->inodes_list) == NULL;
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) pthread_create(&threads[i], NULL, count_in_thread, NULL);
+    for (int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+    counters_sum(&after);
+    ok = ok && after.reads - before.reads == 4000 && after.read_bytes - before.read_bytes == 40000
+        && after.lookup_hits - before.lookup_hits >= 1;
+    if (!ok) {
+        printf("Ошибка: Кэши потоков работают неверно\n");
+    } else {
+        printf("Тест кэшей потоков пройден успешно.\n");
+    }
+}
+
+void test_Timestamps() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/src", 0755, 0, 0);
+    make_node(fs, "/src/main.c", S_IFREG | 0644, 0, 0);
+    Inode* dir = get_inode_by_path("/src", fs->inodes_list);
+    Inode* node = get_inode_by_path("/src/main.c", fs->inodes_list);
+    bool ok = node->st->st_mtime != 0 && dir->st->st_mtime != 0;
+
+    // Старые метки, как после touch -d
+    struct timespec old[2] = {{1000, 0}, {2000, 500}};
+    ok = ok && set_node_times(node, old) == 0 && node->st->st_atime == 1000
+        && node->st->st_mtim.tv_nsec == 500;
+    struct timespec omit[2] = {{0, UTIME_OMIT}, {3000, 0}};
+    ok = ok && set_node_times(node, omit) == 0 && node->st->st_atime == 1000 && node->st->st_mtime == 3000;
+    struct timespec bad[2] = {{0, -5}, {0, 0}};
+    ok = ok && set_node_times(node, bad) == -EINVAL;
+
+    // atime старше mtime - при чтении его надо обновить, после этого уже нет
+    node->st->st_ctim = node->st->st_mtim;
+    ok = ok && atime_stale(node);
+    update_times(node, TIME_ATIME);
+    ok = ok && !atime_stale(node);
+
+    // Запись и переименование двигают mtime файла и каталога
+    dir->st->st_mtime = 0;
+    ok = ok && write_node(node, "int", 3, 0) == 3 && node->st->st_mtime > 3000
+        && rename_node(fs, "/src/main.c", "/src/app.c") == 0 && dir->st->st_mtime != 0
+        && truncate_node(node, 0) == 0 && node->st->st_ctime >= node->st->st_mtime;
+    if (!ok) {
+        printf("Ошибка: Метки времени обновляются неверно\n");
+    } else {
+        printf("Тест меток времени пройден успешно.\n");
+    }
+}
+
+void test_FileHandles() {
+    Filesystem* fs = init_filesystem();
+    make_node(fs, "/log", S_IFREG | 0644, 0, 0);
+    Inode* node = get_inode_by_path("/log", fs->inodes_list);
+
+    // Больше 127 открытий: раньше счётчик был char и переполнялся
+    FileHandle* handles[300];
+    for (int i = 0; i < 300; i++) handles[i] = open_handle(node, i ? O_RDONLY : O_WRONLY | O_APPEND);
+    bool ok = node->nopen == 300;
+
+    // Дописывание идёт в конец независимо от смещения запроса
+    off_t at = -1;
+    ok = ok && append_node(node, "abc", 3, &at) == 3 && at == 0 && append_node(node, "de", 2, &at) == 2
+        && at == 3 && node->st->st_size == 5;
+    char buf[8] = {0};
+    ok = ok && read_node(node, buf, 5, 0) == 5 && strcmp(buf, "abcde") == 0;
+
+    // Окно упреждения растёт при чтении подряд и сбрасывается при прыжке
+    FileHandle* reader = handles[1];
+    ok = ok && note_read(reader, 0, 4096) == READAHEAD_MIN_PAGES
+        && note_read(reader, 4096, 4096) == 2 * READAHEAD_MIN_PAGES
+        && note_read(reader, 100000, 4096) == 0 && note_read(reader, 104096, 10) == READAHEAD_MIN_PAGES;
+
+    // Упреждение разжимает сжатые страницы заранее
+    char data[4 * FILE_PAGE_SIZE];
+    memset(data, 'z', sizeof(data));
+    write_node(node, data, sizeof(data), 0);
+    compress_cold_pages(fs, 0);
+    FileData* file = node->data;
+    ok = ok && file->pages[2]->data == NULL && prefetch_pages(node, 1, 3) == 3 && file->pages[2]->data != NULL;
+
+    // Последний дескриптор удалённого файла освобождает иноду
+    node->st->st_nlink = 0;
+    int last = 0;
+    for (int i = 0; i < 300; i++) last += close_handle(handles[i]);
+    ok = ok && last == 1 && node->nopen == 0;
+    if (!ok) {
+        printf("Ошибка: Дескрипторы открытых файлов работают неверно\n");
+    } else {
+        printf("Тест дескрипторов открытых файлов пройден успешно.\n");
+    }
+}
+
+void test_ReaddirCursor() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/d", 0755, 0, 0);
+    char path[32];
+    for (int i = 0; i < 10; i++) {
+        sprintf(path, "/d/f%d", i);
+        make_node(fs, path, S_IFREG | 0644, 0, 0);
+        write_node(get_inode_by_path(path, fs->inodes_list), path, strlen(path), 0);
+    }
+    Directory* dir = get_inode_by_path("/d", fs->inodes_list)->data;
+
+    // Первая порция листинга: ".", "..", f0..f3; курсор - слот следующей записи
+    int seen[10] = {0};
+    int cursor = 0;
+    for (int n = 0, i = next_entry(dir, 0); n < 6 && i >= 0; n++, i = next_entry(dir, i + 1)) {
+        if (dir->entries[i].name[0] == 'f') seen[dir->entries[i].name[1] - '0']++;
+        cursor = i + 1;
+    }
+    // Каталог меняется между вызовами readdir
+    unlink_node(fs, "/d/f1");
+    unlink_node(fs, "/d/f8");
+    make_node(fs, "/d/new", S_IFREG | 0644, 0, 0);
+    rename_node(fs, "/d/f6", "/d/f6renamed");
+    for (int i = next_entry(dir, cursor); i >= 0; i = next_entry(dir, i + 1)) {
+        const char* name = dir->entries[i].name;
+        if (name[0] == 'f' && strcmp(name, "f6renamed") != 0) seen[name[1] - '0']++;
+    }
+    // Каждый файл, живший весь листинг, встречен ровно один раз
+    bool ok = dir->num_entries == 2 + 9;
+    for (int i = 0; i < 10; i++) {
+        if (i == 6 || i == 8) continue;
+        ok = ok && seen[i] == 1;
+    }
+    ok = ok && seen[8] == 0 && get_inode_by_path("/d/f6renamed", fs->inodes_list) != NULL
+        && get_inode_by_path("/d/f6", fs->inodes_list) == NULL;
+
+    // В образ свободные слоты не попадают
+    const char* image = "/tmp/tmpfs_readdir_test.img";
+    ok = ok && save_snapshot(fs, image);
+    Filesystem* restored = restore_snapshot(image);
+    Inode* restored_dir = restored ? get_inode_by_path("/d", restored->inodes_list) : NULL;
+    ok = ok && restored_dir && ((Directory*)restored_dir->data)->num_slots == 11
+        && get_inode_by_path("/d/f9", restored->inodes_list) != NULL
+        && get_inode_by_path("/d/f1", restored->inodes_list) == NULL;
+    unlink(image);
+    if (!ok) {
+        printf("Ошибка: Курсоры readdir работают неверно\n");
+    } else {
+        printf("Тест курсоров readdir пройден успешно.\n");
+    }
+}
+
+static bool names_sorted(Directory* dir, const unsigned char* order, int count) {
+    for (int i = 1; i < count; i++) {
+        if (strcmp(dir->entries[order[i - 1]].name, dir->entries[order[i]].name) >= 0) return false;
+    }
+    return true;
+}
+
+void test_OrderedDirectory() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/d", 0755, 0, 0);
+    make_node(fs, "/d/zeta", S_IFREG | 0644, 0, 0);
+    make_node(fs, "/d/alpha", S_IFREG | 0644, 0, 0);
+    bool ok = order_directory(fs, "/d", true) == 0 && order_directory(fs, "/d/zeta", true) == -ENOTDIR;
+    const char* names[] = {"lib-b", "bin", "lib-a", "lib", "etc", "lib-c"};
+    char path[32];
+    for (int i = 0; i < 6; i++) {
+        sprintf(path, "/d/%s", names[i]);
+        make_node(fs, path, S_IFREG | 0644, 0, 0);
+    }
+    make_directory(fs, "/d/sub", 0755, 0, 0);
+    unlink_node(fs, "/d/etc");
+    rename_node(fs, "/d/alpha", "/d/omega");
+
+    Directory* dir = get_inode_by_path("/d", fs->inodes_list)->data;
+    ok = ok && dir->ordered && dir->num_entries == 2 + 8 && names_sorted(dir, dir->order, dir->num_entries);
+    ok = ok && ((Directory*)get_inode_by_path("/d/sub", fs->inodes_list)->data)->ordered;
+    ok = ok && get_inode_by_path("/d/omega", fs->inodes_list) && !get_inode_by_path("/d/alpha", fs->inodes_list)
+        && !get_inode_by_path("/d/etc", fs->inodes_list);
+
+    // Префикс "lib-": подряд, начиная с нижней границы
+    unsigned char order[MAX_FILES];
+    int count = sorted_entries(dir, order);
+    int first = lower_bound_entry(dir, order, count, "lib-");
+    ok = ok && first + 3 <= count && strcmp(dir->entries[order[first]].name, "lib-a") == 0
+        && strcmp(dir->entries[order[first + 2]].name, "lib-c") == 0
+        && strncmp(dir->entries[order[first + 3]].name, "lib-", 4) != 0;
+
+    // Обычный каталог сортируется по запросу
+    Directory* root = fs->root->data;
+    count = sorted_entries(root, order);
+    ok = ok && !root->ordered && count == root->num_entries && names_sorted(root, order, count);
+
+    // Режим переживает образ
+    const char* image = "/tmp/tmpfs_ordered_test.img";
+    write_node(get_inode_by_path("/d/bin", fs->inodes_list), "data", 4, 0);
+    ok = ok && save_snapshot(fs, image);
+    Filesystem* restored = restore_snapshot(image);
+    Inode* restored_dir = restored ? get_inode_by_path("/d", restored->inodes_list) : NULL;
+    ok = ok && restored_dir && ((Directory*)restored_dir->data)->ordered
+        && names_sorted(restored_dir->data, ((Directory*)restored_dir->data)->order, 10)
+        && get_inode_by_path("/d/lib-b", restored->inodes_list) != NULL;
+    unlink(image);
+    if (!ok) {
+        printf("Ошибка: Упорядоченный каталог работает неверно\n");
+    } else {
+        printf("Тест упорядоченного каталога пройден успешно.\n");
+    }
+}
+
+void test_Freeze() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/bin", 0755, 0, 0);
+    make_directory(fs, "/lib", 0755, 0, 0);
+    make_directory(fs, "/lib/empty", 0755, 0, 0);
+    char path[64];
+    for (int i = 0; i < 90; i++) {
+        sprintf(path, "/lib/libpart%d.so", i);
+        make_node(fs, path, S_IFREG | 0644, 0, 0);
+        write_node(get_inode_by_path(path, fs->inodes_list), path, strlen(path), 0);
+    }
+    make_node(fs, "/bin/tool", S_IFREG | 0755, 0, 0);
+    Inode* tool = get_inode_by_path("/bin/tool", fs->inodes_list);
+    char* content = malloc(3 * FILE_PAGE_SIZE);
+    for (int i = 0; i < 3 * FILE_PAGE_SIZE; i++) content[i] = (char)(i * 7);
+    write_node(tool, content, FILE_PAGE_SIZE, 0);
+    // Дыра во второй странице
+    write_node(tool, content + 2 * FILE_PAGE_SIZE, FILE_PAGE_SIZE, 2 * FILE_PAGE_SIZE);
+    memset(content + FILE_PAGE_SIZE, 0, FILE_PAGE_SIZE);
+    add_node_by_path("/bin/alias", tool, fs->inodes_list);
+    make_node(fs, "/bin/copy", S_IFREG | 0755, 0, 0);
+    clone_node(tool, get_inode_by_path("/bin/copy", fs->inodes_list));
+
+    FrozenFs* frozen = freeze_filesystem(fs);
+    bool ok = frozen != NULL && frozen->num_inodes == 1 + 3 + 90 + 2;
+    for (int i = 0; ok && i < 90; i++) {
+        sprintf(path, "/lib/libpart%d.so", i);
+        int node = frozen_lookup(frozen, path);
+        char buf[64] = {0};
+        ok = node > 0 && frozen_read(frozen, node, buf, sizeof(buf), 0) == (int)strlen(path)
+            && strcmp(buf, path) == 0;
+    }
+    ok = ok && frozen_lookup(frozen, "/") == 0 && frozen_lookup(frozen, "/lib/libpart90.so") == -ENOENT
+        && frozen_lookup(frozen, "/bin/tool/x") == -ENOTDIR && frozen_lookup(frozen, "/lib/empty/x") == -ENOENT;
+
+    // Жёсткая ссылка - та же инода, данные с дырой совпадают
+    int node = frozen_lookup(frozen, "/bin/tool");
+    char* buf = malloc(3 * FILE_PAGE_SIZE);
+    struct stat st;
+    if (ok) frozen_stat(frozen, node, &st);
+    ok = ok && node == frozen_lookup(frozen, "/bin/alias") && st.st_nlink == 2 && st.st_ino == (ino_t)tool->node_number
+        && frozen_read(frozen, node, buf, 3 * FILE_PAGE_SIZE, 0) == 3 * FILE_PAGE_SIZE
+        && memcmp(buf, content, 3 * FILE_PAGE_SIZE) == 0
+        && frozen_read(frozen, node, buf, 10, 3 * FILE_PAGE_SIZE) == 0;
+
+    // Перечисление отдаёт каждое имя один раз
+    int lib = frozen_lookup(frozen, "/lib");
+    uint32_t child, count = 0;
+    for (const char* name; ok && (name = frozen_entry(frozen, lib, count, &child)); count++) {
+        sprintf(path, "/lib/%s", name);
+        ok = frozen_lookup(frozen, path) == (int)child;
+    }
+    ok = ok && count == 91;
+    // Упаковка заметно меньше изменяемых каталогов
+    ok = ok && frozen_memory(frozen) < sizeof(Directory);
+    // Клон делит страницы с оригиналом, они скопированы один раз
+    int copy = frozen_lookup(frozen, "/bin/copy");
+    ok = ok && copy > 0 && frozen->pages[frozen->inodes[copy].data] == frozen->pages[frozen->inodes[node].data]
+        && frozen->data_size < 3 * FILE_PAGE_SIZE;
+    destroy_frozen(frozen);
+
+    // Страницы восстановленного дерева читаются прямо из образа, который
+    // переживает исходную fs
+    const char* image = "/tmp/tmpfs_freeze_test.img";
+    ok = ok && save_snapshot(fs, image);
+    Filesystem* restored = ok ? restore_snapshot(image) : NULL;
+    frozen = restored ? freeze_filesystem(restored) : NULL;
+    bool handed_over = frozen && restored->image == NULL;
+    if (restored) destroy_filesystem(restored);
+    node = frozen ? frozen_lookup(frozen, "/bin/tool") : -1;
+    ok = ok && handed_over && node > 0 && frozen->image
+        && frozen->pages[frozen->inodes[node].data] >= (char*)frozen->image
+        && frozen->pages[frozen->inodes[node].data] < (char*)frozen->image + frozen->image_size
+        && frozen->data_size < FILE_PAGE_SIZE
+        && frozen_read(frozen, node, buf, 3 * FILE_PAGE_SIZE, 0) == 3 * FILE_PAGE_SIZE
+        && memcmp(buf, content, 3 * FILE_PAGE_SIZE) == 0;
+    destroy_frozen(frozen);
+    unlink(image);
+    free(content);
+    free(buf);
+    if (!ok) {
+        printf("Ошибка: Замороженная файловая система работает неверно\n");
+    } else {
+        printf("Тест заморозки пройден успешно.\n");
+    }
+}
+
+void test_Trace() {
+    const char* trace_path = "/tmp/tmpfs_trace_test.trc";
+    bool ok = trace_open(trace_path);
+    uint64_t start = trace_clock();
+    trace_record(TRACE_MKNOD, "/file", NULL, 0, 0, S_IFREG | 0644, start, 0);
+    trace_record(TRACE_WRITE, "/file", NULL, 4096, 100, 0, trace_clock(), 100);
+    trace_record(TRACE_RENAME, "/file", "/renamed", 0, 0, 0, trace_clock(), 0);
+    trace_record(TRACE_GETATTR, "/file", NULL, 0, 0, 0, trace_clock(), -ENOENT);
+    trace_record(TRACE_GETXATTR, "/file", "user.tmpfs.owner_apparent_bytes", 0, 32, 0, trace_clock(), 4);
+    trace_close();
+
+    FILE* in = fopen(trace_path, "rb");
+    TraceHeader header;
+    TraceRecord records[5];
+    char path[TRACE_PATH_MAX], new_path[TRACE_PATH_MAX];
+    char renamed[32] = "", attribute[64] = "";
+    int count = 0;
+    ok = ok && in && trace_read_header(in, &header);
+    while (ok && count < 5 && trace_read_record(in, &records[count], path, new_path)) {
+        if (records[count].op == TRACE_RENAME) strcpy(renamed, new_path);
+        if (records[count].op == TRACE_GETXATTR) strcpy(attribute, new_path);
+        ok = strcmp(path, "/file") == 0;
+        count++;
+    }
+    ok = ok && count == 5 && records[0].op == TRACE_MKNOD && records[0].mode == (S_IFREG | 0644)
+        && records[1].offset == 4096 && records[1].size == 100 && records[1].result == 100
+        && records[3].result == -ENOENT && records[1].time_ns <= records[2].time_ns
+        && strcmp(renamed, "/renamed") == 0 && strcmp(trace_op_name(TRACE_WRITE), "write") == 0
+        && records[4].size == 32 && strcmp(attribute, "user.tmpfs.owner_apparent_bytes") == 0
+        && strcmp(trace_op_name(TRACE_GETXATTR), "getxattr") == 0;
+    if (in) fclose(in);
+    unlink(trace_path);
+    if (!ok) {
+        printf("Ошибка: Трасса записана неверно\n");
+    } else {
+        printf("Тест записи трассы пройден успешно.\n");
+    }
+}
+
+// Сумма поддерева обходом записей: файл с несколькими ссылками считается
+// в своём parent_node. Заодно сверяет счётчики каждого каталога.
+static Usage walk_usage(Filesystem* fs, Inode* dir_node, bool* ok) {
+    Usage total = {0, 1};
+    Directory* dir = dir_node->data;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        if (strcmp(dir->entries[i].name, ".") == 0 || strcmp(dir->entries[i].name, "..") == 0) continue;
+        Inode* child = get_inode_from_container(fs->inodes_list, dir->entries[i].node_number);
+        if (is_dir(child)) {
+            Usage sub = walk_usage(fs, child, ok);
+            total.bytes += sub.bytes;
+            total.inodes += sub.inodes;
+        } else if (child->parent_node == dir_node) {
+            total.bytes += child->st->st_size;
+            total.inodes++;
+        }
+    }
+    *ok = *ok && dir->usage.bytes == total.bytes && dir->usage.inodes == total.inodes;
+    return total;
+}
+
+static bool owner_matches(Filesystem* fs, uid_t uid) {
+    Usage expected = {0, 0};
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode* node = fs->inodes_list->inode_table[i];
+        if (!node || node->st->st_uid != uid || (!is_dir(node) && node->st->st_nlink == 0)) continue;
+        if (!is_dir(node)) expected.bytes += node->st->st_size;
+        expected.inodes++;
+    }
+    Usage usage = usage_of_uid(uid);
+    return usage.bytes == expected.bytes && usage.inodes == expected.inodes;
+}
+
+static bool usage_consistent(Filesystem* fs) {
+    bool ok = true;
+    walk_usage(fs, fs->root, &ok);
+    return ok && owner_matches(fs, 0) && owner_matches(fs, 1000) && owner_matches(fs, 2000);
+}
+
+static Usage dir_usage(Filesystem* fs, const char* path) {
+    return ((Directory*)get_inode_by_path(path, fs->inodes_list)->data)->usage;
+}
+
+void test_UsageAccounting() {
+    Filesystem* fs = init_filesystem();
+    char buf[FILE_PAGE_SIZE] = {0};
+    make_directory(fs, "/a", 0755, 0, 0);
+    make_directory(fs, "/a/b", 0755, 0, 0);
+    make_directory(fs, "/c", 0755, 0, 0);
+    make_node(fs, "/a/f1", S_IFREG | 0644, 1000, 1000);
+    make_node(fs, "/a/b/f2", S_IFREG | 0644, 1000, 1000);
+    make_node(fs, "/c/g", S_IFREG | 0644, 2000, 2000);
+    Inode* f1 = get_inode_by_path("/a/f1", fs->inodes_list);
+    Inode* f2 = get_inode_by_path("/a/b/f2", fs->inodes_list);
+    Inode* g = get_inode_by_path("/c/g", fs->inodes_list);
+    write_node(f1, buf, sizeof(buf), 1000);
+    write_node(f2, buf, 100, 0);
+    truncate_node(f2, 10000);
+    off_t offset;
+    append_node(g, buf, 300, &offset);
+    bool ok = usage_consistent(fs) && dir_usage(fs, "/").bytes == 5096 + 10000 + 300
+        && dir_usage(fs, "/").inodes == 7 && dir_usage(fs, "/a").bytes == 15096
+        && usage_of_uid(1000).bytes == 15096 && usage_of_uid(1000).inodes == 2;
+
+    // Перенос каталога уносит всё поддерево
+    ok = ok && rename_node(fs, "/a/b", "/c/b") == 0 && usage_consistent(fs)
+        && dir_usage(fs, "/a").bytes == 5096 && dir_usage(fs, "/c").bytes == 10300
+        && dir_usage(fs, "/c").inodes == 4;
+
+    // Удаление ссылки из parent_node переносит учёт к оставшейся ссылке
+    add_node_by_path("/c/f1link", f1, fs->inodes_list);
+    ok = ok && unlink_node(fs, "/a/f1") == 0 && usage_consistent(fs)
+        && dir_usage(fs, "/a").bytes == 0 && dir_usage(fs, "/c").bytes == 15396;
+
+    // Удалённый, но открытый файл не считается и при записи
+    make_node(fs, "/a/open", S_IFREG | 0644, 1000, 1000);
+    FileHandle* handle = open_handle(get_inode_by_path("/a/open", fs->inodes_list), O_RDWR);
+    write_node(handle->node, buf, 50, 0);
+    remove_node_by_path("/a/open", fs);
+    write_node(handle->node, buf, sizeof(buf), 0);
+    ok = ok && usage_consistent(fs) && dir_usage(fs, "/").bytes == 15396;
+    Inode* orphan = handle->node;
+    if (close_handle(handle)) release_inode(fs, orphan);
+
+    // Клон, а затем rm -rf: ссылка из удаляемого дерева уезжает в /a
+    make_node(fs, "/a/h", S_IFREG | 0644, 2000, 2000);
+    clone_node(g, get_inode_by_path("/a/h", fs->inodes_list));
+    add_node_by_path("/a/glink", g, fs->inodes_list);
+    ok = ok && remove_tree(fs, "/c") == 0 && usage_consistent(fs)
+        && dir_usage(fs, "/a").bytes == 600 && dir_usage(fs, "/a").inodes == 3
+        && dir_usage(fs, "/").inodes == 4 && usage_of_uid(1000).inodes == 0
+        && usage_of_uid(2000).bytes == 600;
+
+    // Пересчёт с нуля даёт то же самое
+    Usage before = dir_usage(fs, "/");
+    usage_rebuild(fs);
+    ok = ok && usage_consistent(fs) && dir_usage(fs, "/").bytes == before.bytes
+        && dir_usage(fs, "/").inodes == before.inodes;
+
+    // Атрибуты: значение, только длина, короткий буфер, чужое имя
+    char value[8] = {0};
+    Inode* a = get_inode_by_path("/a", fs->inodes_list);
+    ok = ok && usage_xattr(a, "user.tmpfs.subtree_apparent_bytes", value, sizeof(value)) == 3
+        && memcmp(value, "600", 3) == 0
+        && usage_xattr(a, "user.tmpfs.subtree_inodes", NULL, 0) == 1
+        && usage_xattr(a, "user.tmpfs.subtree_apparent_bytes", value, 2) == -ERANGE
+        && usage_xattr(g, "user.tmpfs.subtree_apparent_bytes", value, sizeof(value)) == -ENODATA
+        && usage_xattr(a, "user.mime_type", value, sizeof(value)) == -ENODATA;
+    destroy_filesystem(fs);
+    if (!ok) {
+        printf("Ошибка: Учёт места по каталогам и владельцам неверен\n");
+    } else {
+        printf("Тест учёта места пройден успешно.\n");
+    }
+}
+
+void test_HardLinks() {
+    Filesystem* fs = init_filesystem();
+    make_directory(fs, "/a", 0755, 0, 0);
+    make_directory(fs, "/b", 0755, 0, 0);
+    make_node(fs, "/a/f", S_IFREG | 0644, 1000, 1000);
+    Inode* node = get_inode_by_path("/a/f", fs->inodes_list);
+    write_node(node, "linked", 6, 0);
+    Inode* b = get_inode_by_path("/b", fs->inodes_list);
+    b->st->st_mtime = 0;
+    Usage before = dir_usage(fs, "/");
+
+    // Новая ссылка - та же инода, каталог меняет mtime, учёт один раз
+    bool ok = link_node(fs, "/a/f", "/b/g") == 0 && get_inode_by_path("/b/g", fs->inodes_list) == node
+        && node->st->st_nlink == 2 && b->st->st_mtime != 0 && usage_consistent(fs)
+        && dir_usage(fs, "/").inodes == before.inodes && dir_usage(fs, "/").bytes == before.bytes
+        && usage_of_uid(1000).inodes == 1;
+    ok = ok && link_node(fs, "/a/f", "/b/g") == -EEXIST && link_node(fs, "/a", "/b/dir") == -EPERM
+        && link_node(fs, "/a/none", "/b/h") == -ENOENT && link_node(fs, "/a/f", "/none/h") == -ENOENT;
+
+    // После удаления первой ссылки учёт переезжает к оставшейся
+    ok = ok && unlink_node(fs, "/a/f") == 0 && node->st->st_nlink == 1 && usage_consistent(fs)
+        && dir_usage(fs, "/b").bytes == 6 && dir_usage(fs, "/a").bytes == 0;
+    destroy_filesystem(fs);
+    if (!ok) {
+        printf("Ошибка: Жёсткие ссылки работают неверно\n");
+    } else {
+        printf("Тест жёстких ссылок пройден успешно.\n");
+    }
+}
+
+static const char* fifo_test_path = "/tmp/tmpfs_fifo_test";
+
+// Как демон, отказавший до открытия приёмника
+static int refuse_export(void* arg) {
+    return EPERM;
+}
+
+static int write_export(void* arg) {
+    int fd = open(fifo_test_path, O_WRONLY);
+    if (fd < 0) return errno;
+    // Больше буфера канала, чтобы писатель ждал читателя
+    char* data = arg;
+    for (int i = 0; i < 4; i++) {
+        if (write(fd, data, 65536) != 65536) return EIO;
+    }
+    close(fd);
+    return 0;
+}
+
+void test_FifoPump() {
+    unlink(fifo_test_path);
+    const char* out_path = "/tmp/tmpfs_fifo_test.out";
+    int out = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    char* data = malloc(65536);
+    memset(data, 't', 65536);
+    bool ok = out >= 0 && mkfifo(fifo_test_path, 0600) == 0;
+
+    // Отказ без открытия FIFO не вешает читателя
+    ok = ok && pump_fifo(fifo_test_path, refuse_export, NULL, out) == -1 && errno == EPERM
+        && lseek(out, 0, SEEK_END) == 0;
+    ok = ok && pump_fifo(fifo_test_path, write_export, data, out) == 0 && lseek(out, 0, SEEK_END) == 4 * 65536;
+    if (out >= 0) close(out);
+    unlink(out_path);
+    unlink(fifo_test_path);
+    free(data);
+    if (!ok) {
+        printf("Ошибка: Чтение выгрузки через FIFO работает неверно\n");
+    } else {
+        printf("Тест выгрузки через FIFO пройден успешно.\n");
+    }
+}
+
 int main() {
     // const char* s = get_last_name("/123");
     // printf("%s\n", s);
     test_FindInodeByName();
+    test_SnapshotRoundTrip();
+    test_ImagePagesOnFirstAccess();
+    test_JournalReplay();
+    test_CheckpointCapture();
+    test_CloneSharesPages();
+    test_DedupMergesPages();
+    test_CompressColdPages();
+    test_SpillToDisk();
+    test_LargeFilePageTable();
+    test_FallocatePunchHole();
+    test_ReclaimUnlinked();
+    test_RemoveTree();
+    test_PopulateFromHost();
+    test_TarExport();
+    test_ThreadCaches();
+    test_Timestamps();
+    test_FileHandles();
+    test_ReaddirCursor();
+    test_OrderedDirectory();
+    test_Freeze();
+    test_Trace();
+    test_UsageAccounting();
+    test_HardLinks();
+    test_FifoPump();
     return 0;
 }
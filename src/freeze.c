@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "freeze.h"
+#include "compress.h"
+
+// Перебор затравок корзины ограничен: при двух именах на корзину в среднем
+// подходящая находится за единицы попыток даже для последних корзин
+#define MAX_SEED (1u << 24)
+
+// Хэш -------------------------------------------------------------------------
+
+static uint64_t name_hash(const char *name, size_t length, uint32_t seed) {
+    uint64_t hash = 0xcbf29ce484222325ull ^ (seed * 0x9e3779b97f4a7c15ull);
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ull;
+    }
+    // Перемешивание, чтобы остаток от деления зависел от всех бит
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Корзин вдвое меньше, чем записей
+static uint32_t bucket_count(uint32_t count) {
+    return (count + 1) / 2;
+}
+
+static bool is_dot_name(const char *name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
+
+// Построение -------------------------------------------------------------------
+
+static int live_entries(Directory *dir) {
+    int count = 0;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        if (!is_dot_name(dir->entries[i].name)) count++;
+    }
+    return count;
+}
+
+// Раскладывает записи каталога по позициям: корзины от больших к маленьким,
+// для каждой ищется затравка, при которой все её имена попадают в свободные
+// и разные позиции
+static bool place_entries(FrozenFs *frozen, FrozenInode *target, Directory *dir, const int32_t *index,
+                          size_t *names_used) {
+    uint32_t count = target->count;
+    if (count == 0) return true;
+    uint32_t buckets = bucket_count(count);
+    const char *names[MAX_FILES];
+    uint32_t nodes[MAX_FILES];
+    uint32_t bucket_of[MAX_FILES];
+    uint32_t bucket_size[MAX_FILES] = {0};
+    uint32_t n = 0;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        if (is_dot_name(dir->entries[i].name)) continue;
+        names[n] = dir->entries[i].name;
+        nodes[n] = (uint32_t)index[dir->entries[i].node_number];
+        bucket_of[n] = name_hash(names[n], strlen(names[n]), 0) % buckets;
+        bucket_size[bucket_of[n]]++;
+        n++;
+    }
+
+    bool taken[MAX_FILES] = {false};
+    uint32_t largest = 0;
+    for (uint32_t b = 0; b < buckets; b++) {
+        if (bucket_size[b] > largest) largest = bucket_size[b];
+    }
+    for (uint32_t size = largest; size > 0; size--) {
+        for (uint32_t b = 0; b < buckets; b++) {
+            if (bucket_size[b] != size) continue;
+            uint32_t members[MAX_FILES];
+            uint32_t slots[MAX_FILES];
+            uint32_t m = 0;
+            for (uint32_t i = 0; i < n; i++) {
+                if (bucket_of[i] == b) members[m++] = i;
+            }
+            uint32_t seed = 1;
+            for (; seed < MAX_SEED; seed++) {
+                uint32_t placed = 0;
+                for (; placed < m; placed++) {
+                    const char *name = names[members[placed]];
+                    slots[placed] = name_hash(name, strlen(name), seed) % count;
+                    if (taken[slots[placed]]) break;
+                    taken[slots[placed]] = true;
+                }
+                if (placed == m) break;
+                // Затравка не подошла - возвращаем занятое ей
+                for (uint32_t j = 0; j < placed; j++) taken[slots[j]] = false;
+            }
+            if (seed == MAX_SEED) return false;
+            frozen->seeds[target->seeds + b] = seed;
+            for (uint32_t j = 0; j < m; j++) {
+                FrozenEntry *entry = &frozen->entries[target->first + slots[j]];
+                size_t length = strlen(names[members[j]]) + 1;
+                memcpy(frozen->names + *names_used, names[members[j]], length);
+                entry->name = (uint32_t)*names_used;
+                entry->node = nodes[members[j]];
+                *names_used += length;
+            }
+        }
+    }
+    return true;
+}
+
+// Данные ------------------------------------------------------------------------
+// Копия каждой физической страницы: сколько байт нужно самому длинному из
+// файлов, которые её делят, и где она лежит в data
+
+typedef struct PageCopy{
+    DataPage *page;
+    size_t length;
+    uint64_t offset;
+} PageCopy;
+
+typedef struct PageCopies{
+    PageCopy *slots;
+    size_t mask;
+} PageCopies;
+
+static size_t pages_of(off_t size) {
+    return (size + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+}
+
+// Страница из образа остаётся на месте
+static bool in_image(const DataPage *page) {
+    return page->mapped && page->data;
+}
+
+static PageCopy* find_copy(PageCopies *copies, DataPage *page) {
+    size_t i = ((uintptr_t)page >> 4) * 0x9e3779b97f4a7c15ull & copies->mask;
+    while (copies->slots[i].page && copies->slots[i].page != page) i = (i + 1) & copies->mask;
+    return &copies->slots[i];
+}
+
+static DataPage* file_page(FileData *file, size_t i) {
+    return file && i < file->num_pages ? file->pages[i] : NULL;
+}
+
+// Запоминает страницы файла, которые придётся скопировать
+static void note_file_pages(PageCopies *copies, Inode *node) {
+    off_t size = node->st->st_size;
+    for (size_t i = 0; i < pages_of(size); i++) {
+        DataPage *page = file_page(node->data, i);
+        if (page == NULL || in_image(page)) continue;
+        off_t rest = size - (off_t)i * FILE_PAGE_SIZE;
+        size_t length = rest < FILE_PAGE_SIZE ? (size_t)rest : FILE_PAGE_SIZE;
+        PageCopy *copy = find_copy(copies, page);
+        copy->page = page;
+        if (length > copy->length) copy->length = length;
+    }
+}
+
+static bool copy_pages(FrozenFs *frozen, PageCopies *copies) {
+    for (size_t i = 0; i <= copies->mask; i++) {
+        PageCopy *copy = &copies->slots[i];
+        if (copy->page == NULL) continue;
+        const char *data = load_page_data(copy->page);
+        if (data == NULL) return false;
+        memcpy(frozen->data + copy->offset, data, copy->length);
+    }
+    return true;
+}
+
+static void fill_file_pages(FrozenFs *frozen, PageCopies *copies, FrozenInode *target, Inode *node) {
+    for (size_t i = 0; i < pages_of(target->size); i++) {
+        DataPage *page = file_page(node->data, i);
+        const char **out = &frozen->pages[target->data + i];
+        if (page == NULL) *out = node->data ? image_page(node->data, i) : NULL;
+        else if (in_image(page)) *out = page->data;
+        else *out = frozen->data + find_copy(copies, page)->offset;
+    }
+}
+
+static void fill_inode(FrozenInode *target, Inode *node, const int32_t *index) {
+    struct stat *st = node->st;
+    target->ino = (uint32_t)st->st_ino;
+    target->mode = st->st_mode;
+    target->nlink = st->st_nlink;
+    target->uid = st->st_uid;
+    target->gid = st->st_gid;
+    target->size = st->st_size;
+    target->atime = st->st_atim;
+    target->mtime = st->st_mtim;
+    target->ctime = st->st_ctim;
+    Inode *parent = node->parent_node ? node->parent_node : node;
+    target->parent = index[parent->node_number] >= 0 ? (uint32_t)index[parent->node_number] : 0;
+}
+
+FrozenFs* freeze_filesystem(Filesystem *fs) {
+    InodeContainer *container = fs->inodes_list;
+    FrozenFs *frozen = calloc(1, sizeof(FrozenFs));
+    int32_t *index = malloc((MAX_INODES + 1) * sizeof(int32_t));
+    if (frozen == NULL || index == NULL) {
+        free(frozen);
+        free(index);
+        return NULL;
+    }
+
+    // Нумерация плотная, корень первым
+    for (int i = 0; i <= MAX_INODES; i++) index[i] = -1;
+    index[fs->root->node_number] = frozen->num_inodes++;
+    for (int i = 1; i <= MAX_INODES; i++) {
+        if (container->inode_table[i] && i != fs->root->node_number) index[i] = frozen->num_inodes++;
+    }
+    // Размеры массивов
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = container->inode_table[i];
+        if (node == NULL) continue;
+        if (is_dir(node)) {
+            Directory *dir = node->data;
+            uint32_t count = live_entries(dir);
+            frozen->num_entries += count;
+            frozen->num_seeds += bucket_count(count);
+            for (int j = next_entry(dir, 0); j >= 0; j = next_entry(dir, j + 1)) {
+                if (!is_dot_name(dir->entries[j].name)) frozen->names_size += strlen(dir->entries[j].name) + 1;
+            }
+        } else if (is_file(node)) {
+            frozen->num_pages += pages_of(node->st->st_size);
+            frozen->files_size += node->st->st_size;
+        }
+    }
+
+    // Таблица копий заполнена не больше чем наполовину
+    PageCopies copies = {NULL, 0};
+    size_t slots = 2;
+    while (slots < 2 * frozen->num_pages) slots *= 2;
+    copies.slots = calloc(slots, sizeof(PageCopy));
+    copies.mask = slots - 1;
+    frozen->inodes = calloc(frozen->num_inodes, sizeof(FrozenInode));
+    frozen->entries = calloc(frozen->num_entries + 1, sizeof(FrozenEntry));
+    frozen->seeds = calloc(frozen->num_seeds + 1, sizeof(uint32_t));
+    frozen->names = malloc(frozen->names_size + 1);
+    frozen->pages = calloc(frozen->num_pages + 1, sizeof(char *));
+    bool ok = copies.slots && frozen->inodes && frozen->entries && frozen->seeds && frozen->names
+        && frozen->pages;
+
+    if (ok) {
+        for (int i = 1; i <= MAX_INODES; i++) {
+            Inode *node = container->inode_table[i];
+            if (node && is_file(node)) note_file_pages(&copies, node);
+        }
+        for (size_t i = 0; i < slots; i++) {
+            if (copies.slots[i].page == NULL) continue;
+            copies.slots[i].offset = frozen->data_size;
+            frozen->data_size += (copies.slots[i].length + 7) & ~(size_t)7;
+        }
+        frozen->data = malloc(frozen->data_size + 1);
+        ok = frozen->data && copy_pages(frozen, &copies);
+    }
+
+    uint32_t first = 0, seeds = 0;
+    uint64_t pages = 0;
+    size_t names_used = 0;
+    for (int i = 1; i <= MAX_INODES && ok; i++) {
+        Inode *node = container->inode_table[i];
+        if (node == NULL) continue;
+        FrozenInode *target = &frozen->inodes[index[i]];
+        fill_inode(target, node, index);
+        if (is_dir(node)) {
+            target->first = first;
+            target->count = live_entries(node->data);
+            target->seeds = seeds;
+            first += target->count;
+            seeds += bucket_count(target->count);
+            ok = place_entries(frozen, target, node->data, index, &names_used);
+        } else if (is_file(node)) {
+            target->data = pages;
+            pages += pages_of(target->size);
+            fill_file_pages(frozen, &copies, target, node);
+        }
+    }
+    free(index);
+    free(copies.slots);
+    if (!ok) {
+        destroy_frozen(frozen);
+        return NULL;
+    }
+    // Страницы образа теперь читаются через копию
+    frozen->image = fs->image;
+    frozen->image_size = fs->image_size;
+    fs->image = NULL;
+    fs->image_size = 0;
+    return frozen;
+}
+
+void destroy_frozen(FrozenFs *frozen) {
+    if (frozen == NULL) return;
+    free(frozen->inodes);
+    free(frozen->entries);
+    free(frozen->seeds);
+    free(frozen->names);
+    free(frozen->pages);
+    free(frozen->data);
+    if (frozen->image) munmap(frozen->image, frozen->image_size);
+    free(frozen);
+}
+
+// Чтение -------------------------------------------------------------------------
+
+static int64_t find_in_dir(const FrozenFs *frozen, const FrozenInode *dir, const char *name, size_t length) {
+    if (dir->count == 0) return -1;
+    uint32_t bucket = name_hash(name, length, 0) % bucket_count(dir->count);
+    uint32_t seed = frozen->seeds[dir->seeds + bucket];
+    const FrozenEntry *entry = &frozen->entries[dir->first + name_hash(name, length, seed) % dir->count];
+    const char *found = frozen->names + entry->name;
+    if (strncmp(found, name, length) != 0 || found[length] != '\0') return -1;
+    return entry->node;
+}
+
+int frozen_lookup(const FrozenFs *frozen, const char *path) {
+    uint32_t node = 0;
+    const char *component = path;
+    while (*component) {
+        while (*component == '/') component++;
+        if (*component == '\0') break;
+        size_t length = strcspn(component, "/");
+        const FrozenInode *dir = &frozen->inodes[node];
+        if (!S_ISDIR(dir->mode)) return -ENOTDIR;
+        int64_t next = find_in_dir(frozen, dir, component, length);
+        if (next < 0) return -ENOENT;
+        node = (uint32_t)next;
+        component += length;
+    }
+    return (int)node;
+}
+
+void frozen_stat(const FrozenFs *frozen, uint32_t node, struct stat *st) {
+    const FrozenInode *source = &frozen->inodes[node];
+    memset(st, 0, sizeof(*st));
+    st->st_ino = source->ino;
+    st->st_mode = source->mode;
+    st->st_nlink = source->nlink;
+    st->st_uid = source->uid;
+    st->st_gid = source->gid;
+    st->st_size = source->size;
+    st->st_blksize = FILE_PAGE_SIZE;
+    st->st_blocks = (source->size + 511) / 512;
+    st->st_atim = source->atime;
+    st->st_mtim = source->mtime;
+    st->st_ctim = source->ctime;
+}
+
+int frozen_read(const FrozenFs *frozen, uint32_t node, char *buf, size_t size, off_t offset) {
+    const FrozenInode *file = &frozen->inodes[node];
+    if (!S_ISREG(file->mode)) return -EISDIR;
+    if (offset < 0) return -EINVAL;
+    if (offset >= file->size) return 0;
+    if ((off_t)size > file->size - offset) size = file->size - offset;
+    for (size_t done = 0; done < size;) {
+        off_t position = offset + done;
+        size_t in_page = position % FILE_PAGE_SIZE;
+        size_t chunk = FILE_PAGE_SIZE - in_page < size - done ? FILE_PAGE_SIZE - in_page : size - done;
+        const char *page = frozen->pages[file->data + position / FILE_PAGE_SIZE];
+        if (page) memcpy(buf + done, page + in_page, chunk);
+        else memset(buf + done, 0, chunk);
+        done += chunk;
+    }
+    return (int)size;
+}
+
+const char* frozen_entry(const FrozenFs *frozen, uint32_t dir, uint32_t i, uint32_t *node) {
+    const FrozenInode *source = &frozen->inodes[dir];
+    if (i >= source->count) return NULL;
+    const FrozenEntry *entry = &frozen->entries[source->first + i];
+    *node = entry->node;
+    return frozen->names + entry->name;
+}
+
+size_t frozen_memory(const FrozenFs *frozen) {
+    return sizeof(FrozenFs) + frozen->num_inodes * sizeof(FrozenInode)
+        + frozen->num_entries * sizeof(FrozenEntry) + frozen->num_seeds * sizeof(uint32_t)
+        + frozen->names_size + frozen->num_pages * sizeof(char *) + frozen->data_size;
+}
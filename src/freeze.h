@@ -0,0 +1,71 @@
+#ifndef FREEZE_H
+#define FREEZE_H
+
+#include "filesystem.h"
+
+// Замороженная файловая система ------------------------------------------------
+// Неизменяемая упакованная копия дерева для раздачи только на чтение. Иноды,
+// записи каталогов, имена и данные файлов лежат в сплошных массивах. Записи
+// каталога разложены минимальной совершенной хэш-функцией (хэш и смещение):
+// по первому хэшу имени выбирается корзина, по её затравке - позиция записи,
+// так что поиск имени - два хэша и одно сравнение. После построения ничего
+// не меняется, поэтому читатели обходятся без блокировок.
+// Данные файла - таблица указателей на страницы. Физическая страница
+// (DataPage) копируется один раз, сколько бы файлов её ни делили после
+// клонирования или дедупликации, а страницы из отображённого образа не
+// копируются вовсе: отображение переходит к замороженной копии.
+
+typedef struct FrozenInode{
+    uint32_t ino;          // номер иноды в исходном дереве
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t parent;       // индекс родителя в inodes
+    uint32_t first;        // каталог: первая запись в entries
+    uint32_t count;        // каталог: число записей без "." и ".."
+    uint32_t seeds;        // каталог: первая затравка в seeds
+    uint64_t data;         // файл: первая страница в pages
+    int64_t size;
+    struct timespec atime;
+    struct timespec mtime;
+    struct timespec ctime;
+} FrozenInode;
+
+typedef struct FrozenEntry{
+    uint32_t name;         // смещение имени (с '\0') в names
+    uint32_t node;         // индекс в inodes
+} FrozenEntry;
+
+typedef struct FrozenFs{
+    FrozenInode *inodes;   // [0] - корень
+    uint32_t num_inodes;
+    FrozenEntry *entries;
+    uint32_t num_entries;
+    uint32_t *seeds;       // затравки корзин всех каталогов подряд
+    uint32_t num_seeds;
+    char *names;
+    size_t names_size;
+    const char **pages;    // страницы всех файлов подряд, NULL - нули
+    size_t num_pages;
+    char *data;            // скопированные страницы, каждая один раз
+    size_t data_size;
+    uint64_t files_size;   // сумма размеров файлов
+    void *image;           // отображённый образ, на который указывают pages
+    size_t image_size;
+} FrozenFs;
+
+// Строит копию fs. Дерево fs не меняется, но отображение образа забирается
+// (fs->image = NULL): fs нужно уничтожить раньше копии. NULL - не хватило памяти
+FrozenFs* freeze_filesystem(Filesystem *fs);
+void destroy_frozen(FrozenFs *frozen);
+// Индекс иноды или -ENOENT / -ENOTDIR
+int frozen_lookup(const FrozenFs *frozen, const char *path);
+void frozen_stat(const FrozenFs *frozen, uint32_t node, struct stat *st);
+int frozen_read(const FrozenFs *frozen, uint32_t node, char *buf, size_t size, off_t offset);
+// Имя i-й записи каталога и индекс её иноды или NULL после последней
+const char* frozen_entry(const FrozenFs *frozen, uint32_t dir, uint32_t i, uint32_t *node);
+// Сколько памяти занимают массивы и скопированные данные (без образа)
+size_t frozen_memory(const FrozenFs *frozen);
+
+#endif /* FREEZE_H */
@@ -0,0 +1,31 @@
+#include <stdlib.h>
+
+#include "handle.h"
+
+FileHandle* open_handle(Inode *node, int flags) {
+    FileHandle *handle = calloc(1, sizeof(FileHandle));
+    if (handle == NULL) return NULL;
+    handle->node = node;
+    handle->flags = flags;
+    node->nopen++;
+    return handle;
+}
+
+bool close_handle(FileHandle *handle) {
+    Inode *node = handle->node;
+    free(handle);
+    return --node->nopen == 0 && node->st->st_nlink == 0;
+}
+
+size_t note_read(FileHandle *handle, off_t offset, size_t size) {
+    off_t expected = __atomic_exchange_n(&handle->next_offset, offset + (off_t)size, __ATOMIC_RELAXED);
+    if (offset != expected || size == 0) {
+        __atomic_store_n(&handle->window, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    size_t window = __atomic_load_n(&handle->window, __ATOMIC_RELAXED);
+    window = window ? window * 2 : READAHEAD_MIN_PAGES;
+    if (window > READAHEAD_MAX_PAGES) window = READAHEAD_MAX_PAGES;
+    __atomic_store_n(&handle->window, window, __ATOMIC_RELAXED);
+    return window;
+}
@@ -0,0 +1,33 @@
+#ifndef HANDLE_H
+#define HANDLE_H
+
+#include "filesystem.h"
+
+// Открытые файлы ---------------------------------------------------------------
+// На каждый open заводится FileHandle, его адрес лежит в fi->fh. Кроме
+// иноды в нём флаги open и состояние чтения: если каждое чтение начинается
+// там, где кончилось предыдущее, поток считается последовательным, и
+// страницы после прочитанного готовятся заранее (разжимаются, подкачиваются)
+// окном, которое удваивается от READAHEAD_MIN_PAGES до READAHEAD_MAX_PAGES.
+// Чтения одного дескриптора идут параллельно под блокировкой чтения fs,
+// поэтому поля состояния меняются атомарно.
+
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+typedef struct FileHandle{
+    Inode *node;
+    int flags;            // флаги open (O_APPEND и т.д.)
+    off_t next_offset;    // где кончилось прошлое чтение
+    size_t window;        // текущее окно упреждения в страницах, 0 - нет
+} FileHandle;
+
+// Под блокировкой записи: увеличивает nopen иноды
+FileHandle* open_handle(Inode *node, int flags);
+// Под блокировкой записи: возвращает true, если это был последний дескриптор
+// удалённого файла и иноду пора освободить
+bool close_handle(FileHandle *handle);
+// Отмечает чтение; возвращает, сколько страниц после него подготовить
+size_t note_read(FileHandle *handle, off_t offset, size_t size);
+
+#endif /* HANDLE_H */
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+#include "snapshot.h"
+
+#define JOURNAL_INITIAL_BUFFER (64 * 1024)
+// Столько накопленных байт будит поток раньше срока, чтобы буфер не рос без меры
+#define JOURNAL_FLUSH_THRESHOLD (4 * 1024 * 1024)
+
+// crc32 --------------------------------------------------------------------
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Контрольная сумма записи: заголовок без поля checksum и всё, что за ним
+static uint32_t record_checksum(const JournalRecord *record, const char *path,
+                                const char *new_path, const void *data) {
+    uint32_t crc = crc32_update(0, (const char *)record + sizeof(record->checksum),
+                                sizeof(JournalRecord) - sizeof(record->checksum));
+    crc = crc32_update(crc, path, record->path_length);
+    crc = crc32_update(crc, new_path, record->new_path_length);
+    return crc32_update(crc, data, record->size);
+}
+
+// Фоновая запись -----------------------------------------------------------
+
+static bool write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buf, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Забирает всё накопленное и записывает одним куском с одним fdatasync
+static void journal_flush(Journal *journal) {
+    pthread_mutex_lock(&journal->io_lock);
+    pthread_mutex_lock(&journal->lock);
+    char *pending = journal->buffer;
+    size_t pending_size = journal->used;
+    size_t pending_capacity = journal->capacity;
+    journal->buffer = journal->spare;
+    journal->capacity = journal->spare_capacity;
+    journal->used = 0;
+    journal->spare = pending;
+    journal->spare_capacity = pending_capacity;
+    pthread_mutex_unlock(&journal->lock);
+
+    if (pending_size > 0) {
+        if (!write_all(journal->fd, pending, pending_size) || fdatasync(journal->fd) != 0) {
+            perror("Ошибка записи журнала");
+        }
+    }
+    pthread_mutex_unlock(&journal->io_lock);
+}
+
+static void* journal_thread(void *arg) {
+    Journal *journal = arg;
+    pthread_mutex_lock(&journal->lock);
+    while (journal->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += journal->fsync_interval_ms / 1000;
+        deadline.tv_nsec += (long)(journal->fsync_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (journal->running && journal->used < JOURNAL_FLUSH_THRESHOLD) {
+            if (pthread_cond_timedwait(&journal->wakeup, &journal->lock, &deadline) == ETIMEDOUT) break;
+        }
+        pthread_mutex_unlock(&journal->lock);
+        journal_flush(journal);
+        pthread_mutex_lock(&journal->lock);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    journal_flush(journal);
+    return NULL;
+}
+
+Journal* journal_open(const char *path, unsigned int fsync_interval_ms) {
+    pthread_once(&crc_table_once, init_crc_table);
+    Journal *journal = calloc(1, sizeof(Journal));
+    if (journal == NULL) return NULL;
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    struct stat journal_stat;
+    if (journal->fd < 0 || fstat(journal->fd, &journal_stat) != 0) {
+        perror("Не удалось открыть журнал");
+        if (journal->fd >= 0) close(journal->fd);
+        free(journal);
+        return NULL;
+    }
+    journal->appended = journal_stat.st_size;
+    journal->path = strdup(path);
+    journal->fsync_interval_ms = fsync_interval_ms ? fsync_interval_ms : 1;
+    journal->buffer = malloc(JOURNAL_INITIAL_BUFFER);
+    journal->capacity = JOURNAL_INITIAL_BUFFER;
+    journal->spare = malloc(JOURNAL_INITIAL_BUFFER);
+    journal->spare_capacity = JOURNAL_INITIAL_BUFFER;
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_mutex_init(&journal->io_lock, NULL);
+    pthread_cond_init(&journal->wakeup, NULL);
+    journal->running = true;
+    if (!journal->buffer || !journal->spare || !journal->path
+        || pthread_create(&journal->thread, NULL, journal_thread, journal) != 0) {
+        fprintf(stderr, "Ошибка: Не удалось запустить поток журнала.\n");
+        close(journal->fd);
+        free(journal->path);
+        free(journal->buffer);
+        free(journal->spare);
+        free(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+// Останавливает поток, дописав всё накопленное
+void journal_close(Journal *journal) {
+    pthread_mutex_lock(&journal->lock);
+    journal->running = false;
+    pthread_cond_signal(&journal->wakeup);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->thread, NULL);
+
+    close(journal->fd);
+    free(journal->path);
+    pthread_mutex_destroy(&journal->lock);
+    pthread_mutex_destroy(&journal->io_lock);
+    pthread_cond_destroy(&journal->wakeup);
+    free(journal->buffer);
+    free(journal->spare);
+    free(journal);
+}
+
+// Вызывается после удачной операции. Только копирует запись в буфер.
+void journal_append(Journal *journal, JournalOp op, const char *path, const char *new_path,
+                    mode_t mode, uid_t uid, gid_t gid, off_t offset, const void *data, size_t size) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.op = op;
+    record.path_length = path ? strlen(path) : 0;
+    record.new_path_length = new_path ? strlen(new_path) : 0;
+    record.mode = mode;
+    record.uid = uid;
+    record.gid = gid;
+    record.offset = offset;
+    record.size = data ? size : 0;
+    record.length = sizeof(record) + record.path_length + record.new_path_length + record.size;
+    record.checksum = record_checksum(&record, path, new_path, data);
+
+    pthread_mutex_lock(&journal->lock);
+    if (journal->used + record.length > journal->capacity) {
+        size_t capacity = journal->capacity * 2;
+        while (capacity < journal->used + record.length) capacity *= 2;
+        char *buffer = realloc(journal->buffer, capacity);
+        if (buffer == NULL) {
+            pthread_mutex_unlock(&journal->lock);
+            fprintf(stderr, "Ошибка: Нет памяти под журнал, запись потеряна.\n");
+            return;
+        }
+        journal->buffer = buffer;
+        journal->capacity = capacity;
+    }
+    char *out = journal->buffer + journal->used;
+    memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    if (record.path_length) memcpy(out, path, record.path_length);
+    out += record.path_length;
+    if (record.new_path_length) memcpy(out, new_path, record.new_path_length);
+    out += record.new_path_length;
+    if (record.size) memcpy(out, data, record.size);
+    journal->used += record.length;
+    journal->appended += record.length;
+    if (journal->used >= JOURNAL_FLUSH_THRESHOLD) {
+        pthread_cond_signal(&journal->wakeup);
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+uint64_t journal_mark(Journal *journal) {
+    pthread_mutex_lock(&journal->lock);
+    uint64_t mark = journal->appended;
+    pthread_mutex_unlock(&journal->lock);
+    return mark;
+}
+
+// Переносит в новый файл хвост старого начиная с offset
+static int rewrite_tail(Journal *journal, off_t offset) {
+    char tmp_path[MAX_PATH];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal->path);
+    int in = open(journal->path, O_RDONLY);
+    int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    struct stat journal_stat;
+    bool ok = in >= 0 && out >= 0 && fstat(in, &journal_stat) == 0;
+    char buf[65536];
+    for (off_t at = offset; ok && at < journal_stat.st_size;) {
+        ssize_t length = pread(in, buf, sizeof(buf), at);
+        if (length < 0 && errno == EINTR) continue;
+        ok = length > 0 && write_all(out, buf, length);
+        at += length;
+    }
+    ok = ok && fdatasync(out) == 0 && rename(tmp_path, journal->path) == 0
+        && sync_parent_directory(journal->path);
+    if (in >= 0) close(in);
+    if (!ok) {
+        if (out >= 0) close(out);
+        unlink(tmp_path);
+        return -1;
+    }
+    return out;
+}
+
+bool journal_discard(Journal *journal, uint64_t mark) {
+    // Поток записи стоит, всё, кроме буфера, уже в файле. Новые записи
+    // тем временем только дописываются в конец буфера
+    pthread_mutex_lock(&journal->io_lock);
+    pthread_mutex_lock(&journal->lock);
+    uint64_t file_end = journal->appended - journal->used;
+    pthread_mutex_unlock(&journal->lock);
+
+    int fd = rewrite_tail(journal, (mark < file_end ? mark : file_end) - journal->base);
+    if (fd >= 0) {
+        close(journal->fd);
+        journal->fd = fd;
+        journal->base = mark;
+        // Часть записей до mark могла ещё не дойти до файла
+        pthread_mutex_lock(&journal->lock);
+        if (mark > file_end) {
+            size_t drop = mark - file_end;
+            memmove(journal->buffer, journal->buffer + drop, journal->used - drop);
+            journal->used -= drop;
+        }
+        pthread_mutex_unlock(&journal->lock);
+    } else {
+        perror("Ошибка сброса журнала");
+    }
+    pthread_mutex_unlock(&journal->io_lock);
+    return fd >= 0;
+}
+
+// Воспроизведение ----------------------------------------------------------
+
+static int apply_clone(Filesystem *fs, const char *path, const char *new_path,
+                       const char *data, uint64_t size) {
+    JournalCloneArgs args;
+    if (size != sizeof(args)) return -EINVAL;
+    memcpy(&args, data, sizeof(args));
+    Inode *src = get_inode_by_path(path, fs->inodes_list);
+    Inode *dst = get_inode_by_path(new_path, fs->inodes_list);
+    if (!src || !dst) return -ENOENT;
+    if (args.length == 0) return clone_node(src, dst);
+    int res = copy_node_range(src, args.src_offset, dst, args.dst_offset, args.length);
+    return res < 0 ? res : 0;
+}
+
+static int apply_record(Filesystem *fs, const JournalRecord *record, const char *path,
+                        const char *new_path, const char *data) {
+    Inode *node;
+    switch (record->op) {
+    case JOURNAL_MKNOD:
+        return make_node(fs, path, record->mode, record->uid, record->gid);
+    case JOURNAL_MKDIR:
+        return make_directory(fs, path, record->mode, record->uid, record->gid);
+    case JOURNAL_WRITE:
+        node = get_inode_by_path(path, fs->inodes_list);
+        if (!node) return -ENOENT;
+        return write_node(node, data, record->size, record->offset) < 0 ? -EIO : 0;
+    case JOURNAL_TRUNCATE:
+        node = get_inode_by_path(path, fs->inodes_list);
+        if (!node) return -ENOENT;
+        return truncate_node(node, record->offset);
+    case JOURNAL_RENAME:
+        return rename_node(fs, path, new_path);
+    case JOURNAL_LINK:
+        return link_node(fs, path, new_path);
+    case JOURNAL_UNLINK:
+        return unlink_node(fs, path);
+    case JOURNAL_RMDIR:
+        return remove_directory(fs, path);
+    case JOURNAL_RMTREE:
+        return remove_tree(fs, path);
+    case JOURNAL_ORDER:
+        return order_directory(fs, path, record->mode != 0);
+    case JOURNAL_CLONE:
+        return apply_clone(fs, path, new_path, data, record->size);
+    case JOURNAL_FALLOCATE: {
+        uint64_t length;
+        if (record->size != sizeof(length)) return -EINVAL;
+        memcpy(&length, data, sizeof(length));
+        node = get_inode_by_path(path, fs->inodes_list);
+        if (!node) return -ENOENT;
+        return fallocate_node(node, record->mode, record->offset, length);
+    }
+    case JOURNAL_UTIMENS: {
+        struct timespec times[2];
+        if (record->size != sizeof(times)) return -EINVAL;
+        memcpy(times, data, sizeof(times));
+        node = get_inode_by_path(path, fs->inodes_list);
+        if (!node) return -ENOENT;
+        return set_node_times(node, times);
+    }
+    default:
+        return -EINVAL;
+    }
+}
+
+// Применяет записи журнала к fs. Повреждённый хвост (недописанная при
+// падении запись) отрезается, чтобы новые записи шли за последней целой.
+bool journal_replay(Filesystem *fs, const char *path) {
+    pthread_once(&crc_table_once, init_crc_table);
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        if (errno == ENOENT) return true;
+        perror("Не удалось открыть журнал");
+        return false;
+    }
+    struct stat journal_stat;
+    if (fstat(fd, &journal_stat) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = journal_stat.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    char *log = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (log == MAP_FAILED) {
+        perror("Не удалось отобразить журнал");
+        close(fd);
+        return false;
+    }
+
+    char record_path[MAX_PATH + 1];
+    char record_new_path[MAX_PATH + 1];
+    size_t offset = 0;
+    size_t applied = 0;
+    while (offset + sizeof(JournalRecord) <= size) {
+        JournalRecord record;
+        memcpy(&record, log + offset, sizeof(record));
+        if (record.length < sizeof(record) || record.length > size - offset
+            || record.length != sizeof(record) + record.path_length + record.new_path_length + record.size
+            || record.path_length > MAX_PATH || record.new_path_length > MAX_PATH) {
+            break;
+        }
+        const char *payload = log + offset + sizeof(record);
+        if (record_checksum(&record, payload, payload + record.path_length,
+                            payload + record.path_length + record.new_path_length) != record.checksum) {
+            break;
+        }
+        memcpy(record_path, payload, record.path_length);
+        record_path[record.path_length] = '\0';
+        memcpy(record_new_path, payload + record.path_length, record.new_path_length);
+        record_new_path[record.new_path_length] = '\0';
+
+        int res = apply_record(fs, &record, record_path, record_new_path,
+                               payload + record.path_length + record.new_path_length);
+        if (res != 0) {
+            fprintf(stderr, "Журнал: операция %d над \"%s\" не применилась: %s\n",
+                    record.op, record_path, strerror(-res));
+        }
+        applied++;
+        offset += record.length;
+    }
+
+    munmap(log, size);
+    if (offset < size) {
+        fprintf(stderr, "Журнал: отброшен повреждённый хвост (%zu байт).\n", size - offset);
+        if (ftruncate(fd, offset) != 0) perror("Ошибка обрезки журнала");
+    }
+    close(fd);
+    printf("Журнал: воспроизведено операций: %zu\n", applied);
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "filesystem.h"
+
+// Журнал изменений ---------------------------------------------------------
+// Каждая изменяющая операция дописывается в буфер в памяти, фоновый поток
+// раз в fsync_interval_ms сбрасывает накопленное одной записью и делает
+// fdatasync (групповая фиксация). Колбэки fuse никогда не ждут диска.
+// При старте журнал воспроизводится поверх исходного дерева.
+
+typedef enum JournalOp{
+    JOURNAL_MKNOD = 1,
+    JOURNAL_MKDIR,
+    JOURNAL_WRITE,
+    JOURNAL_TRUNCATE,
+    JOURNAL_RENAME,
+    JOURNAL_UNLINK,
+    JOURNAL_RMDIR,
+    JOURNAL_CLONE,
+    JOURNAL_FALLOCATE,
+    JOURNAL_RMTREE,
+    JOURNAL_UTIMENS,
+    JOURNAL_ORDER,
+    JOURNAL_LINK,
+} JournalOp;
+
+// Аргументы JOURNAL_CLONE (path - источник, new_path - приёмник), лежат в данных записи.
+// length == 0 - клонирование файла целиком.
+typedef struct JournalCloneArgs{
+    int64_t src_offset;
+    int64_t dst_offset;
+    uint64_t length;
+} JournalCloneArgs;
+
+// JOURNAL_FALLOCATE: режим в mode, начало в offset, длина (uint64_t) в данных записи
+// JOURNAL_UTIMENS: atime и mtime (struct timespec[2]) в данных записи
+// JOURNAL_ORDER: 1 или 0 в mode
+// JOURNAL_LINK: path - существующий файл, new_path - новая ссылка
+
+// Заголовок записи, за ним path, new_path и данные (для write)
+typedef struct JournalRecord{
+    uint32_t checksum;   // crc32 всего, что идёт после этого поля
+    uint32_t length;     // полная длина записи вместе с заголовком
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t path_length;
+    uint16_t new_path_length;
+    uint16_t reserved2;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t reserved3;
+    int64_t offset;      // write: смещение, truncate: новый размер
+    uint64_t size;       // write: длина данных
+} JournalRecord;
+
+typedef struct Journal{
+    int fd;
+    char *path;
+    unsigned int fsync_interval_ms;
+    pthread_t thread;
+    bool running;
+
+    pthread_mutex_t lock;     // защищает buffer, used, running
+    pthread_cond_t wakeup;
+    char *buffer;
+    size_t used;
+    size_t capacity;
+    uint64_t appended;        // байт записей с начала журнала, считая отброшенные
+    uint64_t base;            // сколько из них отброшено (под io_lock)
+
+    pthread_mutex_t io_lock;  // удерживается потоком на время write + fdatasync
+    char *spare;
+    size_t spare_capacity;
+} Journal;
+
+Journal* journal_open(const char *path, unsigned int fsync_interval_ms);
+void journal_close(Journal *journal);
+void journal_append(Journal *journal, JournalOp op, const char *path, const char *new_path,
+                    mode_t mode, uid_t uid, gid_t gid, off_t offset, const void *data, size_t size);
+// Позиция после последней добавленной записи. Берётся под блокировкой
+// записи fs вместе со снимком для образа
+uint64_t journal_mark(Journal *journal);
+// Образ с изменениями до mark уже на диске: убирает эти записи, оставляя
+// более поздние. Журнал переписывается во временный файл и
+// переименовывается, так что при сбое остаётся старый или новый целиком
+bool journal_discard(Journal *journal, uint64_t mark);
+bool journal_replay(Filesystem *fs, const char *path);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "pagealloc.h"
+#include "filesystem.h"
+
+#define PAGES_PER_CHUNK (PAGE_CHUNK_SIZE / FILE_PAGE_SIZE)
+// Свободные буферы, которые не отдаются системе
+#define PAGE_POOL_WARM 64
+// Сколько неотданных буферов копится до следующей пачки madvise
+#define PAGE_TRIM_BATCH 512
+// Буферов в кэше потока; из общего стека и обратно они переходят половинами
+#define PAGE_THREAD_CACHE 32
+
+PageAllocStats page_alloc_stats;
+
+// Страницы выделяются и под блокировкой записи fs, и при чтении
+// (разжатие, подкачка), поэтому у распределителя своя блокировка
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool huge_pages = false;
+static bool released = false;
+static char *chunk = NULL;
+static size_t chunk_used = PAGES_PER_CHUNK;
+static char **chunks = NULL;
+
+// Стек свободных буферов; [0, advised) уже отданы системе
+static char **free_list = NULL;
+static size_t free_capacity = 0;
+static size_t advised = 0;
+
+typedef struct ThreadPageCache{
+    bool enabled;
+    size_t count;
+    char *pages[PAGE_THREAD_CACHE];
+} ThreadPageCache;
+
+static __thread ThreadPageCache thread_cache;
+
+void page_alloc_use_huge_pages(bool enable) {
+    huge_pages = enable;
+}
+
+static char* map_chunk(void) {
+    if (!huge_pages) {
+        char *region = mmap(NULL, PAGE_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return region == MAP_FAILED ? NULL : region;
+    }
+    // Для прозрачных огромных страниц кусок должен быть выровнен на их размер
+    char *region = mmap(NULL, 2 * PAGE_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+    uintptr_t start = ((uintptr_t)region + PAGE_CHUNK_SIZE - 1) & ~(uintptr_t)(PAGE_CHUNK_SIZE - 1);
+    char *aligned = (char*)start;
+    if (aligned > region) munmap(region, aligned - region);
+    munmap(aligned + PAGE_CHUNK_SIZE, region + PAGE_CHUNK_SIZE - aligned);
+    madvise(aligned, PAGE_CHUNK_SIZE, MADV_HUGEPAGE);
+    return aligned;
+}
+
+// Место в стеке резервируется заранее, чтобы free_page_data не падал
+static bool new_chunk(void) {
+    size_t capacity = (page_alloc_stats.chunks + 1) * PAGES_PER_CHUNK;
+    char **list = realloc(free_list, capacity * sizeof(char*));
+    if (list == NULL) return false;
+    free_list = list;
+    free_capacity = capacity;
+    list = realloc(chunks, (page_alloc_stats.chunks + 1) * sizeof(char*));
+    if (list == NULL) return false;
+    chunks = list;
+    chunk = map_chunk();
+    if (chunk == NULL) return false;
+    chunks[page_alloc_stats.chunks++] = chunk;
+    chunk_used = 0;
+    return true;
+}
+
+static char* alloc_locked(void) {
+    char *data = NULL;
+    if (page_alloc_stats.free_pages) {
+        data = free_list[--page_alloc_stats.free_pages];
+        if (advised > page_alloc_stats.free_pages) advised = page_alloc_stats.free_pages;
+    } else if (chunk_used < PAGES_PER_CHUNK || new_chunk()) {
+        data = chunk + chunk_used++ * FILE_PAGE_SIZE;
+    }
+    return data;
+}
+
+char* alloc_page_data(void) {
+    ThreadPageCache *cache = &thread_cache;
+    if (cache->count) return cache->pages[--cache->count];
+    pthread_mutex_lock(&alloc_lock);
+    char *data = alloc_locked();
+    // Заодно запасаем половину кэша, пока блокировка взята
+    while (data && cache->enabled && cache->count < PAGE_THREAD_CACHE / 2) {
+        char *spare = alloc_locked();
+        if (spare == NULL) break;
+        cache->pages[cache->count++] = spare;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    return data;
+}
+
+static int compare_addresses(const void *a, const void *b) {
+    char *left = *(char* const*)a;
+    char *right = *(char* const*)b;
+    return left < right ? -1 : left > right;
+}
+
+static void trim_locked(void) {
+    if (page_alloc_stats.free_pages <= advised + PAGE_POOL_WARM) return;
+    size_t end = page_alloc_stats.free_pages - PAGE_POOL_WARM;
+    qsort(free_list + advised, end - advised, sizeof(char*), compare_addresses);
+    size_t i = advised;
+    while (i < end) {
+        size_t j = i + 1;
+        while (j < end && free_list[j] == free_list[j - 1] + FILE_PAGE_SIZE) j++;
+        madvise(free_list[i], (j - i) * FILE_PAGE_SIZE, MADV_DONTNEED);
+        i = j;
+    }
+    advised = end;
+}
+
+static void free_locked(char *data) {
+    free_list[page_alloc_stats.free_pages++] = data;
+}
+
+void free_page_data(char *data) {
+    if (data == NULL) return;
+    ThreadPageCache *cache = &thread_cache;
+    if (cache->enabled && cache->count < PAGE_THREAD_CACHE) {
+        cache->pages[cache->count++] = data;
+        return;
+    }
+    pthread_mutex_lock(&alloc_lock);
+    if (released) {
+        pthread_mutex_unlock(&alloc_lock);
+        return;
+    }
+    free_locked(data);
+    // Полный кэш потока отдаёт половину за ту же блокировку
+    while (cache->count > PAGE_THREAD_CACHE / 2) free_locked(cache->pages[--cache->count]);
+    if (page_alloc_stats.free_pages >= advised + PAGE_POOL_WARM + PAGE_TRIM_BATCH) trim_locked();
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void page_alloc_thread_cache(bool enable) {
+    ThreadPageCache *cache = &thread_cache;
+    cache->enabled = enable;
+    if (enable || cache->count == 0) return;
+    pthread_mutex_lock(&alloc_lock);
+    while (cache->count) {
+        char *data = cache->pages[--cache->count];
+        if (!released) free_locked(data);
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void page_alloc_trim(void) {
+    pthread_mutex_lock(&alloc_lock);
+    trim_locked();
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void page_alloc_release(void) {
+    pthread_mutex_lock(&alloc_lock);
+    for (size_t i = 0; i < page_alloc_stats.chunks; i++) {
+        munmap(chunks[i], PAGE_CHUNK_SIZE);
+    }
+    free(chunks);
+    free(free_list);
+    chunks = NULL;
+    free_list = NULL;
+    free_capacity = advised = 0;
+    chunk = NULL;
+    chunk_used = PAGES_PER_CHUNK;
+    page_alloc_stats.chunks = page_alloc_stats.free_pages = 0;
+    released = true;
+    pthread_mutex_unlock(&alloc_lock);
+}
@@ -0,0 +1,38 @@
+#ifndef PAGEALLOC_H
+#define PAGEALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Память под данные страниц --------------------------------------------------
+// Буферы страниц (FILE_PAGE_SIZE) нарезаются из анонимных отображений по
+// PAGE_CHUNK_SIZE, а не берутся из malloc: куча не фрагментируется мелкими
+// блоками, а освобождённая память возвращается системе через
+// madvise(MADV_DONTNEED), так что RSS демона следует за размером файлов.
+// Несколько последних освобождённых буферов остаются тёплыми для повторного
+// использования, остальные отдаются пачками, соседние адреса одним вызовом.
+
+#define PAGE_CHUNK_SIZE (2 << 20)
+
+typedef struct PageAllocStats{
+    size_t chunks;      // отображённых кусков по PAGE_CHUNK_SIZE
+    size_t free_pages;  // свободных буферов (в т.ч. отданных системе)
+} PageAllocStats;
+
+extern PageAllocStats page_alloc_stats;
+
+// Куски выравниваются на 2 МиБ и помечаются MADV_HUGEPAGE
+void page_alloc_use_huge_pages(bool enable);
+char* alloc_page_data(void);
+void free_page_data(char *data);
+// Кэш буферов потока: выделение и освобождение без общей блокировки, пока
+// в нём есть место. Выключение возвращает буферы в общий стек; поток должен
+// выключить кэш до page_alloc_release.
+void page_alloc_thread_cache(bool enable);
+// Отдать системе все свободные буферы сверх тёплого запаса
+void page_alloc_trim(void);
+// При размонтировании: снимает все отображения разом, за время, не зависящее
+// от числа страниц. После вызова free_page_data ничего не делает.
+void page_alloc_release(void);
+
+#endif /* PAGEALLOC_H */
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE  // preadv
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "populate.h"
+#include "pagealloc.h"
+#include "usage.h"
+
+// Страниц за один preadv (1 МиБ)
+#define POPULATE_BATCH_PAGES 256
+
+typedef struct PopulateJob{
+    Inode *node;
+    char *host_path;
+    off_t size;
+} PopulateJob;
+
+typedef struct Populate{
+    Filesystem *fs;
+    PopulateJob *jobs;
+    size_t num_jobs;
+    size_t capacity;
+    size_t next_job;   // следующее задание для потоков (атомарно)
+    bool failed;
+} Populate;
+
+static void copy_times(Inode *node, const struct stat *host) {
+    node->st->st_atim = host->st_atim;
+    node->st->st_mtim = host->st_mtim;
+    node->st->st_ctim = host->st_ctim;
+}
+
+static bool add_job(Populate *populate, Inode *node, const char *host_path, off_t size) {
+    if (populate->num_jobs == populate->capacity) {
+        size_t capacity = populate->capacity ? populate->capacity * 2 : 256;
+        PopulateJob *jobs = realloc(populate->jobs, capacity * sizeof(PopulateJob));
+        if (jobs == NULL) return false;
+        populate->jobs = jobs;
+        populate->capacity = capacity;
+    }
+    char *copy = strdup(host_path);
+    if (copy == NULL) return false;
+    populate->jobs[populate->num_jobs++] = (PopulateJob){node, copy, size};
+    return true;
+}
+
+// Обходит каталог хоста и создаёт его содержимое в каталоге path
+static bool walk_host_dir(Populate *populate, const char *host_dir, const char *path) {
+    DIR *dir = opendir(host_dir);
+    if (dir == NULL) {
+        perror(host_dir);
+        return false;
+    }
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char host_path[MAX_PATH];
+        char fs_path[MAX_PATH];
+        if ((size_t)snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, entry->d_name) >= sizeof(host_path)
+            || (size_t)snprintf(fs_path, sizeof(fs_path), "%s%s%s", path, strcmp(path, "/") ? "/" : "",
+                                entry->d_name) >= sizeof(fs_path)) {
+            fprintf(stderr, "Ошибка: Слишком длинный путь %s/%s\n", host_dir, entry->d_name);
+            ok = false;
+            break;
+        }
+        struct stat host;
+        if (lstat(host_path, &host) != 0) {
+            perror(host_path);
+            ok = false;
+            break;
+        }
+
+        int res;
+        if (S_ISDIR(host.st_mode)) {
+            res = make_directory(populate->fs, fs_path, host.st_mode & 07777, host.st_uid, host.st_gid);
+        } else if (S_ISREG(host.st_mode)) {
+            res = make_node(populate->fs, fs_path, host.st_mode, host.st_uid, host.st_gid);
+        } else {
+            fprintf(stderr, "Пропущен %s: поддерживаются только файлы и каталоги\n", host_path);
+            continue;
+        }
+        if (res != 0) {
+            fprintf(stderr, "Ошибка: Не удалось создать %s: %s\n", fs_path, strerror(-res));
+            ok = false;
+            break;
+        }
+        Inode *node = get_inode_by_path(fs_path, populate->fs->inodes_list);
+        if (S_ISDIR(host.st_mode)) {
+            ok = walk_host_dir(populate, host_path, fs_path);
+        } else if (host.st_size > 0) {
+            ok = add_job(populate, node, host_path, host.st_size);
+        }
+        // Время каталога ставится после заполнения, как у cp -a
+        copy_times(node, &host);
+    }
+    closedir(dir);
+    return ok;
+}
+
+// Вставляет прочитанные буферы как страницы first.. файла
+static bool install_pages(Filesystem *fs, Inode *node, size_t first, char **buffers, size_t count, off_t size) {
+    bool ok = true;
+    write_lock_filesystem(fs);
+    if (node->data == NULL) node->data = init_file_data();
+    FileData *file = node->data;
+    if (file == NULL || !reserve_file_pages(file, first + count)) ok = false;
+    for (size_t i = 0; i < count; i++) {
+        DataPage *page = ok ? init_data_page(buffers[i], false) : NULL;
+        if (page == NULL) {
+            free_page_data(buffers[i]);
+            ok = false;
+            continue;
+        }
+        file->pages[first + i] = page;
+    }
+    if (ok) usage_set_size(node, size);
+    unlock_filesystem(fs);
+    return ok;
+}
+
+static bool load_file(Filesystem *fs, PopulateJob *job) {
+    int fd = open(job->host_path, O_RDONLY);
+    if (fd < 0) {
+        perror(job->host_path);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char *buffers[POPULATE_BATCH_PAGES];
+    struct iovec iov[POPULATE_BATCH_PAGES];
+    off_t done = 0;
+    bool ok = true;
+    while (ok && done < job->size) {
+        size_t count = (job->size - done + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+        if (count > POPULATE_BATCH_PAGES) count = POPULATE_BATCH_PAGES;
+        for (size_t i = 0; i < count; i++) {
+            buffers[i] = alloc_page_data();
+            if (buffers[i] == NULL) {
+                while (i--) free_page_data(buffers[i]);
+                ok = false;
+                break;
+            }
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = FILE_PAGE_SIZE;
+        }
+        if (!ok) break;
+
+        ssize_t got = preadv(fd, iov, count, done);
+        if (got <= 0) {
+            // Файл укоротился или не читается: берём то, что успели
+            if (got < 0) perror(job->host_path);
+            for (size_t i = 0; i < count; i++) free_page_data(buffers[i]);
+            ok = got == 0;
+            break;
+        }
+        size_t pages = (got + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+        memset(buffers[pages - 1] + (got - (pages - 1) * FILE_PAGE_SIZE), 0,
+               pages * FILE_PAGE_SIZE - got);
+        for (size_t i = pages; i < count; i++) free_page_data(buffers[i]);
+        ok = install_pages(fs, job->node, done / FILE_PAGE_SIZE, buffers, pages, done + got);
+        done += got;
+    }
+    close(fd);
+    return ok;
+}
+
+static void* populate_thread(void *arg) {
+    Populate *populate = arg;
+    for (;;) {
+        size_t index = __atomic_fetch_add(&populate->next_job, 1, __ATOMIC_RELAXED);
+        if (index >= populate->num_jobs) break;
+        if (!load_file(populate->fs, &populate->jobs[index])) {
+            __atomic_store_n(&populate->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+bool populate_from_host(Filesystem *fs, const char *host_dir, int threads) {
+    Populate populate = {fs, NULL, 0, 0, 0, false};
+    bool ok = walk_host_dir(&populate, host_dir, "/");
+
+    if (ok && populate.num_jobs) {
+        if (threads < 1) threads = 1;
+        if ((size_t)threads > populate.num_jobs) threads = populate.num_jobs;
+        pthread_t workers[threads];
+        int started = 0;
+        for (; started < threads; started++) {
+            if (pthread_create(&workers[started], NULL, populate_thread, &populate) != 0) break;
+        }
+        // Если ни один поток не запустился, читаем сами
+        if (started == 0) populate_thread(&populate);
+        for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        ok = !populate.failed;
+    }
+
+    for (size_t i = 0; i < populate.num_jobs; i++) free(populate.jobs[i].host_path);
+    free(populate.jobs);
+    if (ok) {
+        printf("Загружено из %s: файлов с данными %zu\n", host_dir, populate.num_jobs);
+    }
+    return ok;
+}
@@ -0,0 +1,16 @@
+#ifndef POPULATE_H
+#define POPULATE_H
+
+#include "filesystem.h"
+
+// Начальное заполнение из каталога хоста ------------------------------------
+// До монтирования дерево каталога хоста переносится в корень fs. Обход идёт
+// в одном потоке и сразу создаёт иноды и каталоги (метаданные дешёвые),
+// содержимое файлов читают threads потоков: preadv по мегабайту прямо в
+// буферы страниц, страницы вставляются в файл под блокировкой записи.
+// Сохраняются режим, владелец и времена; символьные ссылки и специальные
+// файлы пропускаются.
+
+bool populate_from_host(Filesystem *fs, const char *host_dir, int threads);
+
+#endif /* POPULATE_H */
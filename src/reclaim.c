@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "reclaim.h"
+
+ReclaimStats reclaim_stats;
+
+static Filesystem *reclaim_fs = NULL;
+static pthread_t thread;
+static bool running = false;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static FileData *queue = NULL;
+
+// Вызывается под блокировкой записи fs
+bool reclaim_defer(FileData *file) {
+    if (file->num_pages < RECLAIM_MIN_PAGES) return false;
+    pthread_mutex_lock(&queue_lock);
+    bool deferred = running;
+    if (deferred) {
+        file->reclaim_next = queue;
+        queue = file;
+        reclaim_stats.pending_files++;
+        reclaim_stats.pending_pages += file->num_pages;
+        pthread_cond_signal(&wakeup);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return deferred;
+}
+
+// Отпускает страницы с конца таблицы, не больше пачки за раз
+static void release_batch(FileData *file) {
+    size_t batch = file->num_pages < RECLAIM_BATCH_PAGES ? file->num_pages : RECLAIM_BATCH_PAGES;
+    for (size_t i = 0; i < batch; i++) {
+        DataPage *page = file->pages[--file->num_pages];
+        if (page) release_data_page(page);
+    }
+    pthread_mutex_lock(&queue_lock);
+    reclaim_stats.pending_pages -= batch;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void reclaim_file(Filesystem *fs, FileData *file) {
+    while (file->num_pages) {
+        write_lock_filesystem(fs);
+        release_batch(file);
+        unlock_filesystem(fs);
+    }
+    destroy_file_data(file);
+}
+
+static void* reclaim_thread(void *arg) {
+    pthread_mutex_lock(&queue_lock);
+    while (running) {
+        if (queue == NULL) {
+            pthread_cond_wait(&wakeup, &queue_lock);
+            continue;
+        }
+        FileData *file = queue;
+        queue = file->reclaim_next;
+        pthread_mutex_unlock(&queue_lock);
+
+        reclaim_file(reclaim_fs, file);
+
+        pthread_mutex_lock(&queue_lock);
+        reclaim_stats.pending_files--;
+        reclaim_stats.reclaimed_files++;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+bool reclaimer_start(Filesystem *fs) {
+    reclaim_fs = fs;
+    running = true;
+    if (pthread_create(&thread, NULL, reclaim_thread, NULL) != 0) {
+        fprintf(stderr, "Ошибка: Не удалось запустить поток освобождения памяти.\n");
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void reclaimer_stop(void) {
+    pthread_mutex_lock(&queue_lock);
+    if (!running) {
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+    running = false;
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(thread, NULL);
+
+    while (queue) {
+        FileData *file = queue;
+        queue = file->reclaim_next;
+        reclaim_file(reclaim_fs, file);
+        reclaim_stats.pending_files--;
+        reclaim_stats.reclaimed_files++;
+    }
+}
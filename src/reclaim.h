@@ -0,0 +1,32 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <pthread.h>
+#include "filesystem.h"
+
+// Фоновое освобождение данных ------------------------------------------------
+// Когда удаляется последняя ссылка на большой файл, его таблица страниц
+// уходит в очередь, а unlink сразу возвращается. Поток забирает файлы из
+// очереди и отпускает страницы пачками под блокировкой записи fs (страницы
+// могут быть общими с другими файлами), отдавая блокировку между пачками.
+// Очередь одна на процесс, как индекс дедупликации.
+
+// Файлы меньше этого освобождаются сразу
+#define RECLAIM_MIN_PAGES 256
+#define RECLAIM_BATCH_PAGES 4096
+
+typedef struct ReclaimStats{
+    size_t pending_files;
+    size_t pending_pages;
+    size_t reclaimed_files;  // за всё время
+} ReclaimStats;
+
+extern ReclaimStats reclaim_stats;
+
+// false - поток не запущен или файл маленький, освобождать надо сразу
+bool reclaim_defer(FileData *file);
+bool reclaimer_start(Filesystem *fs);
+// Дожидается потока и освобождает то, что осталось в очереди
+void reclaimer_stop(void);
+
+#endif /* RECLAIM_H */
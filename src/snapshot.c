@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "compress.h"
+#include "usage.h"
+
+#define SNAPSHOT_ALIGN 4096
+// Столько страниц копируется за одну блокировку чтения
+#define SNAPSHOT_BATCH 64
+
+static uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// Удалённый, но ещё открытый файл в образ не попадает: после
+// восстановления он был бы недостижим и навсегда занял бы номер
+static bool saved_node(Inode *node) {
+    return node && (is_dir(node) || node->st->st_nlink > 0);
+}
+
+static uint64_t directory_image_size(Directory *dir) {
+    uint64_t size = 0;
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        size += sizeof(int32_t) + sizeof(uint8_t) + strlen(dir->entries[i].name);
+    }
+    return size;
+}
+
+// Сохранение ---------------------------------------------------------------
+
+// Фиксирует на диске сам rename: запись о новом имени лежит в каталоге
+bool sync_parent_directory(const char *path) {
+    char dir_path[MAX_PATH];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(dir_path, ".");
+    } else if (slash == path) {
+        strcpy(dir_path, "/");
+    } else {
+        size_t length = slash - path;
+        if (length >= sizeof(dir_path)) return false;
+        memcpy(dir_path, path, length);
+        dir_path[length] = '\0';
+    }
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+struct SnapshotCapture{
+    SnapshotHeader header;
+    SnapshotInode *records;
+    char *entries;         // записи каталогов, как в образе
+    uint64_t entries_size;
+    PageRef *pages;        // страницы файлов подряд, пустые - нули
+    size_t num_pages;
+};
+
+static size_t pages_of(off_t size) {
+    return (size + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+}
+
+static void fill_record(SnapshotInode *record, Inode *node) {
+    memset(record, 0, sizeof(*record));
+    record->node_number = node->node_number;
+    record->parent_number = node->parent_node ? node->parent_node->node_number : 1;
+    record->mode = node->st->st_mode;
+    record->nlink = node->st->st_nlink;
+    record->uid = node->st->st_uid;
+    record->gid = node->st->st_gid;
+    record->size = node->st->st_size;
+    record->atime = node->st->st_atim;
+    record->mtime = node->st->st_mtim;
+    record->ctime = node->st->st_ctim;
+}
+
+static char* copy_directory(char *out, Directory *dir) {
+    for (int j = next_entry(dir, 0); j >= 0; j = next_entry(dir, j + 1)) {
+        int32_t number = dir->entries[j].node_number;
+        uint8_t length = (uint8_t)strlen(dir->entries[j].name);
+        memcpy(out, &number, sizeof(number));
+        memcpy(out + sizeof(number), &length, sizeof(length));
+        memcpy(out + sizeof(number) + sizeof(length), dir->entries[j].name, length);
+        out += sizeof(number) + sizeof(length) + length;
+    }
+    return out;
+}
+
+static void free_capture(SnapshotCapture *capture) {
+    free(capture->records);
+    free(capture->entries);
+    free(capture->pages);
+    free(capture);
+}
+
+SnapshotCapture* capture_snapshot(Filesystem *fs) {
+    InodeContainer *container = fs->inodes_list;
+    uint32_t inode_count = 0;
+    uint64_t entries_size = 0;
+    uint64_t data_size = 0;
+    size_t num_pages = 0;
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = container->inode_table[i];
+        if (!saved_node(node)) continue;
+        inode_count++;
+        if (is_dir(node)) {
+            entries_size += directory_image_size(node->data);
+        } else {
+            data_size += align_up(node->st->st_size, SNAPSHOT_ALIGN);
+            num_pages += pages_of(node->st->st_size);
+        }
+    }
+
+    SnapshotCapture *capture = calloc(1, sizeof(SnapshotCapture));
+    if (capture == NULL) return NULL;
+    capture->records = calloc(inode_count + 1, sizeof(SnapshotInode));
+    capture->entries = malloc(entries_size + 1);
+    capture->pages = calloc(num_pages + 1, sizeof(PageRef));
+    if (!capture->records || !capture->entries || !capture->pages) {
+        free_capture(capture);
+        return NULL;
+    }
+    capture->num_pages = num_pages;
+    capture->entries_size = entries_size;
+
+    SnapshotHeader *header = &capture->header;
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->inode_count = inode_count;
+    header->entries_offset = sizeof(SnapshotHeader) + (uint64_t)inode_count * sizeof(SnapshotInode);
+    header->data_offset = align_up(header->entries_offset + entries_size, SNAPSHOT_ALIGN);
+    header->image_size = header->data_offset + data_size;
+
+    uint64_t entries_offset = header->entries_offset;
+    uint64_t data_offset = header->data_offset;
+    char *entries = capture->entries;
+    PageRef *pages = capture->pages;
+    SnapshotInode *record = capture->records;
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = container->inode_table[i];
+        if (!saved_node(node)) continue;
+        fill_record(record, node);
+        if (is_dir(node)) {
+            Directory *dir = node->data;
+            record->offset = entries_offset;
+            record->num_entries = dir->num_entries;
+            record->flags = dir->ordered ? SNAPSHOT_DIR_ORDERED : 0;
+            entries_offset += directory_image_size(dir);
+            entries = copy_directory(entries, dir);
+        } else {
+            record->offset = data_offset;
+            data_offset += align_up(node->st->st_size, SNAPSHOT_ALIGN);
+            FileData *file = node->data;
+            for (size_t page = 0; page < pages_of(node->st->st_size); page++, pages++) {
+                get_page_ref(file, page, pages);
+            }
+        }
+        record++;
+    }
+    return capture;
+}
+
+void release_capture(Filesystem *fs, SnapshotCapture *capture) {
+    if (capture == NULL) return;
+    write_lock_filesystem(fs);
+    for (size_t i = 0; i < capture->num_pages; i++) {
+        if (capture->pages[i].page) release_data_page(capture->pages[i].page);
+    }
+    unlock_filesystem(fs);
+    free_capture(capture);
+}
+
+// Данные одного файла. Страницы копируются пачками под короткой блокировкой
+// чтения: сжатые и выгруженные страницы при этом подгружаются
+static bool write_file_data(FILE *out, Filesystem *fs, const PageRef *pages, off_t size, char *buf) {
+    static const char zero_page[FILE_PAGE_SIZE];
+    size_t count = pages_of(size);
+    for (size_t i = 0; i < count;) {
+        size_t batch = count - i < SNAPSHOT_BATCH ? count - i : SNAPSHOT_BATCH;
+        size_t used = 0;
+        read_lock_filesystem(fs);
+        for (size_t j = i; j < i + batch; j++) {
+            off_t left = size - (off_t)j * FILE_PAGE_SIZE;
+            size_t chunk = left < FILE_PAGE_SIZE ? (size_t)left : FILE_PAGE_SIZE;
+            const char *data = pages[j].page ? load_page_data(pages[j].page)
+                             : pages[j].image ? pages[j].image : zero_page;
+            if (data == NULL) {
+                unlock_filesystem(fs);
+                return false;
+            }
+            memcpy(buf + used, data, chunk);
+            used += chunk;
+        }
+        unlock_filesystem(fs);
+        if (fwrite(buf, 1, used, out) != used) return false;
+        i += batch;
+    }
+    return true;
+}
+
+bool write_snapshot(Filesystem *fs, const SnapshotCapture *capture, const char *image_path) {
+    const SnapshotHeader *header = &capture->header;
+    // Пишем во временный файл и переименовываем, чтобы не испортить старый образ
+    char tmp_path[MAX_PATH];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", image_path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        perror("Не удалось создать файл образа");
+        return false;
+    }
+    char *buf = malloc(SNAPSHOT_BATCH * FILE_PAGE_SIZE);
+    bool ok = buf && fwrite(header, sizeof(*header), 1, out) == 1
+        && fwrite(capture->records, sizeof(SnapshotInode), header->inode_count, out) == header->inode_count
+        && fwrite(capture->entries, 1, capture->entries_size, out) == capture->entries_size;
+
+    // Промежутки до границ страниц остаются дырами и читаются нулями
+    const PageRef *pages = capture->pages;
+    for (uint32_t i = 0; i < header->inode_count && ok; i++) {
+        const SnapshotInode *record = &capture->records[i];
+        if (S_ISDIR(record->mode)) continue;
+        ok = record->size == 0 || (fseeko(out, record->offset, SEEK_SET) == 0
+                                   && write_file_data(out, fs, pages, record->size, buf));
+        pages += pages_of(record->size);
+    }
+    free(buf);
+    // Последняя страница последнего файла тоже должна целиком лежать в файле
+    if (ok) ok = fflush(out) == 0 && ftruncate(fileno(out), header->image_size) == 0;
+    // Образ должен лежать на диске раньше, чем rename сделает его видимым
+    if (ok) ok = fsync(fileno(out)) == 0;
+
+    if (fclose(out) != 0) ok = false;
+    if (!ok || rename(tmp_path, image_path) != 0) {
+        perror("Ошибка записи образа");
+        unlink(tmp_path);
+        return false;
+    }
+    if (!sync_parent_directory(image_path)) {
+        perror("Ошибка синхронизации каталога образа");
+        return false;
+    }
+    return true;
+}
+
+bool save_snapshot(Filesystem *fs, const char *image_path) {
+    write_lock_filesystem(fs);
+    SnapshotCapture *capture = capture_snapshot(fs);
+    unlock_filesystem(fs);
+    if (capture == NULL) {
+        fprintf(stderr, "Ошибка: Нет памяти под снимок для образа.\n");
+        return false;
+    }
+    bool ok = write_snapshot(fs, capture, image_path);
+    release_capture(fs, capture);
+    return ok;
+}
+
+// Восстановление -----------------------------------------------------------
+
+static bool restore_directory(Directory *dir, const char *image, const SnapshotHeader *header,
+                              const SnapshotInode *record) {
+    uint64_t offset = record->offset;
+    if (record->num_entries > MAX_FILES) return false;
+    for (uint32_t i = 0; i < record->num_entries; i++) {
+        if (offset + sizeof(int32_t) + sizeof(uint8_t) > header->data_offset) return false;
+        int32_t number;
+        uint8_t length;
+        memcpy(&number, image + offset, sizeof(number));
+        memcpy(&length, image + offset + sizeof(number), sizeof(length));
+        offset += sizeof(number) + sizeof(length);
+        if (offset + length > header->data_offset || length == 0 || length >= MAX_FILE_NAME
+            || number <= 0 || number > MAX_INODES) return false;
+
+        memcpy(dir->entries[i].name, image + offset, length);
+        dir->entries[i].name[length] = '\0';
+        dir->entries[i].node_number = number;
+        dir->entries[i].generation = 1;
+        offset += length;
+    }
+    // Свободные слоты в образ не попадают, записи восстанавливаются подряд
+    dir->num_entries = dir->num_slots = record->num_entries;
+    set_directory_ordered(dir, record->flags & SNAPSHOT_DIR_ORDERED);
+    return true;
+}
+
+// Файл читается прямо из отображения образа. DataPage страница получает
+// только при первой записи или разделении, поэтому время восстановления
+// не зависит от объёма данных
+static bool restore_file_pages(Inode *node, char *data) {
+    FileData *file = init_file_data();
+    node->data = file;
+    size_t num_pages = pages_of(node->st->st_size);
+    if (file == NULL || !reserve_file_pages(file, num_pages)) return false;
+    file->image = data;
+    file->image_pages = num_pages;
+    return true;
+}
+
+// Все записи каталогов указывают на иноды из образа
+static bool entries_resolved(Filesystem *fs) {
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = fs->inodes_list->inode_table[i];
+        if (!node || !is_dir(node)) continue;
+        Directory *dir = node->data;
+        for (int j = next_entry(dir, 0); j >= 0; j = next_entry(dir, j + 1)) {
+            if (!fs->inodes_list->inode_table[dir->entries[j].node_number]) return false;
+        }
+    }
+    return true;
+}
+
+static void destroy_restored(Filesystem *fs) {
+    for (int i = 1; i <= MAX_INODES; i++) {
+        if (fs->inodes_list->inode_table[i]) destroy_inode(fs->inodes_list->inode_table[i]);
+    }
+    free(fs->inodes_list);
+    free(fs->inodes_numbers_tracker);
+    release_snapshot(fs);
+    free(fs);
+}
+
+// Отображает образ в память и строит по нему дерево.
+// Копируются только метаданные, данные файлов остаются в отображении.
+Filesystem* restore_snapshot(const char *image_path) {
+    int fd = open(image_path, O_RDONLY);
+    if (fd < 0) {
+        perror("Не удалось открыть образ");
+        return NULL;
+    }
+    struct stat image_stat;
+    if (fstat(fd, &image_stat) != 0 || (size_t)image_stat.st_size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "Ошибка: Образ \"%s\" повреждён.\n", image_path);
+        close(fd);
+        return NULL;
+    }
+    char *image = mmap(NULL, image_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("Не удалось отобразить образ");
+        return NULL;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)image;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SNAPSHOT_VERSION
+        || header->image_size > (uint64_t)image_stat.st_size
+        || header->inode_count > MAX_INODES
+        || header->entries_offset != sizeof(SnapshotHeader) + (uint64_t)header->inode_count * sizeof(SnapshotInode)
+        || header->data_offset < header->entries_offset
+        || header->data_offset > header->image_size) {
+        fprintf(stderr, "Ошибка: Образ \"%s\" повреждён.\n", image_path);
+        munmap(image, image_stat.st_size);
+        return NULL;
+    }
+
+    Filesystem *fs = malloc(sizeof(Filesystem));
+    if (fs == NULL) {
+        fprintf(stderr, "Ошибка выделения памяти для файловой системы.\n");
+        exit(EXIT_FAILURE);
+    }
+    fs->inodes_list = init_inode_container(MAX_INODES);
+    fs->inodes_numbers_tracker = init_inodes_numbers_tracker(MAX_INODES);
+    fs->image = image;
+    fs->image_size = image_stat.st_size;
+    pthread_rwlock_init(&fs->lock, NULL);
+
+    const SnapshotInode *records = (const SnapshotInode *)(image + sizeof(SnapshotHeader));
+    for (uint32_t i = 0; i < header->inode_count; i++) {
+        const SnapshotInode *record = &records[i];
+        if (record->node_number <= 0 || record->node_number > MAX_INODES
+            || fs->inodes_list->inode_table[record->node_number]) {
+            goto corrupted;
+        }
+
+        struct stat *st = calloc(1, sizeof(struct stat));
+        if (st == NULL) goto no_memory;
+        st->st_ino = record->node_number;
+        st->st_mode = record->mode;
+        st->st_nlink = record->nlink;
+        st->st_uid = record->uid;
+        st->st_gid = record->gid;
+        st->st_size = record->size;
+        st->st_atim = record->atime;
+        st->st_mtim = record->mtime;
+        st->st_ctim = record->ctime;
+
+        Inode *node = init_inode(record->node_number, st, NULL, NULL);
+        add_inode_to_container(fs->inodes_list, node->node_number, node);
+        fs->inodes_numbers_tracker->inodes[node->node_number - 1] = 1;
+
+        if (S_ISDIR(record->mode)) {
+            node->data = calloc(1, sizeof(Directory));
+            if (node->data == NULL) goto no_memory;
+            if (!restore_directory(node->data, image, header, record)) goto corrupted;
+        } else if (record->size < 0) {
+            goto corrupted;
+        } else if (record->size > 0) {
+            if (record->offset < header->data_offset || record->offset % SNAPSHOT_ALIGN != 0
+                || record->offset + align_up(record->size, SNAPSHOT_ALIGN) > header->image_size) {
+                goto corrupted;
+            }
+            if (!restore_file_pages(node, image + record->offset)) goto corrupted;
+        }
+    }
+
+    if (!entries_resolved(fs)) goto corrupted;
+    for (uint32_t i = 0; i < header->inode_count; i++) {
+        Inode *node = fs->inodes_list->inode_table[records[i].node_number];
+        node->parent_node = get_inode_from_container(fs->inodes_list, records[i].parent_number);
+    }
+    fs->root = get_inode_from_container(fs->inodes_list, 1);
+    if (fs->root == NULL || !is_dir(fs->root)) goto corrupted;
+    fs->root->parent_node = fs->root;
+    usage_rebuild(fs);
+    return fs;
+
+corrupted:
+    fprintf(stderr, "Ошибка: Образ \"%s\" повреждён.\n", image_path);
+    destroy_restored(fs);
+    return NULL;
+
+no_memory:
+    fprintf(stderr, "Ошибка выделения памяти при восстановлении образа.\n");
+    destroy_restored(fs);
+    return NULL;
+}
+
+void release_snapshot(Filesystem *fs) {
+    if (fs->image) {
+        munmap(fs->image, fs->image_size);
+        fs->image = NULL;
+        fs->image_size = 0;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "filesystem.h"
+
+// Образ файловой системы ---------------------------------------------------
+// [SnapshotHeader][SnapshotInode x inode_count][записи каталогов][данные файлов]
+// Данные каждого файла начинаются с границы страницы (первый - с
+// data_offset), хвост последней страницы добит нулями. При восстановлении
+// файл запоминает только, где его данные лежат в отображении (FileData.image),
+// и содержимое подгружается ядром при первом обращении. Запись в страницу
+// образа копирует её в кучу, DataPage заводится только при разделении
+// (см. DataPage.mapped).
+
+#define SNAPSHOT_MAGIC "TMPFSIMG"
+#define SNAPSHOT_VERSION 2
+
+typedef struct SnapshotHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t inode_count;
+    uint64_t entries_offset;
+    uint64_t data_offset;
+    uint64_t image_size;
+} SnapshotHeader;
+
+typedef struct SnapshotInode{
+    int32_t node_number;
+    int32_t parent_number;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    int64_t size;
+    struct timespec atime;
+    struct timespec mtime;
+    struct timespec ctime;
+    uint64_t offset;      // файл: смещение данных; каталог: смещение записей
+    uint32_t num_entries; // только для каталогов
+    uint32_t flags;
+} SnapshotInode;
+
+#define SNAPSHOT_DIR_ORDERED 1  // каталог с индексом имён
+
+// Запись каталога в образе: int32 номер, uint8 длина имени, имя без '\0'
+
+// Сохранение идёт в три шага, как выгрузка в tar (см. export.h). Под
+// блокировкой записи снимается снимок: метаданные и записи каталогов
+// копируются, на страницы берутся ссылки, так что дальнейшие записи идут
+// через копию. Потом без блокировки fs образ пишется во временный файл,
+// страницы копируются пачками под короткой блокировкой чтения, следуют
+// fsync, rename и fsync каталога. После true образ переживёт сбой хоста,
+// и из журнала можно убрать записи до момента снимка.
+typedef struct SnapshotCapture SnapshotCapture;
+
+// Под блокировкой записи fs. NULL - не хватило памяти
+SnapshotCapture* capture_snapshot(Filesystem *fs);
+// Без блокировки fs
+bool write_snapshot(Filesystem *fs, const SnapshotCapture *capture, const char *image_path);
+// Без блокировки fs: отпускает страницы под блокировкой записи
+void release_capture(Filesystem *fs, SnapshotCapture *capture);
+// Все три шага; без блокировки fs
+bool save_snapshot(Filesystem *fs, const char *image_path);
+Filesystem* restore_snapshot(const char *image_path);
+void release_snapshot(Filesystem *fs);
+// fsync каталога, в котором лежит path
+bool sync_parent_directory(const char *path);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "spill.h"
+#include "pagealloc.h"
+
+SpillStats spill_stats;
+
+static int spill_fd = -1;
+static char *spill_path = NULL;
+static uint32_t next_slot = 0;
+static uint32_t *free_slots = NULL;
+static size_t num_free_slots = 0;
+static size_t free_slots_capacity = 0;
+
+// Стрелка CLOCK: номер inode и страница в нём
+static int hand_inode = 1;
+static size_t hand_page = 0;
+
+bool spill_open(const char *path, size_t memory_limit) {
+    spill_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (spill_fd < 0) {
+        perror(path);
+        return false;
+    }
+    spill_path = strdup(path);
+    spill_stats.memory_limit = memory_limit;
+    return true;
+}
+
+void spill_close(void) {
+    if (spill_fd < 0) return;
+    close(spill_fd);
+    unlink(spill_path);
+    free(spill_path);
+    free(free_slots);
+    spill_fd = -1;
+    spill_path = NULL;
+    free_slots = NULL;
+    num_free_slots = free_slots_capacity = 0;
+    next_slot = 0;
+    spill_stats.memory_limit = 0;
+}
+
+size_t data_heap_bytes(void) {
+    size_t plain = data_stats.pages - data_stats.compressed_pages - data_stats.spilled_pages
+        + data_stats.cached_pages;
+    return plain * FILE_PAGE_SIZE + data_stats.compressed_bytes;
+}
+
+bool spill_over_budget(void) {
+    return spill_stats.memory_limit && data_heap_bytes() > spill_stats.memory_limit;
+}
+
+static bool allocate_slot(uint32_t *slot) {
+    if (num_free_slots) {
+        *slot = free_slots[--num_free_slots];
+        return true;
+    }
+    if (next_slot == UINT32_MAX) return false;
+    *slot = next_slot++;
+    return true;
+}
+
+static void free_slot(uint32_t slot) {
+    if (num_free_slots == free_slots_capacity) {
+        size_t capacity = free_slots_capacity ? free_slots_capacity * 2 : 1024;
+        uint32_t *slots = realloc(free_slots, capacity * sizeof(uint32_t));
+        // Без места в списке слот просто теряется до перезапуска
+        if (slots == NULL) return;
+        free_slots = slots;
+        free_slots_capacity = capacity;
+    }
+    free_slots[num_free_slots++] = slot;
+}
+
+static bool spill_page(DataPage *page) {
+    uint32_t slot;
+    if (!allocate_slot(&slot)) return false;
+    if (pwrite(spill_fd, page->data, FILE_PAGE_SIZE, (off_t)slot * FILE_PAGE_SIZE) != FILE_PAGE_SIZE) {
+        perror("Ошибка: Не удалось выгрузить страницу");
+        free_slot(slot);
+        return false;
+    }
+    free_page_data(page->data);
+    page->data = NULL;
+    page->spilled = true;
+    page->spill_slot = slot;
+    data_stats.spilled_pages++;
+    spill_stats.evictions++;
+    return true;
+}
+
+char* spill_page_in(DataPage *page) {
+    char *data = alloc_page_data();
+    if (data == NULL) return NULL;
+    if (pread(spill_fd, data, FILE_PAGE_SIZE, (off_t)page->spill_slot * FILE_PAGE_SIZE) != FILE_PAGE_SIZE) {
+        perror("Ошибка: Не удалось прочитать выгруженную страницу");
+        free_page_data(data);
+        return NULL;
+    }
+    free_slot(page->spill_slot);
+    page->spilled = false;
+    data_stats.spilled_pages--;
+    spill_stats.page_ins++;
+    __atomic_store_n(&page->data, data, __ATOMIC_RELEASE);
+    return data;
+}
+
+void spill_forget_page(DataPage *page) {
+    free_slot(page->spill_slot);
+    page->spilled = false;
+    data_stats.spilled_pages--;
+}
+
+// Один шаг стрелки: освобождает память страницы, если она не использовалась
+// с прошлого оборота. Возвращает false, если писать в файл подкачки нельзя.
+static bool clock_step(DataPage *page) {
+    if (page == NULL || page->mapped || page->spilled) return true;
+    if (page->referenced) {
+        page->referenced = false;
+        return true;
+    }
+    if (page->zdata) {
+        // У сжатой страницы достаточно выбросить разжатую копию
+        if (page->data) {
+            free_page_data(page->data);
+            page->data = NULL;
+            data_stats.cached_pages--;
+        }
+        return true;
+    }
+    return spill_page(page);
+}
+
+void spill_enforce_budget(Filesystem *fs) {
+    if (!spill_over_budget()) return;
+    size_t low_watermark = spill_stats.memory_limit - spill_stats.memory_limit / 8;
+    // Два полных оборота: первый может только сбросить биты referenced
+    int wraps = 0;
+    while (data_heap_bytes() > low_watermark && wraps <= 2) {
+        Inode *node = fs->inodes_list->inode_table[hand_inode];
+        FileData *file = node && is_file(node) ? node->data : NULL;
+        if (file == NULL || hand_page >= file->num_pages) {
+            hand_page = 0;
+            if (++hand_inode > MAX_INODES) {
+                hand_inode = 1;
+                wraps++;
+            }
+            continue;
+        }
+        if (!clock_step(file->pages[hand_page++])) break;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include "filesystem.h"
+
+// Подкачка страниц в файл ----------------------------------------------------
+// Если данные файлов в куче превысили бюджет памяти, давно не использованные
+// страницы выгружаются в файл подкачки, пока занятая память не опустится на
+// восьмую часть ниже бюджета. Кандидатов выбирает CLOCK: стрелка обходит
+// страницы всех файлов, страница с битом referenced (ставит touch_page)
+// получает второй шанс. Выгруженная страница возвращается в память при
+// первом обращении (load_page_data), её слот освобождается.
+// Состояние одно на процесс, как индекс дедупликации.
+
+typedef struct SpillStats{
+    size_t memory_limit;  // байт; 0 - подкачка выключена
+    size_t evictions;     // сколько раз страницы выгружались (за всё время)
+    size_t page_ins;      // сколько раз возвращались в память
+} SpillStats;
+
+extern SpillStats spill_stats;
+
+bool spill_open(const char *path, size_t memory_limit);
+void spill_close(void);
+// Сколько памяти кучи занимают данные файлов
+size_t data_heap_bytes(void);
+bool spill_over_budget(void);
+// Под блокировкой записи fs
+void spill_enforce_budget(Filesystem *fs);
+// Под cache_lock из load_page_data
+char* spill_page_in(DataPage *page);
+void spill_forget_page(DataPage *page);
+
+#endif /* SPILL_H */
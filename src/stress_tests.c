@@ -0,0 +1,376 @@
+// Нагрузочный тест ядра файловой системы в несколько потоков.
+// stress_tests [-t <max threads>] [-n <operations>] [-m <mix>] [-o]
+//   -t  прогоны на 1, 2, 4, ... до max потоков (по умолчанию число ядер)
+//   -n  операций на прогон, делятся между потоками (по умолчанию 200000)
+//   -m  доли операций, например create=30,lookup=40,write=15,rename=10,unlink=5
+//       (по умолчанию STRESS_DEFAULT_MIX: в основном чтения, чтобы read_node
+//       в разных потоках одновременно трогал одни и те же страницы)
+//   -o  каталоги с индексом имён (упорядоченные)
+// Потоки берут блокировку fs так же, как колбэки tmpfs.c: поиск и чтение -
+// на чтение, изменения - на запись. После каждого прогона дерево проверяется
+// в один поток; в конце печатается пропускная способность по числу потоков.
+// Сборка под санитайзерами:
+//   gcc -g -fsanitize=thread -o stress_tests stress_tests.c filesystem.c compress.c dedup.c
+//       spill.c pagealloc.c reclaim.c counters.c usage.c -lpthread
+//   (или -fsanitize=address,undefined)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+#include "pagealloc.h"
+#include "usage.h"
+
+// Не больше MAX_FILES записей на каталог и MAX_INODES инод на всё дерево
+#define STRESS_DIRS 8
+#define STRESS_NAMES 64
+#define STRESS_WRITE_SIZE 6000
+// Файлов с данными в каждом каталоге до начала прогона
+#define STRESS_PREFILL 16
+#define STRESS_DEFAULT_MIX "create=10,lookup=20,read=50,write=10,rename=5,unlink=5"
+
+typedef enum StressOp{
+    STRESS_CREATE,
+    STRESS_LOOKUP,
+    STRESS_READ,
+    STRESS_WRITE,
+    STRESS_RENAME,
+    STRESS_UNLINK,
+    STRESS_NUM_OPS
+} StressOp;
+
+static const char *op_names[STRESS_NUM_OPS] = {"create", "lookup", "read", "write", "rename", "unlink"};
+
+typedef struct StressRun{
+    Filesystem *fs;
+    unsigned int weights[STRESS_NUM_OPS];
+    unsigned int total_weight;
+    unsigned long operations;   // на поток
+    unsigned long succeeded[STRESS_NUM_OPS];  // сумма по потокам, под lock
+    pthread_mutex_t lock;
+} StressRun;
+
+typedef struct StressThread{
+    StressRun *run;
+    unsigned int seed;
+    pthread_t thread;
+} StressThread;
+
+static void random_path(char *path, size_t size, unsigned int *seed) {
+    snprintf(path, size, "/d%u/f%u", rand_r(seed) % STRESS_DIRS, rand_r(seed) % STRESS_NAMES);
+}
+
+static StressOp pick_op(StressRun *run, unsigned int *seed) {
+    unsigned int value = rand_r(seed) % run->total_weight;
+    for (int op = 0; op < STRESS_NUM_OPS; op++) {
+        if (value < run->weights[op]) return op;
+        value -= run->weights[op];
+    }
+    return STRESS_LOOKUP;
+}
+
+static bool do_op(StressRun *run, StressOp op, unsigned int *seed, char *buf) {
+    Filesystem *fs = run->fs;
+    char path[64], new_path[64];
+    random_path(path, sizeof(path), seed);
+    bool ok = false;
+    switch (op) {
+    case STRESS_LOOKUP:
+        read_lock_filesystem(fs);
+        ok = get_inode_by_path(path, fs->inodes_list) != NULL;
+        unlock_filesystem(fs);
+        break;
+    case STRESS_READ: {
+        read_lock_filesystem(fs);
+        Inode *node = get_inode_by_path(path, fs->inodes_list);
+        ok = node && read_node(node, buf, STRESS_WRITE_SIZE, 0) >= 0;
+        unlock_filesystem(fs);
+        break;
+    }
+    case STRESS_CREATE:
+        write_lock_filesystem(fs);
+        ok = make_node(fs, path, S_IFREG | 0644, 0, 0) == 0;
+        unlock_filesystem(fs);
+        break;
+    case STRESS_WRITE: {
+        off_t offset = (rand_r(seed) % 4) * 4096;
+        write_lock_filesystem(fs);
+        Inode *node = get_inode_by_path(path, fs->inodes_list);
+        ok = node && write_node(node, buf, STRESS_WRITE_SIZE, offset) == STRESS_WRITE_SIZE;
+        unlock_filesystem(fs);
+        break;
+    }
+    case STRESS_RENAME:
+        random_path(new_path, sizeof(new_path), seed);
+        write_lock_filesystem(fs);
+        ok = rename_node(fs, path, new_path) == 0;
+        unlock_filesystem(fs);
+        break;
+    case STRESS_UNLINK:
+        write_lock_filesystem(fs);
+        ok = unlink_node(fs, path) == 0;
+        unlock_filesystem(fs);
+        break;
+    default:
+        break;
+    }
+    return ok;
+}
+
+static void* stress_thread(void *arg) {
+    StressThread *self = arg;
+    StressRun *run = self->run;
+    unsigned long succeeded[STRESS_NUM_OPS] = {0};
+    char *buf = malloc(STRESS_WRITE_SIZE);
+    memset(buf, 'a' + self->seed % 26, STRESS_WRITE_SIZE);
+    page_alloc_thread_cache(true);
+    for (unsigned long i = 0; i < run->operations; i++) {
+        StressOp op = pick_op(run, &self->seed);
+        if (do_op(run, op, &self->seed, buf)) succeeded[op]++;
+    }
+    page_alloc_thread_cache(false);
+    free(buf);
+    pthread_mutex_lock(&run->lock);
+    for (int op = 0; op < STRESS_NUM_OPS; op++) run->succeeded[op] += succeeded[op];
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+// Инварианты ------------------------------------------------------------------
+
+static int violations = 0;
+
+static void violation(const char *message, int node_number) {
+    if (violations++ < 20) printf("Ошибка: %s (инода %d)\n", message, node_number);
+}
+
+// Обход от корня: считает ссылки на каждую иноду и проверяет каталоги.
+// Возвращает место, занятое поддеревом, посчитанное заново
+static Usage walk_tree(Filesystem *fs, Inode *dir_node, int *references, bool *seen) {
+    Directory *dir = dir_node->data;
+    int live = 0, subdirs = 0;
+    Usage total = {0, 1};
+    for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+        live++;
+        const char *name = dir->entries[i].name;
+        Inode *child = get_inode_from_container(fs->inodes_list, dir->entries[i].node_number);
+        if (child == NULL) {
+            violation("Запись каталога указывает на отсутствующую иноду", dir->entries[i].node_number);
+            continue;
+        }
+        if (strcmp(name, ".") == 0) {
+            if (child != dir_node) violation("\".\" указывает не на сам каталог", dir_node->node_number);
+            continue;
+        }
+        if (strcmp(name, "..") == 0) {
+            if (child != dir_node->parent_node) violation("\"..\" не совпадает с parent_node", dir_node->node_number);
+            continue;
+        }
+        references[child->node_number]++;
+        if (!is_dir(child) && child->parent_node == dir_node) {
+            total.bytes += child->st->st_size;
+            total.inodes++;
+        }
+        if (is_dir(child)) {
+            subdirs++;
+            if (seen[child->node_number]) {
+                violation("Каталог встречается в дереве дважды", child->node_number);
+                continue;
+            }
+            seen[child->node_number] = true;
+            if (child->parent_node != dir_node) violation("parent_node каталога не его родитель", child->node_number);
+            Usage sub = walk_tree(fs, child, references, seen);
+            total.bytes += sub.bytes;
+            total.inodes += sub.inodes;
+        }
+    }
+    if (dir->usage.bytes != total.bytes || dir->usage.inodes != total.inodes) {
+        violation("Учёт места поддерева расходится с обходом", dir_node->node_number);
+    }
+    if (live != dir->num_entries) violation("num_entries не совпадает с числом записей", dir_node->node_number);
+    if ((int)dir_node->st->st_nlink != 2 + subdirs) violation("Число ссылок каталога неверно", dir_node->node_number);
+    if (dir->ordered) {
+        unsigned char order[MAX_FILES];
+        int count = sorted_entries(dir, order);
+        for (int i = 1; i < count; i++) {
+            if (strcmp(dir->entries[order[i - 1]].name, dir->entries[order[i]].name) >= 0) {
+                violation("Индекс имён не отсортирован", dir_node->node_number);
+                break;
+            }
+        }
+    }
+    return total;
+}
+
+static int check_invariants(Filesystem *fs) {
+    violations = 0;
+    int *references = calloc(MAX_INODES + 1, sizeof(int));
+    bool *seen = calloc(MAX_INODES + 1, sizeof(bool));
+    seen[fs->root->node_number] = true;
+    Usage total = walk_tree(fs, fs->root, references, seen);
+    // Все иноды в тесте принадлежат root
+    Usage owner = usage_of_uid(0);
+    if (owner.bytes != total.bytes || owner.inodes != total.inodes) {
+        violation("Учёт места владельца расходится с обходом", 0);
+    }
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = fs->inodes_list->inode_table[i];
+        bool allocated = !isInodeNumberFree(i, fs->inodes_numbers_tracker);
+        if (node == NULL) {
+            if (allocated) violation("Номер иноды занят, а иноды нет (утечка номера)", i);
+            continue;
+        }
+        if (!allocated) violation("Инода есть, а номер свободен", i);
+        if (node->node_number != i) violation("Номер иноды не совпадает с местом в таблице", i);
+        if (is_dir(node)) {
+            if (!seen[i]) violation("Каталог недостижим из корня", i);
+        } else {
+            // Открытых дескрипторов в тесте нет, так что без ссылок инода жить не должна
+            if (references[i] == 0) violation("Файл недостижим из корня", i);
+            if ((int)node->st->st_nlink != references[i]) violation("Число ссылок файла неверно", i);
+        }
+    }
+    free(references);
+    free(seen);
+    return violations;
+}
+
+// Прогон --------------------------------------------------------------------------
+
+static bool parse_mix(const char *mix, unsigned int weights[STRESS_NUM_OPS]) {
+    memset(weights, 0, STRESS_NUM_OPS * sizeof(unsigned int));
+    char *copy = strdup(mix);
+    bool ok = true;
+    for (char *item = strtok(copy, ","); item && ok; item = strtok(NULL, ",")) {
+        char *equals = strchr(item, '=');
+        ok = false;
+        for (int op = 0; equals && op < STRESS_NUM_OPS; op++) {
+            if (strncmp(item, op_names[op], equals - item) == 0 && op_names[op][equals - item] == '\0') {
+                weights[op] = strtoul(equals + 1, NULL, 10);
+                ok = true;
+            }
+        }
+    }
+    free(copy);
+    return ok;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Возвращает операций в секунду или -1, если нарушены инварианты
+static double stress_run(unsigned int weights[STRESS_NUM_OPS], unsigned int threads, unsigned long operations,
+                         bool ordered) {
+    StressRun run;
+    memset(&run, 0, sizeof(run));
+    run.fs = init_filesystem();
+    memcpy(run.weights, weights, sizeof(run.weights));
+    for (int op = 0; op < STRESS_NUM_OPS; op++) run.total_weight += weights[op];
+    run.operations = operations / threads;
+    pthread_mutex_init(&run.lock, NULL);
+    if (ordered) order_directory(run.fs, "/", true);
+    char *data = malloc(STRESS_WRITE_SIZE);
+    memset(data, 'p', STRESS_WRITE_SIZE);
+    for (int i = 0; i < STRESS_DIRS; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/d%d", i);
+        make_directory(run.fs, path, 0755, 0, 0);
+        // Чтения сразу попадают в страницы, а не в пустые имена
+        for (int j = 0; j < STRESS_PREFILL; j++) {
+            snprintf(path, sizeof(path), "/d%d/f%d", i, j);
+            make_node(run.fs, path, S_IFREG | 0644, 0, 0);
+            write_node(get_inode_by_path(path, run.fs->inodes_list), data, STRESS_WRITE_SIZE, 0);
+        }
+    }
+    free(data);
+
+    StressThread *workers = calloc(threads, sizeof(StressThread));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < threads; i++) {
+        workers[i].run = &run;
+        workers[i].seed = 12345 + i * 7919;
+        pthread_create(&workers[i].thread, NULL, stress_thread, &workers[i]);
+    }
+    for (unsigned int i = 0; i < threads; i++) pthread_join(workers[i].thread, NULL);
+    double seconds = elapsed_seconds(&start);
+
+    int found = check_invariants(run.fs);
+    printf("%2u потоков: %9.0f операций/с", threads, run.operations * threads / seconds);
+    for (int op = 0; op < STRESS_NUM_OPS; op++) {
+        if (weights[op]) printf(", %s %lu", op_names[op], run.succeeded[op]);
+    }
+    printf(found ? ", нарушений: %d\n" : "\n", found);
+    free(workers);
+    pthread_mutex_destroy(&run.lock);
+    destroy_filesystem(run.fs);
+    return found ? -1 : run.operations * threads / seconds;
+}
+
+int main(int argc, char **argv) {
+    unsigned int max_threads = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long operations = 200000;
+    const char *mix = STRESS_DEFAULT_MIX;
+    bool ordered = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:m:o")) != -1) {
+        if (opt == 't') max_threads = strtoul(optarg, NULL, 10);
+        else if (opt == 'n') operations = strtoul(optarg, NULL, 10);
+        else if (opt == 'm') mix = optarg;
+        else if (opt == 'o') ordered = true;
+        else {
+            fprintf(stderr, "Использование: %s [-t потоков] [-n операций] [-m доли] [-o]\n", argv[0]);
+            return 2;
+        }
+    }
+    unsigned int weights[STRESS_NUM_OPS];
+    if (!parse_mix(mix, weights) || max_threads == 0 || operations == 0) {
+        fprintf(stderr, "Ошибка: Неверные параметры нагрузки.\n");
+        return 2;
+    }
+    unsigned int total = 0;
+    for (int op = 0; op < STRESS_NUM_OPS; op++) total += weights[op];
+    if (total == 0) {
+        fprintf(stderr, "Ошибка: Все доли операций нулевые.\n");
+        return 2;
+    }
+
+    double throughput[32];
+    unsigned int counts[32];
+    int runs = 0;
+    bool failed = false;
+    for (unsigned int threads = 1; runs < 32; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        counts[runs] = threads;
+        throughput[runs] = stress_run(weights, threads, operations, ordered);
+        failed = failed || throughput[runs] < 0;
+        runs++;
+        if (threads == max_threads) break;
+    }
+
+    // Пропускная способность по числу потоков, относительно одного потока
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        if (throughput[i] > best) best = throughput[i];
+    }
+    printf("\nпотоки  операций/с  ускорение\n");
+    for (int i = 0; i < runs; i++) {
+        int width = best > 0 && throughput[i] > 0 ? (int)(40 * throughput[i] / best) : 0;
+        printf("%6u %11.0f %9.2fx  ", counts[i], throughput[i] > 0 ? throughput[i] : 0,
+               throughput[0] > 0 && throughput[i] > 0 ? throughput[i] / throughput[0] : 0);
+        for (int j = 0; j < width; j++) putchar('#');
+        putchar('\n');
+    }
+    if (failed) {
+        printf("Ошибка: Нагрузочный тест нашёл нарушения инвариантов\n");
+        return 1;
+    }
+    printf("Нагрузочный тест пройден успешно.\n");
+    return 0;
+}
@@ -1,4 +1,4 @@
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 28
 
 #include <ctype.h>
 #include <dirent.h>
@@ -7,6 +7,8 @@
 #include <fuse.h>
 #include <libgen.h>
 #include <limits.h>
+#include <malloc.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,16 +20,101 @@
 #endif
 
 #include "filesystem.h"
+#include "handle.h"
+#include "compress.h"
+#include "counters.h"
+#include "dedup.h"
+#include "export.h"
+#include "freeze.h"
+#include "journal.h"
+#include "pagealloc.h"
+#include "populate.h"
+#include "reclaim.h"
+#include "snapshot.h"
+#include "spill.h"
+#include "trace.h"
+#include "tmpfs_ioctl.h"
+#include "usage.h"
+#include "workers.h"
+
+// Параметры запуска, которые понимает сам демон (остальное уходит в fuse)
+typedef struct TmpfsOptions{
+    char *restore_image;
+    char *journal_path;
+    unsigned int journal_fsync_ms;
+    int dedup;
+    unsigned int compress_after;
+    char *spill_path;
+    unsigned int memory_limit_mb;
+    int huge_pages;
+    char *populate_dir;
+    unsigned int populate_threads;
+    unsigned int workers;
+    int pin_cpus;
+    int freeze;
+    char *trace_path;
+} TmpfsOptions;
+
+static struct fuse_opt tmpfs_opts[] = {
+    {"--restore=%s", offsetof(TmpfsOptions, restore_image), 0},
+    {"--journal=%s", offsetof(TmpfsOptions, journal_path), 0},
+    {"--journal-fsync=%u", offsetof(TmpfsOptions, journal_fsync_ms), 0},
+    {"--dedup", offsetof(TmpfsOptions, dedup), 1},
+    {"--compress-after=%u", offsetof(TmpfsOptions, compress_after), 0},
+    {"--spill=%s", offsetof(TmpfsOptions, spill_path), 0},
+    {"--memory-limit=%u", offsetof(TmpfsOptions, memory_limit_mb), 0},
+    {"--huge-pages", offsetof(TmpfsOptions, huge_pages), 1},
+    {"--populate=%s", offsetof(TmpfsOptions, populate_dir), 0},
+    {"--populate-threads=%u", offsetof(TmpfsOptions, populate_threads), 0},
+    {"--workers=%u", offsetof(TmpfsOptions, workers), 0},
+    {"--pin-cpus", offsetof(TmpfsOptions, pin_cpus), 1},
+    {"--freeze", offsetof(TmpfsOptions, freeze), 1},
+    {"--trace=%s", offsetof(TmpfsOptions, trace_path), 0},
+    FUSE_OPT_END
+};
+
+static TmpfsOptions options = {
+    .journal_fsync_ms = 1000,
+};
+// Открывается в tmp_init: поток журнала должен жить в процессе после fuse_daemonize
+static Journal* journal = NULL;
+static Compressor* compressor = NULL;
+// Абсолютный путь --restore: при --journal checkpoint пишет только туда
+static char restore_path[PATH_MAX];
+
+// Абсолютный путь без символических ссылок в каталогах; сам файл может
+// ещё не существовать
+static bool canonical_path(const char* path, char* out) {
+    char dir_copy[PATH_MAX], base_copy[PATH_MAX], dir[PATH_MAX];
+    if (strlen(path) >= PATH_MAX) return false;
+    strcpy(dir_copy, path);
+    strcpy(base_copy, path);
+    if (realpath(dirname(dir_copy), dir) == NULL) return false;
+    const char* base = basename(base_copy);
+    const char* slash = strcmp(dir, "/") == 0 ? "" : "/";
+    return (size_t)snprintf(out, PATH_MAX, "%s%s%s", dir, slash, base) < PATH_MAX;
+}
+
+// Вызывается после операции, когда блокировка уже отпущена: чтение тоже
+// добавляет страницы в память, а выгружать можно только под блокировкой записи
+static void enforce_memory_budget(Filesystem* fs) {
+    if (!spill_over_budget()) return;
+    write_lock_filesystem(fs);
+    spill_enforce_budget(fs);
+    unlock_filesystem(fs);
+}
 
 int tmp_getattr(const char *path, struct stat *statbuf)
 {
     Filesystem* fs = fuse_get_context()->private_data;
+    read_lock_filesystem(fs);
     Inode* node = get_inode_by_path(path, fs->inodes_list);
     if (node == NULL){
+        unlock_filesystem(fs);
         return -ENOENT;
     }
-    printf("getattr: node id: %d\n", node->node_number);
     memcpy(statbuf, node->st, sizeof(struct stat));
+    unlock_filesystem(fs);
     return 0;
 }
 
@@ -36,76 +123,27 @@ int tmp_mknod(const char *path, mode_t mode, dev_t dev)
 {
     struct fuse_context* ctx = fuse_get_context();
     Filesystem* fs = ctx->private_data;
-    int node_number = allocate_inode_number(fs->inodes_numbers_tracker);
-    
-    Inode* parent_dir_node = get_parent_directory(path, fs->inodes_list);
-    if (parent_dir_node == NULL) {
-        errno = ENOENT;
-        return -1;
-    }
-
-    const char* name = get_last_name(path);
-    Directory* parent_dir = parent_dir_node->data;
-    add_entry(parent_dir, name, node_number);
-
-    struct stat* st = malloc(sizeof(struct stat));
-    st->st_mode = mode;
-    st->st_nlink = 1;
-    st->st_ino = node_number;
-    st->st_uid = ctx->uid;
-    st->st_gid = ctx->gid;
-    Inode* node = init_inode(node_number, st, NULL, parent_dir_node);
-    if (node == NULL) {
-        errno = ENOMEM;
-        return -1;
+    write_lock_filesystem(fs);
+    int res = make_node(fs, path, mode, ctx->uid, ctx->gid);
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_MKNOD, path, NULL, mode, ctx->uid, ctx->gid, 0, NULL, 0);
     }
-    return 0;
+    unlock_filesystem(fs);
+    return res;
 }
 
 
 int tmp_mkdir(const char *path, mode_t mode)
-{   
-    printf("MKDIR: %s\n", path);
+{
     struct fuse_context* ctx = fuse_get_context();
     Filesystem* fs = ctx->private_data;
-    
-    struct stat* dir_stat = malloc(sizeof(struct stat));
-    if (dir_stat == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
-    dir_stat->st_mode = mode | __S_IFDIR;
-    dir_stat->st_uid = ctx->uid;
-    dir_stat->st_gid = ctx->gid;
-
-    Inode* parent_dir_node = get_parent_directory(path, fs->inodes_list);
-    if (parent_dir_node == NULL) {
-        errno = ENOENT;
-        return -1;
-    }
-    
-    Directory* dir_data = malloc(sizeof(Directory));
-    if (dir_data == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
-    int node_number = allocate_inode_number(fs->inodes_numbers_tracker);
-    if (node_number < 0) {
-        errno = ENOSPC;
-        return -1;
-    }
-    Inode* dir_node = init_inode(node_number, dir_stat, dir_data, parent_dir_node);
-    if (dir_node == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
-
-    add_entry(dir_data, ".", node_number);
-    dir_node->st->st_nlink++;
-    add_entry(dir_data, "..", node_number);
-    parent_dir_node->st->st_nlink++;
-
-    return 0;
+    write_lock_filesystem(fs);
+    int res = make_directory(fs, path, mode, ctx->uid, ctx->gid);
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_MKDIR, path, NULL, mode, ctx->uid, ctx->gid, 0, NULL, 0);
+    }
+    unlock_filesystem(fs);
+    return res;
 }
 
 
@@ -113,90 +151,128 @@ int tmp_mkdir(const char *path, mode_t mode)
 int tmp_link(const char *path, const char *newpath)
 {
     Filesystem* fs = fuse_get_context()->private_data;
-    Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (node == NULL) {
-        errno = ENOENT;
-        return -1;
-    }
-    if (is_dir(node)) {
-        errno = EPERM;
-        return -1;
+    write_lock_filesystem(fs);
+    int res = link_node(fs, path, newpath);
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_LINK, path, newpath, 0, 0, 0, 0, NULL, 0);
     }
-    if (!add_node_by_path(path, node, fs->inodes_list)) {
-        errno = EIO;
-        return -1;
-    }
-    return 0;
+    unlock_filesystem(fs);
+    return res;
 }
 
 
 int tmp_unlink(const char *path)
 {
     Filesystem* fs = fuse_get_context()->private_data;
-    Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (!node) {
-        errno = ENOENT;
-        return -1;
+    write_lock_filesystem(fs);
+    int res = unlink_node(fs, path);
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_UNLINK, path, NULL, 0, 0, 0, 0, NULL, 0);
     }
-    if (is_dir(node)) {
-        errno = EPERM; 
-        return -1;
-    }
-    if (node->nopen) {
-        errno = EBUSY;
-        return -1;
-    }
-    if (!remove_node_by_path(path, fs->inodes_list)) {
-        errno = EIO;
-        return -1;
-    }
-    return 0;
+    unlock_filesystem(fs);
+    return res;
 }
 
 int tmp_opendir(const char *path, struct fuse_file_info *fi)
 {
     Filesystem* fs = fuse_get_context()->private_data;
+    read_lock_filesystem(fs);
     Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (!node) return -ENOENT;
-    if (!is_dir(node)) return -ENOTDIR; 
-    fi->fh = (uint64_t)node;
-    return 0; 
+    int res = 0;
+    if (!node) res = -ENOENT;
+    else if (!is_dir(node)) res = -ENOTDIR;
+    else fi->fh = (uint64_t)node;
+    unlock_filesystem(fs);
+    return res;
 }
 
 
 int tmp_rmdir(const char *path)
 {
     Filesystem* fs = fuse_get_context()->private_data;
-    if (strcmp(path, "/") == 0) {
-        errno = EACCES; 
-        return -1;
+    write_lock_filesystem(fs);
+    int res = remove_directory(fs, path);
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_RMDIR, path, NULL, 0, 0, 0, 0, NULL, 0);
     }
-
-    Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (!node || !is_dir(node)) {
-        errno = ENOENT;
-        return -1;
+    unlock_filesystem(fs);
+    return res;
+}
+// relatime: чтение меняет atime, только если atime_stale, и тогда берёт
+// блокировку записи уже после основной работы. В журнал atime не пишется.
+static void update_atime(Filesystem* fs, Inode* node, const char* path) {
+    write_lock_filesystem(fs);
+    if (path) {
+        node = get_inode_by_path(path, fs->inodes_list);
     }
-
-    if (!remove_node_by_path(path, fs->inodes_list)) {
-        errno = EIO;
-        return -1;
+    if (node && atime_stale(node)) {
+        update_times(node, TIME_ATIME);
     }
+    unlock_filesystem(fs);
+}
 
-    return 0;
+// Смещение упорядоченного листинга описывает последнюю отданную запись:
+// слот, сколько раз его занимали, и позицию в индексе. Имя освобождённого
+// слота сохраняется, поэтому продолжение идёт сразу после него, даже если
+// запись удалили. Если слот успели занять заново - с сохранённой позиции.
+#define ORDER_COOKIE(generation, position, slot) \
+    (((off_t)(generation) << 16) | ((off_t)(position) << 8) | ((slot) + 1))
+
+static void fill_ordered(Directory* dir, void* buf, fuse_fill_dir_t filler, off_t offset) {
+    int position = 0;
+    if (offset > 0) {
+        int slot = (int)(offset & 0xFF) - 1;
+        int last = (int)((offset >> 8) & 0xFF);
+        uint32_t generation = (uint32_t)(offset >> 16);
+        if (slot >= 0 && slot < MAX_FILES && dir->entries[slot].generation == generation) {
+            const char* name = dir->entries[slot].name;
+            position = lower_bound_entry(dir, dir->order, dir->num_entries, name);
+            if (position < dir->num_entries && strcmp(dir->entries[dir->order[position]].name, name) == 0) {
+                position++;
+            }
+        } else {
+            position = last + 1;
+        }
+    }
+    for (; position < dir->num_entries; position++) {
+        int slot = dir->order[position];
+        off_t next = ORDER_COOKIE(dir->entries[slot].generation, position, slot);
+        if (filler(buf, dir->entries[slot].name, NULL, next)) {
+            break;
+        }
+    }
 }
+
 int tmp_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
 	       struct fuse_file_info *fi)
 {
     Filesystem* fs = fuse_get_context()->private_data;
+    read_lock_filesystem(fs);
+    // По пути, а не по fi->fh: открытый каталог не удерживает иноду от rmdir
     Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (!node) return -ENOENT;
-    if (!is_dir(node)) return -ENOTDIR;
+    if (!node || !is_dir(node)) {
+        unlock_filesystem(fs);
+        return node ? -ENOTDIR : -ENOENT;
+    }
 
     Directory* node_dir = node->data;
-
-    for (int i = 0; i < node_dir->num_entries; i++) {
-        filler(buf, node_dir->entries[i].name, NULL, 0);
+    if (node_dir->ordered) {
+        fill_ordered(node_dir, buf, filler, offset);
+    } else {
+        // Смещение - номер слота следующей записи: продолжение листинга
+        // начинается сразу с нужного места, без повторного прохода
+        int start = offset < MAX_FILES ? (int)offset : MAX_FILES;
+        for (int i = next_entry(node_dir, start); i >= 0; i = next_entry(node_dir, i + 1)) {
+            if (filler(buf, node_dir->entries[i].name, NULL, i + 1)) {
+                break;
+            }
+        }
+    }
+    bool stale = atime_stale(node);
+    unlock_filesystem(fs);
+    // Каталог могли удалить без блокировки, поэтому ищем его заново
+    if (stale) {
+        update_atime(fs, NULL, path);
     }
     return 0;
 }
@@ -209,153 +285,666 @@ int tmp_releasedir(const char *path, struct fuse_file_info *fi)
 
 int tmp_rename(const char *path, const char *newpath) {
     Filesystem* fs = fuse_get_context()->private_data;
+    write_lock_filesystem(fs);
+    int res = rename_node(fs, path, newpath);
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_RENAME, path, newpath, 0, 0, 0, 0, NULL, 0);
+    }
+    unlock_filesystem(fs);
+    return res;
+}
+
+int tmp_open(const char *path, struct fuse_file_info *fi) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    write_lock_filesystem(fs);
     Inode* node = get_inode_by_path(path, fs->inodes_list);
+    int res = 0;
     if (!node) {
-        errno = ENOENT;
-        return -1;
+        res = -ENOENT;
+    } else if (is_dir(node)) {
+        res = -EISDIR;
+    } else {
+        FileHandle* handle = open_handle(node, fi->flags);
+        if (handle == NULL) {
+            res = -ENOMEM;
+        } else {
+            fi->fh = (uint64_t)handle;
+        }
     }
+    unlock_filesystem(fs);
+    return res;
+}
 
-    if (strchr(newpath, '.') || strchr(path, '.')) {
-        errno = EINVAL;
-        return -1;
-    }
 
-    Inode* possible_node = get_inode_by_path(newpath, fs->inodes_list);
-    if (possible_node != NULL) {
-        errno = EEXIST;
-        return -1;
+int tmp_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    FileHandle* handle = (FileHandle*)fi->fh;
+    Inode* node = handle->node;
+    read_lock_filesystem(fs);
+    int res = read_node(node, buf, size, offset);
+    // Последовательному читателю следующие страницы готовим заранее
+    size_t window = res > 0 ? note_read(handle, offset, res) : 0;
+    if (window) {
+        count_readahead(prefetch_pages(node, (offset + res + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE, window));
     }
-    if (!move_node(path, newpath, fs->inodes_list)) {
-        errno = EIO;
-        return -1;
+    bool stale = res >= 0 && atime_stale(node);
+    unlock_filesystem(fs);
+    // Открытый файл не освободится до release
+    if (stale) {
+        update_atime(fs, node, NULL);
     }
+    enforce_memory_budget(fs);
+    if (res > 0) count_read(res);
+    return res;
+}
+
 
-    return 0; // Успех
+int tmp_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    FileHandle* handle = (FileHandle*)fi->fh;
+    write_lock_filesystem(fs);
+    // O_APPEND пишет в конец, известный только под блокировкой; смещение
+    // от ядра не проверяется, в журнал идёт фактическое
+    int res = handle->flags & O_APPEND ? append_node(handle->node, buf, size, &offset)
+                                       : write_node(handle->node, buf, size, offset);
+    if (res > 0 && journal) {
+        journal_append(journal, JOURNAL_WRITE, path, NULL, 0, 0, 0, offset, buf, res);
+    }
+    unlock_filesystem(fs);
+    enforce_memory_budget(fs);
+    if (res > 0) count_write(res);
+    return res;
 }
 
-int tmp_open(const char *path, struct fuse_file_info *fi) {
+
+int tmp_truncate(const char* path, off_t offset) {
     Filesystem* fs = fuse_get_context()->private_data;
+    write_lock_filesystem(fs);
     Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (!node) {
-        errno = ENOENT; 
-        return -1;
+    int res = node ? truncate_node(node, offset) : -ENOENT;
+    if (res == 0 && journal) {
+        journal_append(journal, JOURNAL_TRUNCATE, path, NULL, 0, 0, 0, offset, NULL, 0);
     }
-    if (is_dir(node)) {
-        errno = EISDIR;
-        return -1;
+    unlock_filesystem(fs);
+    return res;
+}
+
+
+int tmp_utimens(const char* path, const struct timespec tv[2]) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    write_lock_filesystem(fs);
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    int res = node ? set_node_times(node, tv) : -ENOENT;
+    // В журнал идут итоговые значения, чтобы UTIME_NOW не пересчитывался
+    if (res == 0 && journal) {
+        struct timespec times[2] = {node->st->st_atim, node->st->st_mtim};
+        journal_append(journal, JOURNAL_UTIMENS, path, NULL, 0, 0, 0, 0, times, sizeof(times));
     }
-    node->nopen++;
-    fi->fh = (uint64_t)node;
-    return 0;
+    unlock_filesystem(fs);
+    return res;
 }
 
 
-int tmp_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    Inode* node = (Inode*)fi->fh;
-    if (!node->nopen) {
-        errno = EBADF;
-        return -1;
+int tmp_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    Inode* node = ((FileHandle*)fi->fh)->node;
+    write_lock_filesystem(fs);
+    int res = fallocate_node(node, mode, offset, length);
+    if (res == 0 && journal) {
+        uint64_t size = length;
+        journal_append(journal, JOURNAL_FALLOCATE, path, NULL, mode, 0, 0, offset, &size, sizeof(size));
     }
+    unlock_filesystem(fs);
+    enforce_memory_budget(fs);
+    return res;
+}
+
 
-    if (is_dir(node)) {
-        errno = EISDIR;
-        return -1;
+int tmp_release(const char *path, struct fuse_file_info *fi) {
+    Filesystem* fs = fuse_get_context()->private_data; 
+    FileHandle* handle = (FileHandle*)fi->fh;
+    Inode* node = handle->node;
+    write_lock_filesystem(fs);
+    if (close_handle(handle)) {
+        release_inode(fs, node);
+    } else if (options.dedup) {
+        // Файл обычно дописан к закрытию: новые страницы сверяем с индексом
+        dedup_node(node);
     }
+    unlock_filesystem(fs);
+    return 0;
+}
 
-    if (offset + size > node->st->st_size) {
-        size = node->st->st_size - offset;
-        if (size <= 0) {
-            return 0;
+// FICLONE и copy_file_range ядро до демона на fuse 2 не доводит, поэтому
+// клонирование делается отдельной командой
+static int clone_by_path(Filesystem* fs, struct tmpfs_ioc_clone* request) {
+    struct fuse_context* ctx = fuse_get_context();
+    request->src[sizeof(request->src) - 1] = '\0';
+    request->dst[sizeof(request->dst) - 1] = '\0';
+    Inode* src = get_inode_by_path(request->src, fs->inodes_list);
+    if (!src) return -ENOENT;
+    if (!is_file(src)) return -EINVAL;
+
+    Inode* dst = get_inode_by_path(request->dst, fs->inodes_list);
+    if (!dst && request->length == 0) {
+        int res = make_node(fs, request->dst, src->st->st_mode, ctx->uid, ctx->gid);
+        if (res != 0) return res;
+        if (journal) {
+            journal_append(journal, JOURNAL_MKNOD, request->dst, NULL, src->st->st_mode,
+                           ctx->uid, ctx->gid, 0, NULL, 0);
         }
+        dst = get_inode_by_path(request->dst, fs->inodes_list);
     }
-    memcpy(buf, (char*)node->data + offset, size);
-    return (int)size;
-}   
-
+    if (!dst) return -ENOENT;
+    if (!is_file(dst)) return -EINVAL;
 
-int tmp_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    Inode* node = (Inode*)fi->fh;
-    if (!node->nopen) {
-        errno = EBADF;
-        return -1;
-    }
-    if (is_dir(node)) {
-        errno = EISDIR;
-        return -1;
-    }
-    if (offset + size > node->st->st_size) {
-        char* data = realloc(node->data, offset + size);
-        if (!data) {
-            errno = ENOMEM;
-            return -1;
+    int res;
+    if (request->length == 0) {
+        res = clone_node(src, dst);
+    } else {
+        res = copy_node_range(src, request->src_offset, dst, request->dst_offset, request->length);
+        if (res >= 0) {
+            request->length = res;
+            res = 0;
         }
-        node->data = data;
-        node->st->st_size = (off_t)(size + offset);
     }
-    memcpy((char*)node->data + offset, buf, size);
-    return (int)size;
+    if (res == 0 && journal) {
+        JournalCloneArgs args = {request->src_offset, request->dst_offset, request->length};
+        journal_append(journal, JOURNAL_CLONE, request->src, request->dst, 0, 0, 0, 0, &args, sizeof(args));
+    }
+    return res;
 }
 
+static void fill_stats(Filesystem* fs, struct tmpfs_ioc_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode* node = fs->inodes_list->inode_table[i];
+        if (!node) continue;
+        stats->inodes++;
+        if (is_file(node)) stats->data_bytes += node->st->st_size;
+    }
+    stats->page_size = FILE_PAGE_SIZE;
+    stats->pages = data_stats.pages;
+    stats->mapped_pages = data_stats.mapped_pages;
+    stats->page_refs = data_stats.page_refs;
+    stats->dedup_indexed = dedup_stats.indexed_pages;
+    stats->dedup_merged = dedup_stats.merged_pages;
+    stats->dedup_zero = dedup_stats.zero_pages;
+    stats->compressed_pages = data_stats.compressed_pages;
+    stats->compressed_bytes = data_stats.compressed_bytes;
+    stats->cached_pages = data_stats.cached_pages;
+    stats->resident_pages = data_stats.pages - data_stats.spilled_pages;
+    stats->spilled_pages = data_stats.spilled_pages;
+    stats->heap_bytes = data_heap_bytes();
+    stats->memory_limit = spill_stats.memory_limit;
+    stats->spill_evictions = spill_stats.evictions;
+    stats->spill_page_ins = spill_stats.page_ins;
+    stats->arena_bytes = page_alloc_stats.chunks * PAGE_CHUNK_SIZE;
+    stats->arena_free_pages = page_alloc_stats.free_pages;
+    stats->reclaim_pending_files = reclaim_stats.pending_files;
+    stats->reclaim_pending_pages = reclaim_stats.pending_pages;
+    OpCounters counters;
+    counters_sum(&counters);
+    stats->reads = counters.reads;
+    stats->read_bytes = counters.read_bytes;
+    stats->writes = counters.writes;
+    stats->write_bytes = counters.write_bytes;
+    stats->lookups = counters.lookups;
+    stats->lookup_hits = counters.lookup_hits;
+    stats->readahead_pages = counters.readahead_pages;
+}
 
-int tmp_truncate(const char* path, off_t offset) {
-    Filesystem* fs = fuse_get_context()->private_data;
-    Inode* node = get_inode_by_path(path, fs->inodes_list);
-    if (!node->nopen) {
-        errno = EBADF;
-        return -1;
-    }
-    if (is_dir(node)) {
-        errno = EISDIR;
-        return -1;
-    }
-    if (offset == 0) {
-        if (node->data) {
-            free(node->data);
-            node->data = NULL;
+// Следующий путь пакета или NULL, если строка не завершена внутри buf
+static const char* next_batch_path(const char* buf, size_t* used) {
+    const char* path = buf + *used;
+    const char* end = memchr(path, '\0', TMPFS_IOC_BATCH_SIZE - *used);
+    if (end == NULL) return NULL;
+    *used += end - path + 1;
+    return path;
+}
+
+static int create_batch(Filesystem* fs, struct tmpfs_ioc_batch* batch) {
+    struct fuse_context* ctx = fuse_get_context();
+    size_t used = 0;
+    batch->done = 0;
+    batch->error = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const char* entry = next_batch_path(batch->buf, &used);
+        if (entry == NULL) return -EINVAL;
+        char path[TMPFS_IOC_PATH_MAX];
+        size_t length = strlen(entry);
+        bool directory = length > 1 && entry[length - 1] == '/';
+        if (directory) length--;
+        if (length >= sizeof(path)) {
+            batch->error = ENAMETOOLONG;
+            return 0;
         }
-    } else {
-        char* data = realloc(node->data, offset);
-        if (!data) {
-            errno = ENOMEM;
-            return -1;
+        memcpy(path, entry, length);
+        path[length] = '\0';
+
+        mode_t mode = batch->mode ? batch->mode & 07777 : (directory ? 0755 : 0644);
+        if (!directory) mode |= S_IFREG;
+        int res = directory ? make_directory(fs, path, mode, ctx->uid, ctx->gid)
+                            : make_node(fs, path, mode, ctx->uid, ctx->gid);
+        if (res != 0) {
+            batch->error = -res;
+            return 0;
+        }
+        if (journal) {
+            journal_append(journal, directory ? JOURNAL_MKDIR : JOURNAL_MKNOD, path, NULL, mode,
+                           ctx->uid, ctx->gid, 0, NULL, 0);
         }
-        node->data = data;
+        batch->done++;
     }
-    if (offset > node->st->st_size) {
-        memset(node->data + node->st->st_size, 0, offset - node->st->st_size);
+    return 0;
+}
+
+static int stat_batch(Filesystem* fs, struct tmpfs_ioc_batch* batch) {
+    if (batch->count > TMPFS_IOC_STAT_MAX) return -EINVAL;
+    // Ответ пишется поверх путей, поэтому они читаются из копии
+    char* paths = malloc(TMPFS_IOC_BATCH_SIZE);
+    if (paths == NULL) return -ENOMEM;
+    memcpy(paths, batch->buf, TMPFS_IOC_BATCH_SIZE);
+    struct tmpfs_ioc_stat_entry* entries = (struct tmpfs_ioc_stat_entry*)batch->buf;
+    size_t used = 0;
+    batch->done = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const char* path = next_batch_path(paths, &used);
+        if (path == NULL) {
+            free(paths);
+            return -EINVAL;
+        }
+        Inode* node = get_inode_by_path(path, fs->inodes_list);
+        memset(&entries[i], 0, sizeof(entries[i]));
+        if (node == NULL) {
+            entries[i].error = ENOENT;
+            continue;
+        }
+        entries[i].mode = node->st->st_mode;
+        entries[i].ino = node->st->st_ino;
+        entries[i].nlink = node->st->st_nlink;
+        entries[i].size = node->st->st_size;
+        entries[i].uid = node->st->st_uid;
+        entries[i].gid = node->st->st_gid;
+        batch->done++;
     }
-    node->st->st_size = (off_t)offset;
+    free(paths);
     return 0;
 }
 
+static int scan_directory(Filesystem* fs, struct tmpfs_ioc_scan* request) {
+    request->dir[sizeof(request->dir) - 1] = '\0';
+    request->start[sizeof(request->start) - 1] = '\0';
+    request->end[sizeof(request->end) - 1] = '\0';
+    request->prefix[sizeof(request->prefix) - 1] = '\0';
+    Inode* node = get_inode_by_path(request->dir, fs->inodes_list);
+    if (!node) return -ENOENT;
+    if (!is_dir(node)) return -ENOTDIR;
 
-int tmp_release(const char *path, struct fuse_file_info *fi) {
-    Filesystem* fs = fuse_get_context()->private_data; 
-    Inode* node = (Inode*)fi->fh;
-    if (!node->nopen) {
-        errno = EBADF;
-        return -1;
-    }
-    if (--node->nopen == 0 && node->st->st_nlink == 0) {
-        if (!remove_node_by_path(path, fs->inodes_list)) {
-            errno = EIO;
-            return -1;
+    Directory* dir = node->data;
+    unsigned char order[MAX_FILES];
+    int count = sorted_entries(dir, order);
+    // Всё подходящее лежит подряд, начиная с большей из нижних границ
+    const char* from = strcmp(request->start, request->prefix) > 0 ? request->start : request->prefix;
+    size_t prefix_length = strlen(request->prefix);
+    size_t used = 0;
+    request->count = 0;
+    request->more = 0;
+    for (int i = lower_bound_entry(dir, order, count, from); i < count; i++) {
+        const char* name = dir->entries[order[i]].name;
+        if (strncmp(name, request->prefix, prefix_length) != 0
+            || (request->end[0] && strcmp(name, request->end) >= 0)) {
+            break;
+        }
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        size_t length = strlen(name) + 1;
+        if (used + length > sizeof(request->buf)) {
+            request->more = 1;
+            break;
         }
+        memcpy(request->buf + used, name, length);
+        used += length;
+        request->count++;
     }
     return 0;
 }
 
+static int handle_ioctl(Filesystem* fs, unsigned int cmd, void *data) {
+    switch (cmd) {
+    case TMPFS_IOC_CLONE:
+        return clone_by_path(fs, data);
+    case TMPFS_IOC_STATS:
+        fill_stats(fs, data);
+        return 0;
+    case TMPFS_IOC_DEDUP:
+        dedup_tree(fs);
+        return 0;
+    case TMPFS_IOC_RMTREE: {
+        struct tmpfs_ioc_path* request = data;
+        request->path[TMPFS_IOC_PATH_MAX - 1] = '\0';
+        int res = remove_tree(fs, request->path);
+        if (res == 0 && journal) {
+            journal_append(journal, JOURNAL_RMTREE, request->path, NULL, 0, 0, 0, 0, NULL, 0);
+        }
+        return res;
+    }
+    case TMPFS_IOC_CREATE:
+        return create_batch(fs, data);
+    case TMPFS_IOC_STAT:
+        return stat_batch(fs, data);
+    case TMPFS_IOC_ORDER: {
+        struct tmpfs_ioc_order* request = data;
+        request->path[sizeof(request->path) - 1] = '\0';
+        int res = order_directory(fs, request->path, request->ordered != 0);
+        if (res == 0 && journal) {
+            journal_append(journal, JOURNAL_ORDER, request->path, NULL, request->ordered != 0,
+                           0, 0, 0, NULL, 0);
+        }
+        return res;
+    }
+    case TMPFS_IOC_SCAN:
+        return scan_directory(fs, data);
+    default:
+        return -ENOTTY;
+    }
+}
+
+// checkpoint и export создают и перезаписывают файлы хоста с правами
+// демона. С allow_other открыть файл на точке монтирования может любой
+// пользователь, поэтому такие команды принимаются только от владельца
+// демона или root.
+static bool caller_owns_daemon(void) {
+    uid_t uid = fuse_get_context()->uid;
+    return uid == 0 || uid == getuid();
+}
+
+// Образ пишется без блокировки fs (см. snapshot.h); два checkpoint
+// одновременно писали бы в один временный файл
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int checkpoint_by_path(Filesystem* fs, struct tmpfs_ioc_path* request) {
+    request->path[TMPFS_IOC_PATH_MAX - 1] = '\0';
+    // Журнал очищается, и следующий запуск воспроизведёт его поверх
+    // --restore, поэтому образ в другом месте потерял бы изменения
+    char target[PATH_MAX];
+    if (journal && (!canonical_path(request->path, target) || strcmp(target, restore_path) != 0)) {
+        fprintf(stderr, "Ошибка: С --journal образ сохраняется только в файл --restore (%s).\n",
+                restore_path[0] ? restore_path : "не задан");
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&checkpoint_lock);
+    write_lock_filesystem(fs);
+    SnapshotCapture* capture = capture_snapshot(fs);
+    // Всё до mark попадёт в образ, всё после - нет: операции пишут журнал
+    // под той же блокировкой
+    uint64_t mark = journal ? journal_mark(journal) : 0;
+    unlock_filesystem(fs);
+    int res = capture ? 0 : -ENOMEM;
+    if (res == 0 && !write_snapshot(fs, capture, request->path)) res = -EIO;
+    release_capture(fs, capture);
+    // Журнал дальше ведётся поверх только что сохранённого образа
+    if (res == 0 && journal && !journal_discard(journal, mark)) res = -EIO;
+    pthread_mutex_unlock(&checkpoint_lock);
+    return res;
+}
+
+// Архив пишет демон сам, минуя FUSE; файл открывается с его правами
+static int export_by_path(Filesystem* fs, struct tmpfs_ioc_export* request) {
+    request->src[sizeof(request->src) - 1] = '\0';
+    request->dst[sizeof(request->dst) - 1] = '\0';
+    int fd = open(request->dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -errno;
+    }
+    int res = export_tar(fs, request->src, fd, &request->bytes);
+    if (close(fd) != 0 && res == 0) {
+        res = -errno;
+    }
+    return res;
+}
+
+int tmp_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+              unsigned int flags, void *data) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    if (flags & FUSE_IOCTL_COMPAT) {
+        return -ENOSYS;
+    }
+    if (((unsigned int)cmd == TMPFS_IOC_EXPORT || (unsigned int)cmd == TMPFS_IOC_CHECKPOINT)
+        && !caller_owns_daemon()) {
+        return -EPERM;
+    }
+    // Выгрузка и образ долгие, блокировку они берут сами и ненадолго
+    if ((unsigned int)cmd == TMPFS_IOC_EXPORT) {
+        return export_by_path(fs, data);
+    }
+    if ((unsigned int)cmd == TMPFS_IOC_CHECKPOINT) {
+        return checkpoint_by_path(fs, data);
+    }
+    // Команды, которые только читают дерево, не мешают колбэкам
+    if ((unsigned int)cmd == TMPFS_IOC_STATS || (unsigned int)cmd == TMPFS_IOC_STAT
+        || (unsigned int)cmd == TMPFS_IOC_SCAN) {
+        read_lock_filesystem(fs);
+    } else {
+        write_lock_filesystem(fs);
+    }
+    int res = handle_ioctl(fs, (unsigned int)cmd, data);
+    unlock_filesystem(fs);
+    enforce_memory_budget(fs);
+    return res;
+}
+
+// Учёт места ----------------------------------------------------------------------
+// Атрибуты user.tmpfs.* (см. usage.h)
+int tmp_getxattr(const char *path, const char *name, char *value, size_t size) {
+    Filesystem* fs = fuse_get_context()->private_data;
+    read_lock_filesystem(fs);
+    Inode* node = get_inode_by_path(path, fs->inodes_list);
+    int res = node ? usage_xattr(node, name, value, size) : -ENOENT;
+    unlock_filesystem(fs);
+    return res;
+}
+
+// Файловая система создаётся в main до монтирования и приходит сюда через user_data
 void* tmp_init(struct fuse_conn_info *conn) {
-    Filesystem* fs = init_filesystem();
+    if (conn->capable & FUSE_CAP_IOCTL_DIR) {
+        conn->want |= FUSE_CAP_IOCTL_DIR;
+    }
+    if (options.journal_path) {
+        journal = journal_open(options.journal_path, options.journal_fsync_ms);
+    }
+    Filesystem* fs = fuse_get_context()->private_data;
+    if (options.compress_after) {
+        compressor = compressor_start(fs, options.compress_after);
+    }
+    reclaimer_start(fs);
     return fs;
 }
 
 void tmp_destroy(void *userdata) {
-    Filesystem* fs = fuse_get_context()->private_data;
-    // TODO нужно рекурсивно пройти по fs;
-    free(fs);
+    Filesystem* fs = userdata;
+    if (compressor) {
+        compressor_stop(compressor);
+        compressor = NULL;
+    }
+    if (journal) {
+        journal_close(journal);
+        journal = NULL;
+    }
+    // Буферы страниц отдаются системе целыми кусками, дальше освобождаются
+    // только описатели страниц и инод
+    page_alloc_release();
+    reclaimer_stop();
+    release_snapshot(fs);
+    destroy_filesystem(fs);
+    spill_close();
+}
+
+
+// Замороженный режим --------------------------------------------------------------
+// С --freeze заполненное дерево упаковывается в FrozenFs до монтирования,
+// изменяемое освобождается, и запросы обслуживают эти колбэки: без
+// блокировок, всё, что меняет дерево, - EROFS. Точка монтирования ещё и
+// только для чтения, так что большую часть записей отсекает ядро.
+
+static int frz_getattr(const char *path, struct stat *statbuf) {
+    FrozenFs* frozen = fuse_get_context()->private_data;
+    int node = frozen_lookup(frozen, path);
+    if (node < 0) {
+        return node;
+    }
+    frozen_stat(frozen, node, statbuf);
+    return 0;
+}
+
+static int frz_open(const char *path, struct fuse_file_info *fi) {
+    FrozenFs* frozen = fuse_get_context()->private_data;
+    int node = frozen_lookup(frozen, path);
+    if (node < 0) {
+        return node;
+    }
+    if (S_ISDIR(frozen->inodes[node].mode)) {
+        return -EISDIR;
+    }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC)) {
+        return -EROFS;
+    }
+    fi->fh = (uint64_t)node;
+    // Данные не меняются, кэш страниц ядра можно не сбрасывать
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static int frz_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    FrozenFs* frozen = fuse_get_context()->private_data;
+    int res = frozen_read(frozen, (uint32_t)fi->fh, buf, size, offset);
+    if (res > 0) {
+        count_read(res);
+    }
+    return res;
+}
+
+static int frz_opendir(const char *path, struct fuse_file_info *fi) {
+    FrozenFs* frozen = fuse_get_context()->private_data;
+    int node = frozen_lookup(frozen, path);
+    if (node < 0) {
+        return node;
+    }
+    if (!S_ISDIR(frozen->inodes[node].mode)) {
+        return -ENOTDIR;
+    }
+    fi->fh = (uint64_t)node;
+    return 0;
+}
+
+// Смещения: 1 - ".", 2 - "..", дальше номер записи + 3
+static int frz_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                       struct fuse_file_info *fi) {
+    FrozenFs* frozen = fuse_get_context()->private_data;
+    uint32_t dir = (uint32_t)fi->fh;
+    if (offset < 1 && filler(buf, ".", NULL, 1)) {
+        return 0;
+    }
+    if (offset < 2 && filler(buf, "..", NULL, 2)) {
+        return 0;
+    }
+    uint32_t node;
+    const char* name;
+    for (uint32_t i = offset > 2 ? (uint32_t)(offset - 2) : 0; (name = frozen_entry(frozen, dir, i, &node)); i++) {
+        if (filler(buf, name, NULL, i + 3)) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int frz_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+                     unsigned int flags, void *data) {
+    switch ((unsigned int)cmd) {
+    case TMPFS_IOC_STATS:
+        break;
+    case TMPFS_IOC_CHECKPOINT:
+    case TMPFS_IOC_RMTREE:
+    case TMPFS_IOC_CREATE:
+    case TMPFS_IOC_CLONE:
+    case TMPFS_IOC_ORDER:
+        return -EROFS;
+    default:
+        return -ENOTTY;
+    }
+    FrozenFs* frozen = fuse_get_context()->private_data;
+    struct tmpfs_ioc_stats* stats = data;
+    memset(stats, 0, sizeof(*stats));
+    stats->inodes = frozen->num_inodes;
+    stats->data_bytes = frozen->files_size;
+    stats->page_size = FILE_PAGE_SIZE;
+    stats->frozen_bytes = frozen_memory(frozen);
+    OpCounters counters;
+    counters_sum(&counters);
+    stats->reads = counters.reads;
+    stats->read_bytes = counters.read_bytes;
+    return 0;
+}
+
+static int frz_mknod(const char *path, mode_t mode, dev_t dev) { return -EROFS; }
+static int frz_mkdir(const char *path, mode_t mode) { return -EROFS; }
+static int frz_unlink(const char *path) { return -EROFS; }
+static int frz_rmdir(const char *path) { return -EROFS; }
+static int frz_rename(const char *path, const char *newpath) { return -EROFS; }
+static int frz_link(const char *path, const char *newpath) { return -EROFS; }
+static int frz_truncate(const char *path, off_t offset) { return -EROFS; }
+static int frz_utimens(const char *path, const struct timespec tv[2]) { return -EROFS; }
+static int frz_write(const char *path, const char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi) { return -EROFS; }
+static int frz_fallocate(const char *path, int mode, off_t offset, off_t length,
+                         struct fuse_file_info *fi) { return -EROFS; }
+
+static void* frz_init(struct fuse_conn_info *conn) {
+    if (conn->capable & FUSE_CAP_IOCTL_DIR) {
+        conn->want |= FUSE_CAP_IOCTL_DIR;
+    }
+    return fuse_get_context()->private_data;
+}
+
+static void frz_destroy(void *userdata) {
+    destroy_frozen(userdata);
 }
 
+static struct fuse_operations frozen_operations = {
+    .getattr = frz_getattr,
+    .mknod = frz_mknod,
+    .mkdir = frz_mkdir,
+    .unlink = frz_unlink,
+    .rmdir = frz_rmdir,
+    .rename = frz_rename,
+    .link = frz_link,
+    .open = frz_open,
+    .read = frz_read,
+    .write = frz_write,
+    .truncate = frz_truncate,
+    .utimens = frz_utimens,
+    .fallocate = frz_fallocate,
+    .opendir = frz_opendir,
+    .readdir = frz_readdir,
+    .ioctl = frz_ioctl,
+    .init = frz_init,
+    .destroy = frz_destroy,
+    .flag_utime_omit_ok = 1,
+};
+
+// Упаковывает fs и освобождает её вместе со страницами данных
+static FrozenFs* freeze_and_release(Filesystem* fs) {
+    FrozenFs* frozen = freeze_filesystem(fs);
+    if (frozen == NULL) {
+        fprintf(stderr, "Ошибка: Не удалось заморозить файловую систему.\n");
+        return NULL;
+    }
+    // Отображение образа забрала замороженная копия
+    destroy_filesystem(fs);
+    page_alloc_release();
+    spill_close();
+    malloc_trim(0);
+    return frozen;
+}
 
 struct fuse_operations operations = {
     .getattr = tmp_getattr,
@@ -370,16 +959,274 @@ struct fuse_operations operations = {
     .write = tmp_write,
     .release = tmp_release,
     .truncate = tmp_truncate,
+    .utimens = tmp_utimens,
+    .fallocate = tmp_fallocate,
     .opendir = tmp_opendir,
     .readdir = tmp_readdir,
     .releasedir = tmp_releasedir,
+    .ioctl = tmp_ioctl,
+    .getxattr = tmp_getxattr,
     .init = tmp_init,
-    .destroy = tmp_destroy
+    .destroy = tmp_destroy,
+    // UTIME_NOW и UTIME_OMIT доходят до tmp_utimens как есть
+    .flag_utime_omit_ok = 1,
 };
 
 
+// Трассировка ---------------------------------------------------------------------
+// С --trace колбэки выбранной таблицы (обычной или замороженной)
+// вызываются через обёртки, которые записывают запрос в трассу.
+// Без --trace обёрток на пути запроса нет.
+
+static struct fuse_operations traced;
+
+static int trc_getattr(const char *path, struct stat *statbuf) {
+    uint64_t start = trace_clock();
+    int res = traced.getattr(path, statbuf);
+    trace_record(TRACE_GETATTR, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_mknod(const char *path, mode_t mode, dev_t dev) {
+    uint64_t start = trace_clock();
+    int res = traced.mknod(path, mode, dev);
+    trace_record(TRACE_MKNOD, path, NULL, 0, 0, mode, start, res);
+    return res;
+}
+
+static int trc_mkdir(const char *path, mode_t mode) {
+    uint64_t start = trace_clock();
+    int res = traced.mkdir(path, mode);
+    trace_record(TRACE_MKDIR, path, NULL, 0, 0, mode, start, res);
+    return res;
+}
+
+static int trc_unlink(const char *path) {
+    uint64_t start = trace_clock();
+    int res = traced.unlink(path);
+    trace_record(TRACE_UNLINK, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_rmdir(const char *path) {
+    uint64_t start = trace_clock();
+    int res = traced.rmdir(path);
+    trace_record(TRACE_RMDIR, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_rename(const char *path, const char *newpath) {
+    uint64_t start = trace_clock();
+    int res = traced.rename(path, newpath);
+    trace_record(TRACE_RENAME, path, newpath, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_link(const char *path, const char *newpath) {
+    uint64_t start = trace_clock();
+    int res = traced.link(path, newpath);
+    trace_record(TRACE_LINK, path, newpath, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_open(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.open(path, fi);
+    trace_record(TRACE_OPEN, path, NULL, 0, 0, fi->flags, start, res);
+    return res;
+}
+
+static int trc_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.read(path, buf, size, offset, fi);
+    trace_record(TRACE_READ, path, NULL, offset, size, 0, start, res);
+    return res;
+}
+
+static int trc_write(const char *path, const char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.write(path, buf, size, offset, fi);
+    trace_record(TRACE_WRITE, path, NULL, offset, size, 0, start, res);
+    return res;
+}
+
+static int trc_release(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.release(path, fi);
+    trace_record(TRACE_RELEASE, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_truncate(const char *path, off_t offset) {
+    uint64_t start = trace_clock();
+    int res = traced.truncate(path, offset);
+    trace_record(TRACE_TRUNCATE, path, NULL, offset, 0, 0, start, res);
+    return res;
+}
+
+static int trc_utimens(const char *path, const struct timespec tv[2]) {
+    uint64_t start = trace_clock();
+    int res = traced.utimens(path, tv);
+    trace_record(TRACE_UTIMENS, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_fallocate(const char *path, int mode, off_t offset, off_t length,
+                         struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.fallocate(path, mode, offset, length, fi);
+    trace_record(TRACE_FALLOCATE, path, NULL, offset, length, mode, start, res);
+    return res;
+}
+
+static int trc_opendir(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.opendir(path, fi);
+    trace_record(TRACE_OPENDIR, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                       struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.readdir(path, buf, filler, offset, fi);
+    trace_record(TRACE_READDIR, path, NULL, offset, 0, 0, start, res);
+    return res;
+}
+
+static int trc_releasedir(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = trace_clock();
+    int res = traced.releasedir(path, fi);
+    trace_record(TRACE_RELEASEDIR, path, NULL, 0, 0, 0, start, res);
+    return res;
+}
+
+static int trc_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+                     unsigned int flags, void *data) {
+    uint64_t start = trace_clock();
+    int res = traced.ioctl(path, cmd, arg, fi, flags, data);
+    trace_record(TRACE_IOCTL, path, NULL, 0, 0, (uint32_t)cmd, start, res);
+    return res;
+}
+
+// Имя атрибута пишется вторым путём
+static int trc_getxattr(const char *path, const char *name, char *value, size_t size) {
+    uint64_t start = trace_clock();
+    int res = traced.getxattr(path, name, value, size);
+    trace_record(TRACE_GETXATTR, path, name, 0, size, 0, start, res);
+    return res;
+}
+
+static void trc_destroy(void *userdata) {
+    if (traced.destroy) {
+        traced.destroy(userdata);
+    }
+    trace_close();
+}
+
+// Таблица с обёртками вокруг ops; отсутствующие колбэки остаются пустыми
+static struct fuse_operations* traced_operations(struct fuse_operations* ops) {
+    static struct fuse_operations tracing;
+    traced = *ops;
+    tracing = *ops;
+    if (ops->getattr) tracing.getattr = trc_getattr;
+    if (ops->mknod) tracing.mknod = trc_mknod;
+    if (ops->mkdir) tracing.mkdir = trc_mkdir;
+    if (ops->unlink) tracing.unlink = trc_unlink;
+    if (ops->rmdir) tracing.rmdir = trc_rmdir;
+    if (ops->rename) tracing.rename = trc_rename;
+    if (ops->link) tracing.link = trc_link;
+    if (ops->open) tracing.open = trc_open;
+    if (ops->read) tracing.read = trc_read;
+    if (ops->write) tracing.write = trc_write;
+    if (ops->release) tracing.release = trc_release;
+    if (ops->truncate) tracing.truncate = trc_truncate;
+    if (ops->utimens) tracing.utimens = trc_utimens;
+    if (ops->fallocate) tracing.fallocate = trc_fallocate;
+    if (ops->opendir) tracing.opendir = trc_opendir;
+    if (ops->readdir) tracing.readdir = trc_readdir;
+    if (ops->releasedir) tracing.releasedir = trc_releasedir;
+    if (ops->ioctl) tracing.ioctl = trc_ioctl;
+    if (ops->getxattr) tracing.getxattr = trc_getxattr;
+    tracing.destroy = trc_destroy;
+    return &tracing;
+}
+
 int main(int argc, char *argv[])
 {
-    int fuse_stat = fuse_main(argc, argv, &operations, NULL);
-    return fuse_stat;
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, &options, tmpfs_opts, NULL) == -1) {
+        return 1;
+    }
+
+    if (!options.spill_path != !options.memory_limit_mb) {
+        fprintf(stderr, "Ошибка: --spill и --memory-limit задаются вместе.\n");
+        return 1;
+    }
+    // Файл открывается до fuse_daemonize, который меняет рабочий каталог
+    if (options.spill_path
+        && !spill_open(options.spill_path, (size_t)options.memory_limit_mb << 20)) {
+        return 1;
+    }
+    page_alloc_use_huge_pages(options.huge_pages);
+
+    Filesystem* fs;
+    if (options.restore_image && !canonical_path(options.restore_image, restore_path)) {
+        perror(options.restore_image);
+        return 1;
+    }
+    // С журналом образа до первого checkpoint ещё нет: начинаем с пустого дерева
+    if (options.restore_image && (!options.journal_path || access(restore_path, F_OK) == 0)) {
+        // Восстанавливаем до монтирования: читаются только метаданные образа
+        fs = restore_snapshot(restore_path);
+        if (fs == NULL) {
+            return 1;
+        }
+    } else {
+        fs = init_filesystem();
+    }
+    // Заполняется до журнала: журнал хранит изменения поверх начального дерева
+    if (options.populate_dir) {
+        int threads = options.populate_threads ? (int)options.populate_threads
+                                               : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (!populate_from_host(fs, options.populate_dir, threads)) {
+            return 1;
+        }
+    }
+    if (options.journal_path && !journal_replay(fs, options.journal_path)) {
+        return 1;
+    }
+
+    struct fuse_operations* ops = &operations;
+    void* user_data = fs;
+    if (options.freeze) {
+        user_data = freeze_and_release(fs);
+        if (user_data == NULL) {
+            return 1;
+        }
+        ops = &frozen_operations;
+        fuse_opt_add_arg(&args, "-oro");
+    }
+    // Файл открывается до fuse_daemonize, который меняет рабочий каталог
+    if (options.trace_path) {
+        if (!trace_open(options.trace_path)) {
+            return 1;
+        }
+        ops = traced_operations(ops);
+    }
+
+    // fuse_main без его цикла: запросы обрабатывают наши потоки
+    char* mountpoint;
+    int multithreaded;
+    struct fuse* fuse = fuse_setup(args.argc, args.argv, ops, sizeof(*ops), &mountpoint,
+                                   &multithreaded, user_data);
+    fuse_opt_free_args(&args);
+    if (fuse == NULL) {
+        return 1;
+    }
+    unsigned int threads = options.workers ? options.workers : (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+    int res = run_workers(fuse, multithreaded ? threads : 1, options.pin_cpus);
+    fuse_teardown(fuse, mountpoint);
+    return res == 0 ? 0 : 1;
 }
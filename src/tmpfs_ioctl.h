@@ -0,0 +1,133 @@
+#ifndef TMPFS_IOCTL_H
+#define TMPFS_IOCTL_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// Управляющие команды демона. Выполняются через ioctl на любом файле
+// или каталоге внутри точки монтирования (обычно на её корне).
+
+#define TMPFS_IOC_MAGIC 'T'
+#define TMPFS_IOC_PATH_MAX 4096
+#define TMPFS_IOC_BATCH_SIZE 12288
+
+// Путь на стороне хоста
+struct tmpfs_ioc_path {
+    char path[TMPFS_IOC_PATH_MAX];
+};
+
+// Клонирование внутри точки монтирования, пути от её корня ("/dir/file").
+// length == 0 - FICLONE: dst (создаётся при отсутствии) становится копией src.
+// Иначе copy_file_range; в length возвращается число скопированных байт.
+// Данные не копируются: страницы разделяются до первой записи.
+struct tmpfs_ioc_clone {
+    char src[2048];
+    char dst[2048];
+    int64_t src_offset;
+    int64_t dst_offset;
+    uint64_t length;
+};
+
+// Выгрузка поддерева src в tar-архив dst (путь хоста: файл или FIFO)
+struct tmpfs_ioc_export {
+    char src[2048];
+    char dst[2048];
+    uint64_t bytes;  // сколько байт записано
+};
+
+// Индекс имён каталога path (от корня точки монтирования): ordered 1 - включить,
+// 0 - выключить. Подкаталоги, созданные потом, наследуют режим.
+struct tmpfs_ioc_order {
+    char path[2048];
+    uint32_t ordered;
+};
+
+// Имена каталога dir по возрастанию (побайтно, как strcmp) из [start, end),
+// начинающиеся с prefix; пустые start, end и prefix не ограничивают. "." и ".."
+// не входят. В buf - count имён подряд, каждое с '\0'; more != 0 - влезли
+// не все, продолжение - со start = последнее имя + "\x01".
+// Каталог без индекса сортируется на каждый вызов.
+struct tmpfs_ioc_scan {
+    char dir[2048];
+    char start[256];
+    char end[256];
+    char prefix[256];
+    uint32_t count;
+    uint32_t more;
+    char buf[TMPFS_IOC_BATCH_SIZE];
+};
+
+// Статистика демона
+struct tmpfs_ioc_stats {
+    uint64_t inodes;
+    uint64_t data_bytes;      // сумма размеров файлов
+    uint64_t page_size;
+    uint64_t pages;           // страниц данных в куче
+    uint64_t mapped_pages;    // страниц образа с дескриптором; нетронутые не считаются
+    uint64_t page_refs;       // ссылок из файлов на страницы
+    uint64_t dedup_indexed;
+    uint64_t dedup_merged;
+    uint64_t dedup_zero;
+    uint64_t compressed_pages;
+    uint64_t compressed_bytes;  // сколько занимают сжатые копии
+    uint64_t cached_pages;      // разжатые копии сжатых страниц
+    uint64_t resident_pages;    // страницы кучи, данные которых в памяти (в т.ч. сжатые)
+    uint64_t spilled_pages;     // страницы в файле подкачки
+    uint64_t heap_bytes;        // память кучи под данные файлов
+    uint64_t memory_limit;      // бюджет памяти, 0 - без подкачки
+    uint64_t spill_evictions;
+    uint64_t spill_page_ins;
+    uint64_t arena_bytes;       // отображено под буферы страниц
+    uint64_t arena_free_pages;  // из них свободно
+    uint64_t reclaim_pending_files;  // удалённые файлы, чьи страницы ещё освобождаются
+    uint64_t reclaim_pending_pages;
+    uint64_t reads;        // операций чтения и записи, сумма по потокам
+    uint64_t read_bytes;
+    uint64_t writes;
+    uint64_t write_bytes;
+    uint64_t lookups;      // поисков по пути
+    uint64_t lookup_hits;  // из них найдено в кэше потока
+    uint64_t readahead_pages;  // подготовлено упреждающим чтением
+    uint64_t frozen_bytes;     // замороженное дерево целиком, 0 - изменяемое
+};
+
+// Пакет путей внутри точки монтирования: count строк подряд, каждая с '\0'.
+// CREATE: путь с '/' на конце - каталог, иначе обычный файл; mode - права
+// (0 - 0644 и 0755). Останавливается на первой ошибке: done - сколько
+// создано, error - errno неудачного пути.
+// STAT: в начало buf записываются count записей tmpfs_ioc_stat_entry.
+struct tmpfs_ioc_batch {
+    uint32_t count;
+    uint32_t mode;
+    uint32_t done;
+    int32_t error;
+    char buf[TMPFS_IOC_BATCH_SIZE];
+};
+
+struct tmpfs_ioc_stat_entry {
+    int32_t error;  // 0 или errno
+    uint32_t mode;
+    uint64_t ino;
+    uint64_t nlink;
+    uint64_t size;
+    uint32_t uid;
+    uint32_t gid;
+};
+
+#define TMPFS_IOC_STAT_MAX (TMPFS_IOC_BATCH_SIZE / sizeof(struct tmpfs_ioc_stat_entry))
+
+#define TMPFS_IOC_CHECKPOINT _IOW(TMPFS_IOC_MAGIC, 1, struct tmpfs_ioc_path)
+#define TMPFS_IOC_CLONE _IOWR(TMPFS_IOC_MAGIC, 2, struct tmpfs_ioc_clone)
+#define TMPFS_IOC_STATS _IOR(TMPFS_IOC_MAGIC, 3, struct tmpfs_ioc_stats)
+// Дедупликация всех файлов (и тех, что записаны до --dedup)
+#define TMPFS_IOC_DEDUP _IO(TMPFS_IOC_MAGIC, 4)
+// Рекурсивное удаление каталога (или файла), путь от корня точки монтирования
+#define TMPFS_IOC_RMTREE _IOW(TMPFS_IOC_MAGIC, 5, struct tmpfs_ioc_path)
+#define TMPFS_IOC_CREATE _IOWR(TMPFS_IOC_MAGIC, 6, struct tmpfs_ioc_batch)
+#define TMPFS_IOC_STAT _IOWR(TMPFS_IOC_MAGIC, 7, struct tmpfs_ioc_batch)
+// Выполняется без общей блокировки: снимок берётся внутри
+#define TMPFS_IOC_EXPORT _IOWR(TMPFS_IOC_MAGIC, 8, struct tmpfs_ioc_export)
+#define TMPFS_IOC_ORDER _IOW(TMPFS_IOC_MAGIC, 9, struct tmpfs_ioc_order)
+#define TMPFS_IOC_SCAN _IOWR(TMPFS_IOC_MAGIC, 10, struct tmpfs_ioc_scan)
+
+#endif /* TMPFS_IOCTL_H */
@@ -0,0 +1,423 @@
+// Утилита управления смонтированным tmpfs через ioctl.
+// tmpfsctl <точка монтирования> <команда> [аргументы]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tmpfs_ioctl.h"
+#include "fifo.h"
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Использование: %s <mountpoint> <команда> [аргументы]\n"
+            "  checkpoint <image>   сохранить образ файловой системы\n"
+            "  clone <src> <dst>    клонировать файл без копирования данных\n"
+            "  copy <src> <dst> <src_off> <dst_off> <len>\n"
+            "                       copy_file_range внутри демона\n"
+            "  stats                статистика использования памяти\n"
+            "  dedup                дедуплицировать страницы всех файлов\n"
+            "  rmtree <path>        удалить каталог со всем содержимым\n"
+            "  create [-m mode] [path...]\n"
+            "                       создать файлы (и каталоги, если путь кончается на /)\n"
+            "  stat [path...]       вывести inode, режим, число ссылок и размер\n"
+            "  export <path> <archive|->\n"
+            "                       выгрузить поддерево в tar (\"-\" - на стандартный вывод)\n"
+            "  order <dir> on|off   держать имена каталога отсортированными\n"
+            "  scan [-p prefix] [-f from] [-t to] <dir>\n"
+            "                       имена каталога по возрастанию: с префиксом, из [from, to)\n"
+            "Без путей create и stat читают их со стандартного ввода, по одному в строке.\n"
+            "Пути src и dst задаются от корня точки монтирования.\n",
+            prog);
+}
+
+// Демон работает с путями хоста из своего рабочего каталога, поэтому
+// относительные пути переводим в абсолютные
+static int host_path(const char *path, struct tmpfs_ioc_path *out) {
+    char resolved[PATH_MAX];
+    if (path[0] == '/') {
+        snprintf(out->path, sizeof(out->path), "%s", path);
+        return 0;
+    }
+    if (getcwd(resolved, sizeof(resolved)) == NULL) {
+        return -1;
+    }
+    if ((size_t)snprintf(out->path, sizeof(out->path), "%s/%s", resolved, path) >= sizeof(out->path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int cmd_checkpoint(int fd, int argc, char **argv) {
+    if (argc != 1) return -2;
+    struct tmpfs_ioc_path request;
+    memset(&request, 0, sizeof(request));
+    if (host_path(argv[0], &request) != 0) return -1;
+    return ioctl(fd, TMPFS_IOC_CHECKPOINT, &request);
+}
+
+// Путь внутри точки монтирования: "dir/file" -> "/dir/file"
+static int mount_path(const char *path, char *out, size_t size) {
+    const char *slash = path[0] == '/' ? "" : "/";
+    if ((size_t)snprintf(out, size, "%s%s", slash, path) >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int cmd_clone(int fd, int argc, char **argv) {
+    if (argc != 2 && argc != 5) return -2;
+    struct tmpfs_ioc_clone request;
+    memset(&request, 0, sizeof(request));
+    if (mount_path(argv[0], request.src, sizeof(request.src)) != 0
+        || mount_path(argv[1], request.dst, sizeof(request.dst)) != 0) {
+        return -1;
+    }
+    if (argc == 5) {
+        request.src_offset = strtoll(argv[2], NULL, 0);
+        request.dst_offset = strtoll(argv[3], NULL, 0);
+        request.length = strtoull(argv[4], NULL, 0);
+        if (request.length == 0) return 0;
+    }
+    if (ioctl(fd, TMPFS_IOC_CLONE, &request) != 0) return -1;
+    if (argc == 5) printf("%llu\n", (unsigned long long)request.length);
+    return 0;
+}
+
+static int cmd_stats(int fd, int argc, char **argv) {
+    if (argc != 0) return -2;
+    struct tmpfs_ioc_stats stats;
+    if (ioctl(fd, TMPFS_IOC_STATS, &stats) != 0) return -1;
+
+    uint64_t physical = stats.pages + stats.mapped_pages;
+    uint64_t shared = stats.page_refs > physical ? stats.page_refs - physical : 0;
+    printf("inodes:          %llu\n", (unsigned long long)stats.inodes);
+    printf("file data:       %llu bytes\n", (unsigned long long)stats.data_bytes);
+    if (stats.frozen_bytes) {
+        printf("frozen:          %llu bytes in total, read only\n", (unsigned long long)stats.frozen_bytes);
+        printf("operations:      %llu reads (%llu bytes)\n", (unsigned long long)stats.reads,
+               (unsigned long long)stats.read_bytes);
+        return 0;
+    }
+    printf("heap pages:      %llu (%llu bytes)\n", (unsigned long long)stats.pages,
+           (unsigned long long)(stats.pages * stats.page_size));
+    printf("image pages:     %llu\n", (unsigned long long)stats.mapped_pages);
+    printf("page references: %llu\n", (unsigned long long)stats.page_refs);
+    printf("dedup ratio:     %.2f\n", physical ? (double)stats.page_refs / physical : 1.0);
+    printf("bytes saved:     %llu (shared pages) + %llu (zero pages)\n",
+           (unsigned long long)(shared * stats.page_size),
+           (unsigned long long)(stats.dedup_zero * stats.page_size));
+    printf("dedup index:     %llu pages, %llu merged\n", (unsigned long long)stats.dedup_indexed,
+           (unsigned long long)stats.dedup_merged);
+    printf("compressed:      %llu pages in %llu bytes, %llu cached\n",
+           (unsigned long long)stats.compressed_pages, (unsigned long long)stats.compressed_bytes,
+           (unsigned long long)stats.cached_pages);
+    printf("resident pages:  %llu, heap %llu bytes\n", (unsigned long long)stats.resident_pages,
+           (unsigned long long)stats.heap_bytes);
+    printf("page arena:      %llu bytes mapped, %llu free pages\n",
+           (unsigned long long)stats.arena_bytes, (unsigned long long)stats.arena_free_pages);
+    printf("operations:      %llu reads (%llu bytes), %llu writes (%llu bytes)\n",
+           (unsigned long long)stats.reads, (unsigned long long)stats.read_bytes,
+           (unsigned long long)stats.writes, (unsigned long long)stats.write_bytes);
+    printf("path lookups:    %llu, %.1f%% from thread caches\n", (unsigned long long)stats.lookups,
+           stats.lookups ? 100.0 * stats.lookup_hits / stats.lookups : 0.0);
+    if (stats.readahead_pages) {
+        printf("readahead:       %llu pages decompressed or paged in ahead\n",
+               (unsigned long long)stats.readahead_pages);
+    }
+    if (stats.reclaim_pending_files) {
+        printf("reclaiming:      %llu files, %llu pages\n", (unsigned long long)stats.reclaim_pending_files,
+               (unsigned long long)stats.reclaim_pending_pages);
+    }
+    if (stats.memory_limit) {
+        printf("spilled pages:   %llu of limit %llu bytes (%llu evictions, %llu page-ins)\n",
+               (unsigned long long)stats.spilled_pages, (unsigned long long)stats.memory_limit,
+               (unsigned long long)stats.spill_evictions, (unsigned long long)stats.spill_page_ins);
+    }
+    return 0;
+}
+
+static int cmd_rmtree(int fd, int argc, char **argv) {
+    if (argc != 1) return -2;
+    struct tmpfs_ioc_path request;
+    memset(&request, 0, sizeof(request));
+    if (mount_path(argv[0], request.path, sizeof(request.path)) != 0) return -1;
+    return ioctl(fd, TMPFS_IOC_RMTREE, &request);
+}
+
+// Пути берутся из аргументов или, если их нет, построчно со стандартного ввода
+typedef struct PathSource{
+    int argc;
+    char **argv;
+    char line[TMPFS_IOC_PATH_MAX];
+} PathSource;
+
+static const char* next_path(PathSource *source) {
+    if (source->argv) {
+        return source->argc-- > 0 ? *source->argv++ : NULL;
+    }
+    while (fgets(source->line, sizeof(source->line), stdin)) {
+        source->line[strcspn(source->line, "\n")] = '\0';
+        if (source->line[0]) return source->line;
+    }
+    return NULL;
+}
+
+// Складывает пути в пакет, пока они помещаются (для stat - не больше max)
+static const char* fill_batch(struct tmpfs_ioc_batch *batch, PathSource *source, const char *pending,
+                              uint32_t max) {
+    size_t used = 0;
+    batch->count = 0;
+    const char *path = pending ? pending : next_path(source);
+    while (path && batch->count < max) {
+        char full[TMPFS_IOC_PATH_MAX];
+        if (mount_path(path, full, sizeof(full)) != 0) return NULL;
+        size_t length = strlen(full) + 1;
+        if (used + length > sizeof(batch->buf)) break;
+        memcpy(batch->buf + used, full, length);
+        used += length;
+        batch->count++;
+        path = next_path(source);
+    }
+    return path;
+}
+
+static int cmd_create(int fd, int argc, char **argv) {
+    struct tmpfs_ioc_batch *batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) return -1;
+    if (argc >= 2 && strcmp(argv[0], "-m") == 0) {
+        batch->mode = strtoul(argv[1], NULL, 8);
+        argc -= 2;
+        argv += 2;
+    }
+    PathSource source = {argc, argc ? argv : NULL, ""};
+    const char *pending = NULL;
+    unsigned long long created = 0;
+    int result = 0;
+    do {
+        pending = fill_batch(batch, &source, pending, UINT32_MAX);
+        if (batch->count == 0) break;
+        if (ioctl(fd, TMPFS_IOC_CREATE, batch) != 0) {
+            result = -1;
+            break;
+        }
+        created += batch->done;
+        if (batch->error) {
+            // Неудачный путь - done-й в пакете
+            const char *path = batch->buf;
+            for (uint32_t i = 0; i < batch->done; i++) path += strlen(path) + 1;
+            fprintf(stderr, "%s: %s\n", path, strerror(batch->error));
+            errno = batch->error;
+            result = -1;
+            break;
+        }
+    } while (pending);
+    printf("%llu created\n", created);
+    free(batch);
+    return result;
+}
+
+static int cmd_stat(int fd, int argc, char **argv) {
+    struct tmpfs_ioc_batch *batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) return -1;
+    PathSource source = {argc, argc ? argv : NULL, ""};
+    const char *pending = NULL;
+    char *names = malloc(sizeof(batch->buf));
+    if (names == NULL) {
+        free(batch);
+        return -1;
+    }
+    int result = 0;
+    do {
+        pending = fill_batch(batch, &source, pending, TMPFS_IOC_STAT_MAX);
+        if (batch->count == 0) break;
+        memcpy(names, batch->buf, sizeof(batch->buf));
+        if (ioctl(fd, TMPFS_IOC_STAT, batch) != 0) {
+            result = -1;
+            break;
+        }
+        struct tmpfs_ioc_stat_entry *entries = (struct tmpfs_ioc_stat_entry *)batch->buf;
+        const char *name = names;
+        for (uint32_t i = 0; i < batch->count; i++, name += strlen(name) + 1) {
+            if (entries[i].error) {
+                printf("%s: %s\n", name, strerror(entries[i].error));
+                continue;
+            }
+            printf("%llu %o %llu %llu %s\n", (unsigned long long)entries[i].ino, entries[i].mode,
+                   (unsigned long long)entries[i].nlink, (unsigned long long)entries[i].size, name);
+        }
+    } while (pending);
+    free(names);
+    free(batch);
+    return result;
+}
+
+static int export_to(int fd, struct tmpfs_ioc_export *request) {
+    if (ioctl(fd, TMPFS_IOC_EXPORT, request) != 0) return -1;
+    fprintf(stderr, "%llu bytes\n", (unsigned long long)request->bytes);
+    return 0;
+}
+
+typedef struct ExportRequest{
+    int fd;
+    struct tmpfs_ioc_export *request;
+} ExportRequest;
+
+static int export_request(void *arg) {
+    ExportRequest *export = arg;
+    return ioctl(export->fd, TMPFS_IOC_EXPORT, export->request) == 0 ? 0 : errno;
+}
+
+// Демон пишет только в путь хоста, поэтому для вывода в поток создаём FIFO
+// (см. fifo.h)
+static int export_to_stdout(int fd, struct tmpfs_ioc_export *request) {
+    char dir[] = "/tmp/tmpfsctl.XXXXXX";
+    if (mkdtemp(dir) == NULL) return -1;
+    snprintf(request->dst, sizeof(request->dst), "%s/export.tar", dir);
+    if (mkfifo(request->dst, 0600) != 0) {
+        rmdir(dir);
+        return -1;
+    }
+    ExportRequest export = {fd, request};
+    fflush(stdout);
+    int result = pump_fifo(request->dst, export_request, &export, STDOUT_FILENO);
+    int error = errno;
+    unlink(request->dst);
+    rmdir(dir);
+    errno = error;
+    return result;
+}
+
+static int cmd_export(int fd, int argc, char **argv) {
+    if (argc != 2) return -2;
+    struct tmpfs_ioc_export request;
+    memset(&request, 0, sizeof(request));
+    if (mount_path(argv[0], request.src, sizeof(request.src)) != 0) return -1;
+    if (strcmp(argv[1], "-") == 0) return export_to_stdout(fd, &request);
+
+    struct tmpfs_ioc_path archive;
+    if (host_path(argv[1], &archive) != 0) return -1;
+    if ((size_t)snprintf(request.dst, sizeof(request.dst), "%s", archive.path) >= sizeof(request.dst)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return export_to(fd, &request);
+}
+
+static int cmd_order(int fd, int argc, char **argv) {
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) return -2;
+    struct tmpfs_ioc_order request;
+    memset(&request, 0, sizeof(request));
+    if (mount_path(argv[0], request.path, sizeof(request.path)) != 0) return -1;
+    request.ordered = strcmp(argv[1], "on") == 0;
+    return ioctl(fd, TMPFS_IOC_ORDER, &request);
+}
+
+// Границы не длиннее имени файла, иначе ничего не совпадёт
+static int scan_bound(char *out, size_t size, const char *value) {
+    if ((size_t)snprintf(out, size, "%s", value) >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int cmd_scan(int fd, int argc, char **argv) {
+    struct tmpfs_ioc_scan *request = calloc(1, sizeof(*request));
+    if (request == NULL) return -1;
+    int result = 0;
+    for (; argc >= 3 && argv[0][0] == '-'; argc -= 2, argv += 2) {
+        char *bound = strcmp(argv[0], "-p") == 0 ? request->prefix
+                    : strcmp(argv[0], "-f") == 0 ? request->start
+                    : strcmp(argv[0], "-t") == 0 ? request->end : NULL;
+        if (bound == NULL) {
+            result = -2;
+            break;
+        }
+        if (scan_bound(bound, sizeof(request->prefix), argv[1]) != 0) result = -1;
+    }
+    if (result == 0 && argc != 1) result = -2;
+    if (result == 0 && mount_path(argv[0], request->dir, sizeof(request->dir)) != 0) result = -1;
+    while (result == 0) {
+        if (ioctl(fd, TMPFS_IOC_SCAN, request) != 0) {
+            result = -1;
+            break;
+        }
+        const char *name = request->buf;
+        const char *last = NULL;
+        for (uint32_t i = 0; i < request->count; i++, name += strlen(name) + 1) {
+            printf("%s\n", name);
+            last = name;
+        }
+        if (!request->more || last == NULL) break;
+        // Следующее возможное имя после last; имена короче 255 байт
+        size_t length = strlen(last);
+        if (length + 2 > sizeof(request->start)) {
+            errno = ENAMETOOLONG;
+            result = -1;
+            break;
+        }
+        memcpy(request->start, last, length);
+        request->start[length] = '\x01';
+        request->start[length + 1] = '\0';
+    }
+    free(request);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 2;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    int result;
+    const char *command = argv[2];
+    if (strcmp(command, "checkpoint") == 0) {
+        result = cmd_checkpoint(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "clone") == 0) {
+        result = cmd_clone(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "stats") == 0) {
+        result = cmd_stats(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "dedup") == 0) {
+        result = argc == 3 ? ioctl(fd, TMPFS_IOC_DEDUP) : -2;
+    } else if (strcmp(command, "rmtree") == 0) {
+        result = cmd_rmtree(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "create") == 0) {
+        result = cmd_create(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "stat") == 0) {
+        result = cmd_stat(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "export") == 0) {
+        result = cmd_export(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "order") == 0) {
+        result = cmd_order(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "scan") == 0) {
+        result = cmd_scan(fd, argc - 3, argv + 3);
+    } else if (strcmp(command, "copy") == 0) {
+        result = argc == 8 ? cmd_clone(fd, argc - 3, argv + 3) : -2;
+    } else {
+        result = -2;
+    }
+    close(fd);
+
+    if (result == -2) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (result != 0) {
+        perror(command);
+        return 1;
+    }
+    return 0;
+}
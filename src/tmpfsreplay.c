@@ -0,0 +1,346 @@
+// Воспроизведение трассы, записанной tmpfs --trace, и замер производительности.
+// tmpfsreplay [-m <mountpoint> | -i <image>] [-r] <trace>
+//   без -m запросы выполняет ядро файловой системы (filesystem.c) прямо в
+//   этом процессе; -i - начальное дерево из образа, иначе пустое;
+//   -m - системными вызовами в смонтированный экземпляр;
+//   -r - с записанными интервалами между запросами, иначе как можно быстрее.
+// Запросы идут по порядку в одном потоке. В конце печатается пропускная
+// способность и задержки по операциям рядом с записанными.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "filesystem.h"
+#include "snapshot.h"
+#include "usage.h"
+#include "trace.h"
+
+// Запрос не воспроизводится в этом режиме и в замер не входит
+#define REPLAY_SKIPPED INT_MIN
+#define MAX_OPEN_FILES 1024
+
+typedef struct OpStats{
+    uint64_t *latencies;   // воспроизведённые, нс
+    uint64_t *recorded;    // из трассы, нс
+    size_t count;
+    size_t capacity;
+} OpStats;
+
+typedef struct Replay{
+    Filesystem *fs;          // без -m
+    const char *mountpoint;  // с -m
+    char *buf;               // данные read и write
+    size_t buf_size;
+    struct { char *path; int fd; } files[MAX_OPEN_FILES];  // открытые по записям open
+    OpStats stats[TRACE_NUM_OPS];
+    uint64_t diverged;       // результат не совпал с записанным
+} Replay;
+
+static bool reserve_buffer(Replay *replay, uint64_t size) {
+    if (size <= replay->buf_size) return true;
+    char *buf = realloc(replay->buf, size);
+    if (buf == NULL) return false;
+    // Содержимое записей в трассе нет, пишется один и тот же узор
+    memset(buf + replay->buf_size, 'x', size - replay->buf_size);
+    replay->buf = buf;
+    replay->buf_size = size;
+    return true;
+}
+
+// Ядро файловой системы -----------------------------------------------------------
+
+static int replay_core(Replay *replay, const TraceRecord *record, const char *path, const char *new_path) {
+    Filesystem *fs = replay->fs;
+    Inode *node = NULL;
+    switch (record->op) {
+    case TRACE_MKNOD:
+        return make_node(fs, path, record->mode, 0, 0);
+    case TRACE_MKDIR:
+        return make_directory(fs, path, record->mode, 0, 0);
+    case TRACE_UNLINK:
+        return unlink_node(fs, path);
+    case TRACE_RMDIR:
+        return remove_directory(fs, path);
+    case TRACE_RENAME:
+        return rename_node(fs, path, new_path);
+    case TRACE_LINK:
+        return link_node(fs, path, new_path);
+    case TRACE_RELEASE:
+    case TRACE_RELEASEDIR:
+    case TRACE_IOCTL:
+        return REPLAY_SKIPPED;
+    default:
+        break;
+    }
+
+    node = get_inode_by_path(path, fs->inodes_list);
+    if (node == NULL) return -ENOENT;
+    switch (record->op) {
+    case TRACE_OPEN:
+        return is_dir(node) ? -EISDIR : 0;
+    case TRACE_OPENDIR:
+        return is_dir(node) ? 0 : -ENOTDIR;
+    case TRACE_READ:
+        if (!reserve_buffer(replay, record->size)) return -ENOMEM;
+        return read_node(node, replay->buf, record->size, record->offset);
+    case TRACE_WRITE:
+        if (!reserve_buffer(replay, record->size)) return -ENOMEM;
+        return write_node(node, replay->buf, record->size, record->offset);
+    case TRACE_TRUNCATE:
+        return truncate_node(node, record->offset);
+    case TRACE_UTIMENS: {
+        struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
+        return set_node_times(node, times);
+    }
+    case TRACE_FALLOCATE:
+        return fallocate_node(node, record->mode, record->offset, record->size);
+    case TRACE_GETXATTR:
+        if (!reserve_buffer(replay, record->size)) return -ENOMEM;
+        return usage_xattr(node, new_path, replay->buf, record->size);
+    case TRACE_READDIR: {
+        if (!is_dir(node)) return -ENOTDIR;
+        // Как tmp_readdir: каждое имя проходит через буфер
+        Directory *dir = node->data;
+        for (int i = next_entry(dir, 0); i >= 0; i = next_entry(dir, i + 1)) {
+            if (!reserve_buffer(replay, MAX_FILE_NAME)) return -ENOMEM;
+            strcpy(replay->buf, dir->entries[i].name);
+        }
+        return 0;
+    }
+    default:  // TRACE_GETATTR
+        return 0;
+    }
+}
+
+// Смонтированный экземпляр -----------------------------------------------------------
+
+static int find_file(Replay *replay, const char *path) {
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (replay->files[i].path && strcmp(replay->files[i].path, path) == 0) return i;
+    }
+    return -1;
+}
+
+// Дескриптор от записанного open или временный (*temporary)
+static int file_fd(Replay *replay, const char *full, const char *path, int flags, bool *temporary) {
+    int slot = find_file(replay, path);
+    *temporary = slot < 0;
+    return slot >= 0 ? replay->files[slot].fd : open(full, flags);
+}
+
+static int replay_open(Replay *replay, const char *full, const char *path, int flags) {
+    int fd = open(full, flags & (O_ACCMODE | O_APPEND | O_TRUNC));
+    if (fd < 0) return -errno;
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (replay->files[i].path == NULL) {
+            replay->files[i].path = strdup(path);
+            replay->files[i].fd = fd;
+            return 0;
+        }
+    }
+    close(fd);  // таблица полна - дальше временными дескрипторами
+    return 0;
+}
+
+static int replay_release(Replay *replay, const char *path) {
+    int slot = find_file(replay, path);
+    if (slot < 0) return 0;
+    close(replay->files[slot].fd);
+    free(replay->files[slot].path);
+    replay->files[slot].path = NULL;
+    return 0;
+}
+
+static int replay_readdir(const char *full) {
+    DIR *dir = opendir(full);
+    if (dir == NULL) return -errno;
+    while (readdir(dir) != NULL) {
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int replay_mount(Replay *replay, const TraceRecord *record, const char *path, const char *new_path) {
+    char full[PATH_MAX], new_full[PATH_MAX];
+    snprintf(full, sizeof(full), "%s%s", replay->mountpoint, path);
+    snprintf(new_full, sizeof(new_full), "%s%s", replay->mountpoint, new_path);
+    struct stat st;
+    bool temporary = false;
+    int fd, res;
+    switch (record->op) {
+    case TRACE_GETATTR:
+        return lstat(full, &st) == 0 ? 0 : -errno;
+    case TRACE_MKNOD:
+        return mknod(full, record->mode, 0) == 0 ? 0 : -errno;
+    case TRACE_MKDIR:
+        return mkdir(full, record->mode & 07777) == 0 ? 0 : -errno;
+    case TRACE_UNLINK:
+        return unlink(full) == 0 ? 0 : -errno;
+    case TRACE_RMDIR:
+        return rmdir(full) == 0 ? 0 : -errno;
+    case TRACE_RENAME:
+        return rename(full, new_full) == 0 ? 0 : -errno;
+    case TRACE_LINK:
+        return link(full, new_full) == 0 ? 0 : -errno;
+    case TRACE_OPEN:
+        return replay_open(replay, full, path, record->mode);
+    case TRACE_RELEASE:
+        return replay_release(replay, path);
+    case TRACE_TRUNCATE:
+        return truncate(full, record->offset) == 0 ? 0 : -errno;
+    case TRACE_UTIMENS:
+        return utimensat(AT_FDCWD, full, NULL, 0) == 0 ? 0 : -errno;
+    case TRACE_GETXATTR:
+        if (!reserve_buffer(replay, record->size)) return -ENOMEM;
+        res = lgetxattr(full, new_path, replay->buf, record->size);
+        return res < 0 ? -errno : res;
+    case TRACE_READDIR:
+        // Ядро дробит листинг на несколько readdir; повторяем его целиком один раз
+        return record->offset == 0 ? replay_readdir(full) : REPLAY_SKIPPED;
+    case TRACE_READ:
+    case TRACE_WRITE:
+    case TRACE_FALLOCATE:
+        if (!reserve_buffer(replay, record->size)) return -ENOMEM;
+        fd = file_fd(replay, full, path, record->op == TRACE_READ ? O_RDONLY : O_WRONLY, &temporary);
+        if (fd < 0) return -errno;
+        if (record->op == TRACE_READ) res = pread(fd, replay->buf, record->size, record->offset);
+        else if (record->op == TRACE_WRITE) res = pwrite(fd, replay->buf, record->size, record->offset);
+        else res = fallocate(fd, record->mode, record->offset, record->size);
+        if (res < 0) res = -errno;
+        if (temporary) close(fd);
+        return res;
+    default:  // opendir и releasedir входят в replay_readdir, ioctl не повторяется
+        return REPLAY_SKIPPED;
+    }
+}
+
+// Замер --------------------------------------------------------------------------------
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static bool add_sample(OpStats *stats, uint64_t latency, uint64_t recorded) {
+    if (stats->count == stats->capacity) {
+        size_t capacity = stats->capacity ? stats->capacity * 2 : 1024;
+        uint64_t *latencies = realloc(stats->latencies, capacity * sizeof(uint64_t));
+        if (latencies) stats->latencies = latencies;
+        uint64_t *recorded_latencies = realloc(stats->recorded, capacity * sizeof(uint64_t));
+        if (recorded_latencies) stats->recorded = recorded_latencies;
+        if (latencies == NULL || recorded_latencies == NULL) return false;
+        stats->capacity = capacity;
+    }
+    stats->latencies[stats->count] = latency;
+    stats->recorded[stats->count] = recorded;
+    stats->count++;
+    return true;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Перцентиль по отсортированному массиву, в микросекундах
+static double percentile(const uint64_t *sorted, size_t count, double fraction) {
+    size_t index = (size_t)(fraction * (count - 1));
+    return sorted[index] / 1000.0;
+}
+
+static void report(Replay *replay, uint64_t elapsed) {
+    uint64_t total = 0;
+    for (int op = 1; op < TRACE_NUM_OPS; op++) total += replay->stats[op].count;
+    printf("%llu operations in %.3f s: %.0f ops/s, %llu with a different result than recorded\n",
+           (unsigned long long)total, elapsed / 1e9, elapsed ? total * 1e9 / elapsed : 0.0,
+           (unsigned long long)replay->diverged);
+    printf("%-11s %10s %10s %10s %10s %12s\n", "op", "count", "p50 us", "p99 us", "max us", "recorded p50");
+    for (int op = 1; op < TRACE_NUM_OPS; op++) {
+        OpStats *stats = &replay->stats[op];
+        if (stats->count == 0) continue;
+        qsort(stats->latencies, stats->count, sizeof(uint64_t), compare_u64);
+        qsort(stats->recorded, stats->count, sizeof(uint64_t), compare_u64);
+        printf("%-11s %10zu %10.1f %10.1f %10.1f %12.1f\n", trace_op_name(op), stats->count,
+               percentile(stats->latencies, stats->count, 0.5), percentile(stats->latencies, stats->count, 0.99),
+               stats->latencies[stats->count - 1] / 1000.0, percentile(stats->recorded, stats->count, 0.5));
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Использование: %s [-m <mountpoint> | -i <image>] [-r] <trace>\n"
+            "  -m <mountpoint>  воспроизводить системными вызовами в смонтированный tmpfs\n"
+            "  -i <image>       начать с дерева из образа (без -m)\n"
+            "  -r               соблюдать записанные интервалы между запросами\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    Replay *replay = calloc(1, sizeof(Replay));
+    const char *image = NULL;
+    bool realtime = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:i:r")) != -1) {
+        if (opt == 'm') replay->mountpoint = optarg;
+        else if (opt == 'i') image = optarg;
+        else if (opt == 'r') realtime = true;
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || (replay->mountpoint && image)) {
+        usage(argv[0]);
+        return 2;
+    }
+    FILE *in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    TraceHeader header;
+    if (!trace_read_header(in, &header)) {
+        fprintf(stderr, "Ошибка: \"%s\" не трасса tmpfs.\n", argv[optind]);
+        return 1;
+    }
+    if (replay->mountpoint == NULL) {
+        replay->fs = image ? restore_snapshot(image) : init_filesystem();
+        if (replay->fs == NULL) return 1;
+    }
+
+    char *path = malloc(TRACE_PATH_MAX);
+    char *new_path = malloc(TRACE_PATH_MAX);
+    TraceRecord record;
+    uint64_t start = now_ns();
+    while (trace_read_record(in, &record, path, new_path)) {
+        if (realtime) {
+            uint64_t due = start + record.time_ns;
+            struct timespec wake = {(time_t)(due / 1000000000ull), (long)(due % 1000000000ull)};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+        }
+        uint64_t begin = now_ns();
+        int res = replay->fs ? replay_core(replay, &record, path, new_path)
+                             : replay_mount(replay, &record, path, new_path);
+        uint64_t latency = now_ns() - begin;
+        if (res == REPLAY_SKIPPED) continue;
+        if (res != record.result) replay->diverged++;
+        if (!add_sample(&replay->stats[record.op], latency, record.duration_ns)) {
+            fprintf(stderr, "Ошибка выделения памяти.\n");
+            return 1;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    fclose(in);
+    report(replay, elapsed);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+static int trace_fd = -1;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *buffer = NULL;
+static size_t used = 0;
+static uint64_t origin = 0;
+
+// Запись ----------------------------------------------------------------------
+
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Под trace_lock. Ошибка записи останавливает трассу, запросы идут дальше
+static void flush_buffer(void) {
+    if (used > 0 && !write_all(trace_fd, buffer, used)) {
+        perror("Ошибка записи трассы");
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    used = 0;
+}
+
+uint64_t trace_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+bool trace_open(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Не удалось открыть файл трассы");
+        return false;
+    }
+    buffer = malloc(TRACE_BUFFER_SIZE);
+    if (buffer == NULL) {
+        close(fd);
+        return false;
+    }
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.start_ns = (int64_t)now.tv_sec * 1000000000ll + now.tv_nsec;
+    if (!write_all(fd, (const char *)&header, sizeof(header))) {
+        perror("Ошибка записи трассы");
+        close(fd);
+        free(buffer);
+        buffer = NULL;
+        return false;
+    }
+    origin = trace_clock();
+    trace_fd = fd;
+    return true;
+}
+
+void trace_close(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        flush_buffer();
+        if (trace_fd >= 0) close(trace_fd);
+        trace_fd = -1;
+    }
+    free(buffer);
+    buffer = NULL;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_record(TraceOp op, const char *path, const char *new_path, int64_t offset, uint64_t size,
+                  uint32_t mode, uint64_t start, int result) {
+    uint64_t end = trace_clock();
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.time_ns = start - origin;
+    record.duration_ns = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t)(end - start);
+    record.result = result;
+    record.offset = offset;
+    record.size = size;
+    record.mode = mode;
+    record.op = op;
+    record.path_length = path ? (uint16_t)strnlen(path, UINT16_MAX) : 0;
+    record.new_path_length = new_path ? (uint16_t)strnlen(new_path, UINT16_MAX) : 0;
+    size_t length = sizeof(record) + record.path_length + record.new_path_length;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        if (used + length > TRACE_BUFFER_SIZE) flush_buffer();
+        memcpy(buffer + used, &record, sizeof(record));
+        if (record.path_length) memcpy(buffer + used + sizeof(record), path, record.path_length);
+        if (record.new_path_length) {
+            memcpy(buffer + used + sizeof(record) + record.path_length, new_path, record.new_path_length);
+        }
+        used += length;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Чтение ----------------------------------------------------------------------
+
+bool trace_read_header(FILE *in, TraceHeader *header) {
+    return fread(header, sizeof(*header), 1, in) == 1
+        && memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) == 0
+        && header->version >= 1 && header->version <= TRACE_VERSION;
+}
+
+bool trace_read_record(FILE *in, TraceRecord *record, char *path, char *new_path) {
+    if (fread(record, sizeof(*record), 1, in) != 1) return false;
+    if (record->op == 0 || record->op >= TRACE_NUM_OPS) return false;
+    if (fread(path, 1, record->path_length, in) != record->path_length) return false;
+    if (fread(new_path, 1, record->new_path_length, in) != record->new_path_length) return false;
+    path[record->path_length] = '\0';
+    new_path[record->new_path_length] = '\0';
+    return true;
+}
+
+const char* trace_op_name(TraceOp op) {
+    static const char *names[TRACE_NUM_OPS] = {
+        [TRACE_GETATTR] = "getattr", [TRACE_MKNOD] = "mknod", [TRACE_MKDIR] = "mkdir",
+        [TRACE_UNLINK] = "unlink", [TRACE_RMDIR] = "rmdir", [TRACE_RENAME] = "rename",
+        [TRACE_LINK] = "link", [TRACE_OPEN] = "open", [TRACE_READ] = "read",
+        [TRACE_WRITE] = "write", [TRACE_RELEASE] = "release", [TRACE_TRUNCATE] = "truncate",
+        [TRACE_UTIMENS] = "utimens", [TRACE_FALLOCATE] = "fallocate", [TRACE_OPENDIR] = "opendir",
+        [TRACE_READDIR] = "readdir", [TRACE_RELEASEDIR] = "releasedir", [TRACE_IOCTL] = "ioctl",
+        [TRACE_GETXATTR] = "getxattr",
+    };
+    return op > 0 && op < TRACE_NUM_OPS ? names[op] : "?";
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Трасса операций ------------------------------------------------------------
+// С --trace=<file> каждый запрос FUSE пишется записью: операция, пути,
+// смещение, размер, время прихода от начала трассы и длительность. Записи
+// копятся в общем буфере и уходят в файл, когда он заполнится, и при
+// размонтировании. Данные write не пишутся: для воспроизведения хватает длины.
+// tmpfsreplay прогоняет трассу через ядро файловой системы или через
+// смонтированный экземпляр.
+// Файл: [TraceHeader][TraceRecord, path, new_path]...
+
+#define TRACE_MAGIC "TMPFSTRC"
+// 2 - добавлен getxattr; трассы версии 1 читаются как есть
+#define TRACE_VERSION 2
+
+typedef enum TraceOp{
+    TRACE_GETATTR = 1,
+    TRACE_MKNOD,
+    TRACE_MKDIR,
+    TRACE_UNLINK,
+    TRACE_RMDIR,
+    TRACE_RENAME,
+    TRACE_LINK,
+    TRACE_OPEN,
+    TRACE_READ,
+    TRACE_WRITE,
+    TRACE_RELEASE,
+    TRACE_TRUNCATE,
+    TRACE_UTIMENS,
+    TRACE_FALLOCATE,
+    TRACE_OPENDIR,
+    TRACE_READDIR,
+    TRACE_RELEASEDIR,
+    TRACE_IOCTL,
+    TRACE_GETXATTR,
+    TRACE_NUM_OPS
+} TraceOp;
+
+typedef struct TraceHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t start_ns;     // CLOCK_REALTIME начала записи
+} TraceHeader;
+
+typedef struct TraceRecord{
+    uint64_t time_ns;     // приход запроса от начала трассы
+    uint32_t duration_ns;
+    int32_t result;       // что вернул колбэк
+    int64_t offset;       // read, write, fallocate, readdir; truncate - новый размер
+    uint64_t size;        // read, write, getxattr - длина; fallocate - длина диапазона
+    uint32_t mode;        // mknod, mkdir - режим; open - флаги; fallocate - режим; ioctl - команда
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t path_length;      // затем path и new_path без '\0'; getxattr - имя в new_path
+    uint16_t new_path_length;
+    uint16_t reserved2;
+} TraceRecord;
+
+bool trace_open(const char *path);
+// Сбрасывает буфер и закрывает файл
+void trace_close(void);
+// CLOCK_MONOTONIC в наносекундах; start для trace_record
+uint64_t trace_clock(void);
+void trace_record(TraceOp op, const char *path, const char *new_path, int64_t offset, uint64_t size,
+                  uint32_t mode, uint64_t start, int result);
+
+// Чтение трассы: path и new_path - буферы по TRACE_PATH_MAX байт
+#define TRACE_PATH_MAX 65536
+bool trace_read_header(FILE *in, TraceHeader *header);
+// false - конец файла или обрыв последней записи
+bool trace_read_record(FILE *in, TraceRecord *record, char *path, char *new_path);
+const char* trace_op_name(TraceOp op);
+
+#endif /* TRACE_H */
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "usage.h"
+
+// Разных владельцев не больше, чем инод, поэтому таблица заполнена
+// меньше чем наполовину и поиск с линейным пробированием короткий
+#define UID_SLOTS 2048
+
+typedef struct UidUsage{
+    uid_t uid;
+    bool used;
+    Usage usage;
+} UidUsage;
+
+static UidUsage uids[UID_SLOTS];
+
+// Владельцы -------------------------------------------------------------------
+
+static size_t uid_slot(uid_t uid) {
+    return ((uint32_t)uid * 2654435761u) & (UID_SLOTS - 1);
+}
+
+static UidUsage* find_uid(uid_t uid) {
+    size_t i = uid_slot(uid);
+    while (uids[i].used && uids[i].uid != uid) i = (i + 1) & (UID_SLOTS - 1);
+    return &uids[i];
+}
+
+// Освобождает слот, сдвигая назад записи, которые иначе стали бы недостижимы
+static void drop_uid(UidUsage *entry) {
+    size_t hole = entry - uids;
+    for (size_t i = (hole + 1) & (UID_SLOTS - 1); uids[i].used; i = (i + 1) & (UID_SLOTS - 1)) {
+        size_t home = uid_slot(uids[i].uid);
+        if (((i - home) & (UID_SLOTS - 1)) >= ((i - hole) & (UID_SLOTS - 1))) {
+            uids[hole] = uids[i];
+            hole = i;
+        }
+    }
+    uids[hole].used = false;
+}
+
+static void charge_uid(uid_t uid, int64_t bytes, int64_t inodes) {
+    UidUsage *entry = find_uid(uid);
+    if (!entry->used) {
+        entry->used = true;
+        entry->uid = uid;
+        entry->usage = (Usage){0, 0};
+    }
+    entry->usage.bytes += bytes;
+    entry->usage.inodes += inodes;
+    if (entry->usage.inodes == 0) drop_uid(entry);
+}
+
+Usage usage_of_uid(uid_t uid) {
+    UidUsage *entry = find_uid(uid);
+    return entry->used ? entry->usage : (Usage){0, 0};
+}
+
+void usage_reset(void) {
+    memset(uids, 0, sizeof(uids));
+}
+
+// Каталоги --------------------------------------------------------------------
+
+// Добавляет к dir и всем каталогам над ним. Глубина ограничена на случай
+// испорченного образа с циклом в родителях
+static void charge_dirs(Inode *dir, int64_t bytes, int64_t inodes) {
+    for (int depth = 0; dir && is_dir(dir) && depth <= MAX_INODES; depth++) {
+        Usage *usage = &((Directory *)dir->data)->usage;
+        usage->bytes += bytes;
+        usage->inodes += inodes;
+        if (dir->parent_node == dir) break;
+        dir = dir->parent_node;
+    }
+}
+
+static int64_t own_bytes(Inode *node) {
+    return is_dir(node) ? 0 : node->st->st_size;
+}
+
+// Что node добавляет каталогам над собой: у каталога - всё поддерево
+static Usage subtree_usage(Inode *node) {
+    if (is_dir(node)) return ((Directory *)node->data)->usage;
+    return (Usage){own_bytes(node), 1};
+}
+
+static bool counted(Inode *node) {
+    return is_dir(node) || node->st->st_nlink > 0;
+}
+
+void usage_set_size(Inode *node, off_t size) {
+    int64_t delta = size - node->st->st_size;
+    node->st->st_size = size;
+    if (delta == 0 || !counted(node)) return;
+    charge_dirs(node->parent_node, delta, 0);
+    charge_uid(node->st->st_uid, delta, 0);
+}
+
+void usage_created(Inode *node) {
+    int64_t bytes = own_bytes(node);
+    // Каталог считает и себя
+    charge_dirs(is_dir(node) ? node : node->parent_node, bytes, 1);
+    charge_uid(node->st->st_uid, bytes, 1);
+}
+
+static void forget(Inode *node) {
+    Usage usage = subtree_usage(node);
+    charge_dirs(node->parent_node, -usage.bytes, -usage.inodes);
+    charge_uid(node->st->st_uid, -own_bytes(node), -1);
+}
+
+void usage_moved(Inode *node, Inode *dir) {
+    if (node->parent_node == dir) return;
+    Usage usage = subtree_usage(node);
+    charge_dirs(node->parent_node, -usage.bytes, -usage.inodes);
+    node->parent_node = dir;
+    charge_dirs(dir, usage.bytes, usage.inodes);
+}
+
+// Живой каталог, где есть ещё одна ссылка на node
+static Inode* find_other_link(InodeContainer *container, Inode *node) {
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *dir = container->inode_table[i];
+        if (dir == NULL || !is_dir(dir) || dir->st->st_nlink == 0) continue;
+        Directory *entries = dir->data;
+        for (int slot = next_entry(entries, 0); slot >= 0; slot = next_entry(entries, slot + 1)) {
+            if (entries->entries[slot].node_number == node->node_number) return dir;
+        }
+    }
+    return NULL;
+}
+
+void usage_unlinked(InodeContainer *container, Inode *node, Inode *dir) {
+    if (is_dir(node) || node->st->st_nlink == 0) {
+        forget(node);
+        return;
+    }
+    if (node->parent_node != dir) return;
+    Inode *other = find_other_link(container, node);
+    if (other) usage_moved(node, other);
+}
+
+void usage_rebuild(Filesystem *fs) {
+    usage_reset();
+    InodeContainer *container = fs->inodes_list;
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = container->inode_table[i];
+        if (node && is_dir(node) && node->data) ((Directory *)node->data)->usage = (Usage){0, 0};
+    }
+    for (int i = 1; i <= MAX_INODES; i++) {
+        Inode *node = container->inode_table[i];
+        if (node && counted(node) && (!is_dir(node) || node->data)) usage_created(node);
+    }
+}
+
+// Атрибуты --------------------------------------------------------------------
+
+static bool usage_value(Inode *node, const char *name, int64_t *value) {
+    if (strncmp(name, USAGE_XATTR_PREFIX, strlen(USAGE_XATTR_PREFIX)) != 0) return false;
+    name += strlen(USAGE_XATTR_PREFIX);
+    Usage usage;
+    if (strncmp(name, "subtree_", 8) == 0 && is_dir(node)) {
+        usage = ((Directory *)node->data)->usage;
+        name += 8;
+    } else if (strncmp(name, "owner_", 6) == 0) {
+        usage = usage_of_uid(node->st->st_uid);
+        name += 6;
+    } else {
+        return false;
+    }
+    if (strcmp(name, "apparent_bytes") == 0) *value = usage.bytes;
+    else if (strcmp(name, "inodes") == 0) *value = usage.inodes;
+    else return false;
+    return true;
+}
+
+int usage_xattr(Inode *node, const char *name, char *value, size_t size) {
+    int64_t number;
+    if (!usage_value(node, name, &number)) return -ENODATA;
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%lld", (long long)number);
+    if (size == 0) return length;
+    if ((size_t)length > size) return -ERANGE;
+    memcpy(value, text, length);
+    return length;
+}
@@ -0,0 +1,48 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include "filesystem.h"
+
+// Учёт места -------------------------------------------------------------------
+// Каждый каталог держит суммарный размер файлов (st_size) и число инод своего
+// поддерева вместе с собой (Directory.usage), а для каждого uid то же самое
+// считается по всем инодам владельца. Рост и усечение файла, создание,
+// перенос и удаление поправляют суммы на разницу вдоль цепочки parent_node
+// до корня, поэтому ответ на вопрос "сколько занимает каталог" не обходит
+// дерево.
+// Файл с несколькими жёсткими ссылками учитывается один раз, в каталоге
+// parent_node. Удалённый, но ещё открытый файл уже не учитывается.
+// Таблица uid общая на процесс, как data_stats: init_filesystem и
+// usage_rebuild заводят её заново. Изменения - под блокировкой записи fs.
+// Наружу суммы видны атрибутами только для чтения:
+// user.tmpfs.subtree_{apparent_bytes,inodes} у каталога и
+// user.tmpfs.owner_{apparent_bytes,inodes} у любой иноды (по её владельцу),
+// значение - десятичное число. Байты - видимый размер, как du --apparent-size:
+// дыры, общие после clone и dedup и сжатые страницы считаются полностью.
+// Память страниц показывает tmpfsctl stats. В listxattr
+// их нет, чтобы cp -a и rsync -X не копировали их как обычные атрибуты.
+
+#define USAGE_XATTR_PREFIX "user.tmpfs."
+
+// Ставит размер файла и учитывает разницу
+void usage_set_size(Inode *node, off_t size);
+// Новая инода уже в своём каталоге
+void usage_created(Inode *node);
+// Запись node убрана из dir, nlink уже уменьшен. Последняя ссылка снимает
+// иноду с учёта; если ушла ссылка из parent_node, а другие остались, учёт
+// переезжает в каталог с одной из них (поиск по всем каталогам).
+// Каталоги с nlink == 0 - удаляемые, в них не переезжают.
+void usage_unlinked(InodeContainer *container, Inode *node, Inode *dir);
+// Переносит учёт node (у каталога - всего поддерева) в dir и делает dir
+// её parent_node
+void usage_moved(Inode *node, Inode *dir);
+// Сумма по инодам владельца uid
+Usage usage_of_uid(uid_t uid);
+// Пересчитывает всё с нуля, например после восстановления из образа
+void usage_rebuild(Filesystem *fs);
+void usage_reset(void);
+// getxattr атрибута name у node: длина значения, -ENODATA или -ERANGE.
+// size == 0 - только узнать длину. Под блокировкой чтения fs
+int usage_xattr(Inode *node, const char *name, char *value, size_t size);
+
+#endif /* USAGE_H */
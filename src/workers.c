@@ -0,0 +1,138 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np
+#define FUSE_USE_VERSION 28
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+
+#include "workers.h"
+#include "filesystem.h"
+#include "pagealloc.h"
+
+typedef struct Worker{
+    pthread_t thread;
+    struct fuse_session *se;
+    struct fuse_chan *ch;
+    int cpu;  // -1 - без закрепления
+    char *buf;
+} Worker;
+
+// Поток, вышедший из цикла, будит главный; тот проверяет, завершена ли сессия
+static sem_t finished;
+static int loop_error = 0;
+
+static void worker_cleanup(void *arg) {
+    Worker *worker = arg;
+    page_alloc_thread_cache(false);
+    free(worker->buf);
+    worker->buf = NULL;
+}
+
+static void* worker_thread(void *arg) {
+    Worker *worker = arg;
+    // Отменить поток можно только пока он ждёт запрос, не посреди обработки
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            fprintf(stderr, "Не удалось закрепить поток за процессором %d: %s\n", worker->cpu, strerror(err));
+        }
+    }
+    size_t bufsize = fuse_chan_bufsize(worker->ch);
+    worker->buf = malloc(bufsize);
+    if (worker->buf == NULL) {
+        fprintf(stderr, "Ошибка: Не удалось выделить буфер запроса.\n");
+        fuse_session_exit(worker->se);
+        sem_post(&finished);
+        return NULL;
+    }
+    page_alloc_thread_cache(true);
+    pthread_cleanup_push(worker_cleanup, worker);
+    while (!fuse_session_exited(worker->se)) {
+        struct fuse_chan *ch = worker->ch;
+        struct fuse_buf fbuf = {
+            .mem = worker->buf,
+            .size = bufsize,
+        };
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        int res = fuse_session_receive_buf(worker->se, &fbuf, &ch);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (res == -EINTR) continue;
+        if (res <= 0) {
+            if (res < 0) __atomic_store_n(&loop_error, -1, __ATOMIC_RELAXED);
+            fuse_session_exit(worker->se);
+            break;
+        }
+        // Все изменения в запросе получают одну метку времени
+        refresh_clock();
+        fuse_session_process_buf(worker->se, &fbuf, ch);
+    }
+    pthread_cleanup_pop(1);
+    sem_post(&finished);
+    return NULL;
+}
+
+// Процессоры, на которых процессу разрешено работать
+static int allowed_cpus(int *cpus, int max) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++) {
+        if (CPU_ISSET(cpu, &set)) cpus[count++] = cpu;
+    }
+    return count;
+}
+
+int run_workers(struct fuse *fuse, unsigned int threads, bool pin) {
+    struct fuse_session *se = fuse_get_session(fuse);
+    struct fuse_chan *ch = fuse_session_next_chan(se, NULL);
+    Worker *workers = calloc(threads, sizeof(Worker));
+    if (workers == NULL) {
+        fprintf(stderr, "Ошибка: Не удалось выделить память под потоки.\n");
+        return -1;
+    }
+    int cpus[CPU_SETSIZE];
+    int num_cpus = pin ? allowed_cpus(cpus, CPU_SETSIZE) : 0;
+    sem_init(&finished, 0, 0);
+
+    // Сигналы завершения должен получать главный поток, ждущий на семафоре
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    unsigned int started = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+        workers[started].se = se;
+        workers[started].ch = ch;
+        workers[started].cpu = num_cpus ? cpus[i % num_cpus] : -1;
+        if (pthread_create(&workers[started].thread, NULL, worker_thread, &workers[started]) != 0) {
+            fprintf(stderr, "Не удалось запустить поток обработки %u.\n", i);
+            continue;
+        }
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (started == 0) {
+        fprintf(stderr, "Ошибка: Не запущено ни одного потока обработки.\n");
+        loop_error = -1;
+    } else {
+        while (!fuse_session_exited(se)) sem_wait(&finished);
+    }
+    for (unsigned int i = 0; i < started; i++) pthread_cancel(workers[i].thread);
+    for (unsigned int i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+
+    sem_destroy(&finished);
+    free(workers);
+    fuse_session_reset(se);
+    return loop_error;
+}
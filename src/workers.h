@@ -0,0 +1,17 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdbool.h>
+
+struct fuse;
+
+// Цикл обработки запросов ----------------------------------------------------
+// Замена циклу из fuse_main: запросы из /dev/fuse читают threads потоков,
+// заданных заранее, а не пул libfuse. У каждого потока свой буфер запроса,
+// кэш буферов страниц, кэш поиска по пути и сегмент счётчиков. При pin
+// i-й поток закрепляется за i-м процессором из доступных процессу.
+// Возвращается, когда сессия завершена (размонтирование или сигнал);
+// 0 или -1 при ошибке чтения из канала.
+int run_workers(struct fuse *fuse, unsigned int threads, bool pin);
+
+#endif /* WORKERS_H */